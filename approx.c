@@ -0,0 +1,348 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "formula_internal.h"
+
+/*
+	Piecewise Chebyshev approximation of expensive formulas.
+
+	1 variable: the segment is bisected until the interpolating polynomial
+	on each piece meets the tolerance.
+	2 variables: the rectangle is divided into 1, 2x2, 4x4, ... equal parts
+	until all of them meet the tolerance.
+*/
+
+#define APPROX_DEGREE_1D 16
+#define APPROX_DEGREE_2D 12
+#define APPROX_MAX_DEPTH 12 /* 1 variable: pieces can be 2^12 times shorter than the segment */
+#define APPROX_MAX_GRID 32 /* 2 variables: at most 32x32 rectangles */
+
+struct _sampler
+{
+	formula F;
+	double *args;
+	double tolerance;
+};
+
+static double _sample(struct _sampler *S, double x, double y)
+{
+	S->args[0] = x;
+	S->args[1] = y;
+	return _formula_eval(S->F, S->args);
+}
+
+/* Chebyshev nodes of the first kind on [-1; 1] */
+static void _chebyshev_nodes(int n, double *t)
+{
+	int k;
+	for(k = 0; k < n; k ++)
+		t[k] = cos(M_PI * (k + 0.5) / n);
+}
+
+/* Coefficients c[j] of sum c[j] T_j(t) through (t[k], f[k]), k = 0..n-1, stride as in _chebyshev() */
+static void _chebyshev_coef(int n, const double *f, int f_stride, double *c, int c_stride)
+{
+	int j, k;
+	for(j = 0; j < n; j ++)
+	{
+		double sum = 0;
+		for(k = 0; k < n; k ++)
+			sum += f[k * f_stride] * cos(M_PI * j * (k + 0.5) / n);
+		c[j * c_stride] = sum * (j ? 2. : 1.) / n;
+	}
+}
+
+static double _chebyshev_value(const double *c, int n, double t)
+{
+	double b1 = 0, b2 = 0, b0;
+	int i;
+	for(i = n - 1; i > 0; i --)
+	{
+		b0 = 2 * t * b1 - b2 + c[i];
+		b2 = b1;
+		b1 = b0;
+	}
+	return t * b1 - b2 + c[0];
+}
+
+/*
+	1 variable.
+*/
+
+struct _pieces
+{
+	int count, capacity;
+	double *borders; /* count + 1 */
+	double *coef; /* count * (APPROX_DEGREE_1D + 1) */
+};
+
+static int _add_piece(struct _pieces *P, double a, double b, const double *c)
+{
+	const int n = APPROX_DEGREE_1D + 1;
+	if(P->count == P->capacity)
+	{
+		int capacity = P->capacity ? P->capacity * 2 : 16;
+		double *borders = realloc(P->borders, sizeof(double) * (capacity + 1));
+		if(!borders) return 0;
+		P->borders = borders;
+
+		double *coef = realloc(P->coef, sizeof(double) * capacity * n);
+		if(!coef) return 0;
+		P->coef = coef;
+
+		P->capacity = capacity;
+	}
+
+	P->borders[P->count] = a;
+	P->borders[P->count + 1] = b;
+	memcpy(P->coef + P->count * n, c, sizeof(double) * n);
+	P->count ++;
+	return 1;
+}
+
+static int _approximate1(struct _sampler *S, struct _pieces *P, double a, double b, int depth)
+{
+	const int n = APPROX_DEGREE_1D + 1;
+	double t[n], f[n], c[n];
+	int k, ok = 1;
+
+	_chebyshev_nodes(n, t);
+	for(k = 0; k < n; k ++)
+		f[k] = _sample(S, (a + b) / 2 + (b - a) / 2 * t[k], 0);
+	_chebyshev_coef(n, f, 1, c, 1);
+
+	/* The last coefficients estimate the error; it is checked between the nodes too */
+	if(!(fabs(c[n - 1]) + fabs(c[n - 2]) <= S->tolerance / 2)) ok = 0;
+	for(k = 0; ok && k < n - 1; k += 4)
+	{
+		double tm = (t[k] + t[k + 1]) / 2;
+		double v = _sample(S, (a + b) / 2 + (b - a) / 2 * tm, 0);
+		if(!(fabs(v - _chebyshev_value(c, n, tm)) <= S->tolerance)) ok = 0;
+	}
+
+	if(!ok)
+	{
+		if(depth < APPROX_MAX_DEPTH)
+			return _approximate1(S, P, a, (a + b) / 2, depth + 1)
+				&& _approximate1(S, P, (a + b) / 2, b, depth + 1);
+
+		c[0] = NAN; /* the exact formula will be used here */
+	}
+	return _add_piece(P, a, b, c);
+}
+
+static struct _approx *_approx_1d(struct _sampler *S, double a, double b)
+{
+	const int n = APPROX_DEGREE_1D + 1;
+	struct _pieces P;
+	memset(&P, 0, sizeof(P));
+
+	struct _approx *A = NULL;
+	if(_approximate1(S, &P, a, b, 0))
+	{
+		size_t size = sizeof(struct _approx) + sizeof(double) * (P.count + 1 + P.count * n);
+		A = calloc(1, size);
+		if(A)
+		{
+			A->header.size = size;
+			A->dims = 1;
+			A->degree = APPROX_DEGREE_1D;
+			A->pieces[0] = P.count;
+			A->lo[0] = a;
+			A->hi[0] = b;
+			memcpy(A->data, P.borders, sizeof(double) * (P.count + 1));
+			memcpy(A->data + P.count + 1, P.coef, sizeof(double) * P.count * n);
+		}
+	}
+
+	free(P.borders);
+	free(P.coef);
+	return A;
+}
+
+/*
+	2 variables.
+*/
+
+/* Returns 1 if the rectangle meets the tolerance */
+static int _approximate2(struct _sampler *S, const double *lo, const double *hi, double *c)
+{
+	const int n = APPROX_DEGREE_2D + 1;
+	double t[n], f[n * n], tmp[n * n];
+	int i, j;
+
+	_chebyshev_nodes(n, t);
+	for(i = 0; i < n; i ++)
+		for(j = 0; j < n; j ++)
+			f[i * n + j] = _sample(S,
+				(lo[0] + hi[0]) / 2 + (hi[0] - lo[0]) / 2 * t[i],
+				(lo[1] + hi[1]) / 2 + (hi[1] - lo[1]) / 2 * t[j]);
+
+	/* Transform by y (rows), then by x (columns) */
+	for(i = 0; i < n; i ++)
+		_chebyshev_coef(n, f + i * n, 1, tmp + i * n, 1);
+	for(j = 0; j < n; j ++)
+		_chebyshev_coef(n, tmp + j, n, c + j, n);
+
+	double tail = 0;
+	for(i = 0; i < n; i ++)
+		for(j = 0; j < n; j ++)
+			if(i >= n - 2 || j >= n - 2)
+				tail += fabs(c[i * n + j]);
+
+	if(tail <= S->tolerance / 2) return 1;
+
+	c[0] = NAN;
+	return 0;
+}
+
+static struct _approx *_approx_2d(struct _sampler *S, const double *lo, const double *hi)
+{
+	const int n = APPROX_DEGREE_2D + 1;
+	int grid, i, j;
+
+	for(grid = 1; grid <= APPROX_MAX_GRID; grid *= 2)
+	{
+		size_t size = sizeof(struct _approx) + sizeof(double) * grid * grid * n * n;
+		struct _approx *A = calloc(1, size);
+		if(!A) return NULL;
+
+		A->header.size = size;
+		A->dims = 2;
+		A->degree = APPROX_DEGREE_2D;
+		A->pieces[0] = A->pieces[1] = grid;
+		memcpy(A->lo, lo, sizeof(double) * 2);
+		memcpy(A->hi, hi, sizeof(double) * 2);
+
+		int ok = 1;
+		for(i = 0; i < grid; i ++)
+			for(j = 0; j < grid; j ++)
+			{
+				double l[2], h[2];
+				l[0] = lo[0] + (hi[0] - lo[0]) * i / grid;
+				h[0] = lo[0] + (hi[0] - lo[0]) * (i + 1) / grid;
+				l[1] = lo[1] + (hi[1] - lo[1]) * j / grid;
+				h[1] = lo[1] + (hi[1] - lo[1]) * (j + 1) / grid;
+
+				if(!_approximate2(S, l, h, A->data + (i * grid + j) * n * n))
+					ok = 0;
+			}
+
+		/* On the finest grid, the exact formula is used where the tolerance is not met */
+		if(ok || grid * 2 > APPROX_MAX_GRID) return A;
+		free(A);
+	}
+	return NULL;
+}
+
+static formula _var_node(int name, symtable args)
+{
+	formula V = malloc(sizeof(struct _formula));
+	if(!V) return NULL;
+
+	V->action = F_VAR;
+	V->arg1 = (formula) (long) name;
+	V->arg2 = NULL;
+	V->other_args = NULL;
+	V->args = args;
+	V->refs = 1;
+	V->vars = symtable_new();
+	symtable_add_id(V->vars, name);
+	return V;
+}
+
+/* Names of the arguments of F, in the order of eval() parameters */
+static void _find_args(formula F, symtable args, int *names)
+{
+	int i;
+	if(F->action == F_TABLE || F->action == F_CONST) return;
+	if(F->action == F_VAR)
+	{
+		if(symtable_isset_id(args, _VAR_ID(F)))
+			names[symtable_order_id(args, _VAR_ID(F))] = _VAR_ID(F);
+		return;
+	}
+
+	_find_args(F->arg1, args, names);
+	if(F->arg2) _find_args(F->arg2, args, names);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			_find_args(F->other_args->arg[i], args, names);
+}
+
+formula formula_approximate(const formula F, const double *ranges, double tolerance)
+{
+	if(!F || !ranges || !(tolerance > 0)) return NULL;
+
+	int dims = formula_args(F), i;
+	int names[APPROX_MAX_VARS] = { 0, 0 };
+	if(dims < 1 || dims > APPROX_MAX_VARS) return NULL;
+
+	for(i = 0; i < dims; i ++)
+		if(!isfinite(ranges[2 * i]) || !isfinite(ranges[2 * i + 1]) || !(ranges[2 * i] < ranges[2 * i + 1]))
+			return NULL;
+
+	_find_args(F, F->args, names);
+	for(i = 0; i < dims; i ++)
+		if(!names[i]) return NULL;
+
+	struct _sampler S;
+	double args[APPROX_MAX_VARS + 1];
+	S.F = F;
+	S.args = args;
+	S.tolerance = tolerance;
+
+	struct _approx *A;
+	if(dims == 1)
+		A = _approx_1d(&S, ranges[0], ranges[1]);
+	else
+	{
+		double lo[2] = { ranges[0], ranges[2] }, hi[2] = { ranges[1], ranges[3] };
+		A = _approx_2d(&S, lo, hi);
+	}
+	if(!A) return NULL;
+
+	/* The result is F_APPROX node with the exact formula in arg1 */
+	formula R = formula_clone(F);
+	formula N = malloc(sizeof(struct _formula));
+	formula T = _table_alloc(A, R->args);
+	struct _other_args *vars = malloc(sizeof(struct _other_args));
+	formula *var_nodes = malloc(sizeof(formula) * dims);
+	if(!R || !N || !T || !vars || !var_nodes)
+	{
+		if(R) formula_free(R);
+		if(T) _formula_free(T); else free(A);
+		free(N);
+		free(vars);
+		free(var_nodes);
+		return NULL;
+	}
+
+	vars->count = dims;
+	vars->arg = var_nodes;
+	for(i = 0; i < dims; i ++)
+		var_nodes[i] = _var_node(names[i], R->args);
+
+	memcpy(N, R, sizeof(struct _formula));
+	R->vars = symtable_clone(N->vars);
+	R->action = F_APPROX;
+	R->arg1 = N;
+	R->arg2 = T;
+	R->other_args = vars;
+	return R;
+}
@@ -0,0 +1,329 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+
+#include "formula_internal.h"
+
+/*
+	Construction of formulas without parse().
+	Operands are consumed: on error they are freed (unless they are in the pool).
+*/
+
+static formula _node(mpool pool, int action, formula arg1, formula arg2)
+{
+	formula F = pool ? mpool_alloc(pool, sizeof(struct _formula)) : malloc(sizeof(struct _formula));
+	if(!F) return NULL;
+
+	F->action = action;
+	F->arg1 = arg1;
+	F->arg2 = arg2;
+	F->other_args = NULL;
+	F->args = NULL; /* see formula_finish() */
+	F->refs = 1;
+	F->vars = pool ? symtable_new_mpool(pool) : symtable_new();
+	if(!F->vars)
+	{
+		if(!pool) free(F);
+		return NULL;
+	}
+	return F;
+}
+
+static void _release(mpool pool, formula F)
+{
+	if(F && !pool) _formula_free(F);
+}
+
+static double *_number(mpool pool, double value)
+{
+	double *nr = pool ? mpool_alloc(pool, sizeof(double)) : malloc(sizeof(double));
+	if(nr) *nr = value;
+	return nr;
+}
+
+formula formula_const(mpool pool, double value)
+{
+	double *nr = _number(pool, value);
+	if(!nr) return NULL;
+
+	formula F = _node(pool, F_CONST, (formula) nr, NULL);
+	if(!F && !pool) free(nr);
+	return F;
+}
+
+formula formula_var(mpool pool, const char *name)
+{
+	int c = name ? symtable_id(name) : -1;
+	if(c == -1) return NULL; /* e.g. lowercase letter in case-sensitive mode */
+
+	formula F = _node(pool, F_VAR, (formula) (long) c, NULL);
+	if(!F) return NULL;
+
+	symtable_add_id(F->vars, c);
+	return F;
+}
+
+static int _unary(int action)
+{
+	switch(action)
+	{
+		case F_NOT: case F_SIN: case F_COS: case F_TAN: case F_CTG: case F_D2R:
+		case F_ASIN: case F_ACOS: case F_ATAN: case F_EXP:
+		case F_LN: case F_LG: case F_LOG2: case F_ABS:
+			return 1;
+	}
+	return 0;
+}
+
+static int _binary(int action)
+{
+	return action == F_ADD || action == F_SUB || action == F_MUL
+		|| action == F_DIV || action == F_POW;
+}
+
+formula formula_op(mpool pool, int action, formula arg1, formula arg2)
+{
+	int unary = _unary(action);
+	if(!arg1 || (unary ? arg2 != NULL : (!_binary(action) || !arg2)))
+	{
+		_release(pool, arg1);
+		_release(pool, arg2);
+		return NULL;
+	}
+
+	/* Operations on constants are calculated right away (unless the result is NAN) */
+	if(arg1->action == F_CONST && (unary || arg2->action == F_CONST))
+	{
+		double v = _calc(action, _get_const(arg1), unary ? 0 : _get_const(arg2));
+		if(!isnan(v))
+		{
+			*(double *) arg1->arg1 = v;
+			_release(pool, arg2);
+			return arg1;
+		}
+	}
+
+	formula F = _node(pool, action, arg1, arg2);
+	if(!F)
+	{
+		_release(pool, arg1);
+		_release(pool, arg2);
+		return NULL;
+	}
+
+	symtable_import(F->vars, arg1->vars);
+	if(arg2) symtable_import(F->vars, arg2->vars);
+	return F;
+}
+
+formula formula_integral(mpool pool, formula expr, const char *var, formula a, formula b)
+{
+	formula V = formula_var(pool, var), F = NULL;
+	struct _other_args *other = NULL;
+	formula *other_arg = NULL;
+
+	if(expr && V && a && b)
+	{
+		F = _node(pool, F_INTEGRAL, expr, a);
+		other = pool ? mpool_alloc(pool, sizeof(struct _other_args)) : malloc(sizeof(struct _other_args));
+		other_arg = pool ? mpool_alloc(pool, 2 * sizeof(formula)) : malloc(2 * sizeof(formula));
+	}
+	if(!F || !other || !other_arg)
+	{
+		if(F && !pool)
+		{
+			symtable_free(F->vars);
+			free(F);
+		}
+		if(!pool)
+		{
+			free(other);
+			free(other_arg);
+		}
+		_release(pool, expr);
+		_release(pool, V);
+		_release(pool, a);
+		_release(pool, b);
+		return NULL;
+	}
+
+	other->count = 2;
+	other->arg = other_arg;
+	other_arg[0] = b;
+	other_arg[1] = V;
+	F->other_args = other;
+
+	/* The integration variable is not a variable of the integral */
+	symtable_import(F->vars, expr->vars);
+	symtable_del_id(F->vars, _VAR_ID(V));
+	symtable_import(F->vars, a->vars);
+	symtable_import(F->vars, b->vars);
+	return F;
+}
+
+formula formula_derivative(mpool pool, formula expr, const char *by)
+{
+	formula V = formula_var(pool, by), F = NULL;
+	if(expr && V)
+		F = _node(pool, F_DERIVATIVE, expr, V);
+	if(!F)
+	{
+		_release(pool, expr);
+		_release(pool, V);
+		return NULL;
+	}
+
+	symtable_import(F->vars, expr->vars);
+	symtable_import(F->vars, V->vars);
+	return F;
+}
+
+formula formula_element(mpool pool, const char *array, int size)
+{
+	int first = array ? symtable_array(array, size) : -1, i;
+	if(first == -1) return NULL; /* e.g. the symtable doesn't support arrays */
+
+	formula V = _node(pool, F_VAR, (formula) (long) first, NULL);
+	if(!V) return NULL;
+	symtable_add_id(V->vars, first);
+
+	formula F = _node(pool, F_ELEMENT, V, NULL);
+	if(!F)
+	{
+		_release(pool, V);
+		return NULL;
+	}
+
+	/* The index is not known yet, so the element depends on all of them */
+	for(i = 0; i < size; i ++)
+		symtable_add_id(F->vars, first + i);
+	return F;
+}
+
+/*
+	Number of elements which use the index of the sum, -1 if some of them
+	can't be calculated by sum.c (the array is too short, or the element
+	is inside of an integral, etc.)
+*/
+static int _elements(formula F, int to)
+{
+	int count = 0, n, i;
+	switch(F->action)
+	{
+		case F_CONST:
+		case F_VAR:
+		case F_TABLE:
+		case F_SUM:
+		case F_PROD: /* elements of the nested sum use its own index */
+			return 0;
+
+		case F_ELEMENT:
+			return symtable_isset_id(F->vars, _VAR_ID(F->arg1) + to - 1) ? 1 : -1;
+	}
+
+	for(i = 0; i < 2 + (F->other_args ? F->other_args->count : 0); i ++)
+	{
+		formula arg = i == 0 ? F->arg1 : i == 1 ? F->arg2 : F->other_args->arg[i - 2];
+		if(!arg) continue;
+		if((n = _elements(arg, to)) == -1) return -1;
+		count += n;
+	}
+
+	if(count && (F->action < F_NOT || F->action > F_ABS
+		|| F->action == F_INTEGRAL || F->action == F_DERIVATIVE))
+			return -1; /* only operations are calculated element by element */
+	return count;
+}
+
+formula formula_sum(mpool pool, int action, formula body, int from, int to)
+{
+	formula F = NULL, a = NULL, b = NULL;
+	struct _other_args *other = NULL;
+	formula *other_arg = NULL;
+
+	if(body && (action == F_SUM || action == F_PROD) && from >= 1 && from <= to
+		&& _elements(body, to) != -1)
+	{
+		a = formula_const(pool, from);
+		b = formula_const(pool, to);
+		if(a && b) F = _node(pool, action, body, a);
+		other = pool ? mpool_alloc(pool, sizeof(struct _other_args)) : malloc(sizeof(struct _other_args));
+		other_arg = pool ? mpool_alloc(pool, sizeof(formula)) : malloc(sizeof(formula));
+	}
+	if(!F || !other || !other_arg)
+	{
+		if(F && !pool)
+		{
+			symtable_free(F->vars);
+			free(F);
+		}
+		if(!pool)
+		{
+			free(other);
+			free(other_arg);
+		}
+		_release(pool, body);
+		_release(pool, a);
+		_release(pool, b);
+		return NULL;
+	}
+
+	other->count = 1;
+	other->arg = other_arg;
+	other_arg[0] = b;
+	F->other_args = other;
+
+	symtable_import(F->vars, body->vars);
+	return F;
+}
+
+static int _set_args(formula F, symtable args)
+{
+	struct _node_stack S = { 0, 0, NULL };
+	int ok = _node_stack_push(&S, F);
+
+	while(ok && S.size)
+	{
+		formula N = S.node[-- S.size];
+		N->args = args;
+		ok = _node_stack_push_args(&S, N);
+	}
+	free(S.node);
+	return ok;
+}
+
+formula formula_finish(mpool pool, formula F)
+{
+	if(!F) return NULL;
+
+	symtable args = pool ? symtable_new_mpool(pool) : symtable_new();
+	if(!args)
+	{
+		_release(pool, F);
+		return NULL;
+	}
+	symtable_import(args, F->vars);
+	if(!_set_args(F, args))
+	{
+		if(!pool) symtable_free(args);
+		_release(pool, F);
+		return NULL;
+	}
+
+	/* Integrals without free variables are calculated (as in parse()) */
+	if(!pool) _fold_constants(F);
+	return F;
+}
@@ -18,8 +18,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
 
-#define _FORMULA_C
 #include "formula_internal.h"
 
 #include "integral.h"
@@ -48,62 +48,33 @@ const char *action_descriptions[] = {
 	"log10",
 	"log2",
 	"derivative",
-	"abs"
+	"abs",
+	"cubature",
+	"hoisted",
+	"table",
+	"memo",
+	"cumulative",
+	"approx",
+	"sum",
+	"prod",
+	"element",
+	"poly"
 };
 const int action_descriptions_last = sizeof(action_descriptions) / sizeof(char *) - 1;
 
 #define ACTION_DESCRIPTION(code) (code < 0 || code > action_descriptions_last) ? "unknown" : action_descriptions[code]
 
+static double _eval(const formula F, const double *args) __attribute__((fastcall nonnull(1)));
 static double _simpson_eval(formula F, const double *args, int steps) __attribute__((fastcall nonnull(1,2) const));
 static double _derivative_eval(formula F, const double *args, double offset) __attribute__((fastcall nonnull(1,2) const));
-
-char *_formula_string_p = ""; /* used in lex_rules.l */
-formula _formula_top = NULL; /* used in lex_rules.l */
-symtable _symtable_top = NULL; /* used in _alloc4 to fill in F->args */
-
-void yyparse();
-static void _formula_free(formula F);
-
-static int _init_symtable_top()
-{
-	_symtable_top = symtable_new();
-	if(!_symtable_top)
-	{
-		perror("Not enough memory.\n");
-		return 0;
-	}
-	return 1;
-}
-static void _free_symtable_top()
-{
-	free(_symtable_top);
-	_symtable_top = NULL;
-}
-
-/* Compile formula and return pointer for future use by eval() */
-formula parse(const char *code)
-{ /* This memory MUST be free()d by application */
-	if(!code) return NULL;
-	_formula_string_p = (char *) code;
-
-	_formula_top = NULL;
-	if(!_init_symtable_top())
-		return NULL;
-
-	yyparse();
-	if(!_formula_top)
-	{
-		_free_symtable_top(_symtable_top);
-		return NULL;
-	}
-
-	symtable_import(_symtable_top, _formula_top->vars);
-	_symtable_top = NULL;
-	return _formula_top;
-}
+static double _cubature_eval(formula F, const double *args) __attribute__((fastcall nonnull(1,2) const));
+static void _hoisted_refresh(formula F, const double *args) __attribute__((fastcall nonnull(1,2)));
+static double _memo_eval(formula F, const double *args) __attribute__((fastcall nonnull(1,2)));
+static double _cumulative_eval(formula F, const double *args) __attribute__((fastcall nonnull(1,2)));
+static double _approx_eval(formula F, const double *args) __attribute__((fastcall nonnull(1,2)));
 
 /* Apply an operation to two constants */
-static double _calc(F_TYPE action, double p1, double p2)
+double _calc(F_TYPE action, double p1, double p2)
 {
 	double t;
 	switch(action)
@@ -131,12 +102,6 @@ static double _calc(F_TYPE action, double p1, double p2)
 	return NAN;
 }
 
-/* F parameter MUST be F_CONST, or this call will fail */
-inline static double _get_const(formula F)
-{
-	return *(double *)F->arg1;
-}
-
 __attribute__((fastcall)) YYSTYPE _palloc4(mpool pool, F_TYPE type, YYSTYPE arg1, YYSTYPE arg2,  YYSTYPE arg3, YYSTYPE arg4)
 {
 	formula F;
@@ -201,6 +166,7 @@ optimization_disabled:
 		F->action = type;
 		F->arg1 = arg1;
 		F->arg2 = arg2;
+		F->refs = 1;
 
 		if(arg3)
 		{
@@ -216,17 +182,14 @@ optimization_disabled:
 		else
 			F->other_args = NULL;
 
-		F->args = _symtable_top;
+		F->args = NULL; /* set by formula_finish() or upgrade() */
 		F->vars = symtable_new();
 
 		if(F->action != F_CONST)
 		{
 			if(F->action == F_VAR)
 			{
-				char newvar[2];
-				newvar[0] = (int) F->arg1;
-				newvar[1] = '\0';
-				symtable_add(F->vars, newvar);
+				symtable_add_id(F->vars, _VAR_ID(F));
 			}
 			else
 			{
@@ -242,14 +205,16 @@ optimization_disabled:
 
 						E.g in $[2+A+B]dA|1_2 variable A is not needed.
 					*/
-					char oldvar[2];
-					oldvar[0] = (int) arg4->arg1;
-					oldvar[1] = '\0';
-
 #ifdef DEBUG
-					printf("DEBUG: do not need '%s'\n", oldvar);
+					printf("DEBUG: do not need '%s'\n", symtable_name(_VAR_ID(arg4)));
 #endif
-					symtable_del(F->vars, oldvar);
+					symtable_del_id(F->vars, _VAR_ID(arg4));
+
+					/*
+						Integral without free variables (e.g. $[sin(B)]dB|0_3.14)
+						can't be calculated here, because F->args is not yet known.
+						formula_finish() or optimize() will do it.
+					*/
 				}
 			}
 		}
@@ -263,8 +228,10 @@ optimization_disabled:
 
 formula _formula_clone(const formula F, const symtable args)
 {
+	int i;
 	formula N = malloc(sizeof(struct _formula));
 	memcpy(N, F, sizeof(struct _formula));
+	N->refs = 1;
 
 	if(F->action == F_CONST)
 	{
@@ -272,15 +239,25 @@ formula _formula_clone(const formula F, const symtable args)
 		*nr = *(double *) F->arg1;
 		N->arg1 = (formula) nr;
 	}
+	else if(F->action == F_TABLE)
+	{
+		size_t size = ((struct _table *) F->arg1)->size;
+		N->arg1 = malloc(size);
+		memcpy(N->arg1, F->arg1, size);
+	}
 	else if(F->action != F_VAR)
 	{
 		N->arg1 = _formula_clone(F->arg1, args);
 		if(F->arg2) N->arg2 = _formula_clone(F->arg2, args);
 		if(F->other_args)
 		{
-			N->other_args->arg[0] = _formula_clone(F->other_args->arg[0], args);
-			if(F->other_args->count > 1)
-				N->other_args->arg[1] = _formula_clone(F->other_args->arg[1], args);
+			/* 'other_args' must not be shared with F */
+			N->other_args = malloc(sizeof(struct _other_args));
+			N->other_args->count = F->other_args->count;
+			N->other_args->arg = malloc(sizeof(void *) * F->other_args->count);
+
+			for(i = 0; i < F->other_args->count; i ++)
+				N->other_args->arg[i] = _formula_clone(F->other_args->arg[i], args);
 		}
 	}
 
@@ -289,10 +266,110 @@ formula _formula_clone(const formula F, const symtable args)
 
 	return N;
 }
+/* Share the node with one more formula */
+static formula _ref(formula F)
+{
+	__sync_add_and_fetch(&F->refs, 1);
+	return F;
+}
+
 formula formula_clone(const formula F)
 {
+	int i;
 	if(!F) return NULL;
-	return _formula_clone(F, symtable_clone(F->args));
+	if(F->action == F_CONST || F->action == F_TABLE || F->action == F_VAR)
+		return formula_clone_deep(F);
+
+	/* Only the top-level node is copied, its arguments are shared */
+	formula N = malloc(sizeof(struct _formula));
+	if(!N) return NULL;
+	memcpy(N, F, sizeof(struct _formula));
+	N->refs = 1;
+
+	_ref(F->arg1);
+	if(F->arg2) _ref(F->arg2);
+	if(F->other_args)
+	{
+		N->other_args = malloc(sizeof(struct _other_args));
+		N->other_args->count = F->other_args->count;
+		N->other_args->arg = malloc(sizeof(void *) * F->other_args->count);
+
+		for(i = 0; i < F->other_args->count; i ++)
+			N->other_args->arg[i] = _ref(F->other_args->arg[i]);
+	}
+
+	N->vars = symtable_clone(F->vars);
+	if(F->args) N->args = symtable_ref(F->args);
+	return N;
+}
+
+formula formula_clone_deep(const formula F)
+{
+	if(!F) return NULL;
+	return _formula_clone(F, F->args ? symtable_clone(F->args) : NULL);
+}
+
+void _formula_threads(formula F, int threads, void *(*worker)(void *), void *workers, size_t size, size_t offset)
+{
+	int i;
+	pthread_t *tid = malloc(sizeof(pthread_t) * threads);
+	if(!tid) threads = 1;
+
+	/* Copies are made before any thread is started (F is used by workers[0]) */
+	for(i = 0; i < threads; i ++)
+		*(formula *) ((char *) workers + i * size + offset) = i ? formula_clone_deep(F) : F;
+
+	for(i = 1; i < threads; i ++)
+	{
+		formula *copy = (formula *) ((char *) workers + i * size + offset);
+		if(!*copy || pthread_create(&tid[i], NULL, worker, (char *) workers + i * size))
+			tid[i] = 0;
+	}
+	worker(workers);
+
+	for(i = 1; i < threads; i ++)
+	{
+		formula *copy = (formula *) ((char *) workers + i * size + offset);
+		if(tid[i]) pthread_join(tid[i], NULL);
+		if(*copy) formula_free(*copy);
+	}
+	free(tid);
+}
+
+/* Node 'F' (used by this formula only) and its arguments start using 'args' */
+static void _own_node(formula F, symtable args)
+{
+	int i;
+	F->args = args;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return;
+
+	formula *slots[2] = { &F->arg1, &F->arg2 };
+	for(i = 0; i < 2 + (F->other_args ? F->other_args->count : 0); i ++)
+	{
+		formula *slot = i < 2 ? slots[i] : &F->other_args->arg[i - 2];
+		if(!*slot) continue;
+
+		if(__sync_add_and_fetch(&(*slot)->refs, 0) > 1)
+		{ /* shared with other formulas: this formula gets its own copy */
+			formula copy = _formula_clone(*slot, args);
+			_formula_free(*slot);
+			*slot = copy;
+		}
+		else
+			_own_node(*slot, args);
+	}
+}
+
+void _formula_own(formula F, symtable args)
+{
+	if(!args)
+	{
+		if(!F->args || !symtable_shared(F->args)) return; /* nothing is shared */
+
+		args = symtable_clone(F->args);
+		symtable_free(F->args);
+	}
+	_own_node(F, args);
 }
 
 static void _dump(const formula F, int howdeep)
@@ -309,6 +386,8 @@ static void _dump(const formula F, int howdeep)
 	}
 	else if(F->action == F_CONST)
 		printf("%.2f\n", _get_const(F));
+	else if(F->action == F_TABLE)
+		printf("%lu bytes\n", (unsigned long) ((struct _table *) F->arg1)->size);
 	else
 	{
 		char *vars_dump = symtable_print(F->vars);
@@ -323,11 +402,8 @@ static void _dump(const formula F, int howdeep)
 		if(F->arg2) _dump(F->arg2, howdeep + 1);
 		if(F->other_args)
 		{
-			_dump(F->other_args->arg[0], howdeep + 1);
-			if(F->other_args->count > 1)
-			{
-				_dump(F->other_args->arg[1], howdeep + 1);
-			}
+			for(i = 0; i < F->other_args->count; i ++)
+				_dump(F->other_args->arg[i], howdeep + 1);
 		}
 	}
 }
@@ -345,32 +421,134 @@ void dump(const formula F)
 	}
 }
 
-static void _formula_free(formula F)
+int _node_stack_push(struct _node_stack *S, formula F)
 {
-	symtable_free(F->vars);
-	if(F->action == F_CONST)
+	if(S->size == S->capacity)
+	{
+		int capacity = S->capacity ? 2 * S->capacity : 64;
+		formula *node = realloc(S->node, sizeof(formula) * capacity);
+		if(!node) return 0;
+		S->node = node;
+		S->capacity = capacity;
+	}
+	S->node[S->size ++] = F;
+	return 1;
+}
+
+int _node_stack_push_args(struct _node_stack *S, formula F)
+{
+	int i;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return 1;
+
+	if(!_node_stack_push(S, F->arg1)) return 0;
+	if(F->arg2 && !_node_stack_push(S, F->arg2)) return 0;
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			if(!_node_stack_push(S, F->other_args->arg[i])) return 0;
+	return 1;
+}
+
+/* Arguments of F are pushed to S (or freed right now if there is no memory) */
+static void _release_args(formula F, struct _node_stack *S)
+{
+	int i;
+
+	if(F->action == F_CONST || F->action == F_TABLE)
 	{
 		free(F->arg1);
 	}
 	else if(F->action != F_VAR)
 	{
-		_formula_free(F->arg1);
-		if(F->arg2)
-		{
+		if(!_node_stack_push(S, F->arg1))
+			_formula_free(F->arg1);
+		if(F->arg2 && !_node_stack_push(S, F->arg2))
 			_formula_free(F->arg2);
-			if(F->other_args)
-			{
-				_formula_free(F->other_args->arg[0]);
-				if(F->other_args->count > 1)
-				{
-					_formula_free(F->other_args->arg[1]);
-				}
-			}
+		if(F->other_args)
+		{
+			for(i = 0; i < F->other_args->count; i ++)
+				if(!_node_stack_push(S, F->other_args->arg[i]))
+					_formula_free(F->other_args->arg[i]);
+			free(F->other_args->arg);
+			free(F->other_args);
 		}
 	}
+}
 
+/* Free all arguments of F, but not F itself */
+static void _formula_free_args(formula F)
+{
+	struct _node_stack S = { 0, 0, NULL };
+	_release_args(F, &S);
+
+	while(S.size)
+	{
+		formula N = S.node[-- S.size];
+		if(__sync_sub_and_fetch(&N->refs, 1) > 0) continue; /* used by other formulas */
+
+		_release_args(N, &S);
+		symtable_free(N->vars);
+		free(N);
+	}
+	free(S.node);
+}
+void _formula_free(formula F)
+{
+	if(__sync_sub_and_fetch(&F->refs, 1) > 0) return; /* used by other formulas */
+	_formula_free_args(F);
+	symtable_free(F->vars);
 	free(F);
 }
+
+/*
+	Replace F (which doesn't depend on any variables) with its value.
+	Returns 1 if F is now F_CONST, 0 if it can't be calculated.
+*/
+int _fold(formula F)
+{
+	if(F->action == F_CONST || F->action == F_TABLE || symtable_count(F->vars))
+		return 0;
+
+	/* Values of arguments are not used, but integrals copy them */
+	double *dummy = calloc(symtable_count(F->args) + 1, sizeof(double));
+	double *mem = malloc(sizeof(double));
+	if(!dummy || !mem)
+	{
+		free(dummy);
+		free(mem);
+		return 0;
+	}
+
+	*mem = _eval(F, dummy);
+	free(dummy);
+	if(isnanl(*mem))
+	{
+		free(mem);
+		return 0;
+	}
+
+	_formula_free_args(F);
+	F->action = F_CONST;
+	F->arg1 = (formula) mem;
+	F->arg2 = NULL;
+	F->other_args = NULL;
+	return 1;
+}
+
+/* Create F_TABLE node for the data block */
+formula _table_alloc(void *table, symtable args)
+{
+	formula F = malloc(sizeof(struct _formula));
+	if(!F) return NULL;
+
+	F->action = F_TABLE;
+	F->arg1 = (formula) table;
+	F->arg2 = NULL;
+	F->other_args = NULL;
+	F->vars = symtable_new();
+	F->args = args;
+	F->refs = 1;
+	return F;
+}
 void formula_free(formula F)
 {
 	if(F)
@@ -405,6 +583,38 @@ __attribute__((fastcall)) static double _eval(const formula F, const double *arg
 	{
 		return _derivative_eval(F, args, 0.01);
 	}
+	else if(F->action == F_CUBATURE)
+	{
+		return _cubature_eval(F, args);
+	}
+	else if(F->action == F_HOISTED)
+	{
+		return _get_const(F->arg2); /* calculated by _hoisted_refresh() */
+	}
+	else if(F->action == F_MEMO)
+	{
+		return _memo_eval(F, args);
+	}
+	else if(F->action == F_CUMULATIVE)
+	{
+		return _cumulative_eval(F, args);
+	}
+	else if(F->action == F_APPROX)
+	{
+		return _approx_eval(F, args);
+	}
+	else if(F->action == F_SUM || F->action == F_PROD)
+	{
+		return _sum_eval(F, args);
+	}
+	else if(F->action == F_POLY)
+	{
+		return _poly_eval(F, args);
+	}
+	else if(F->action == F_TABLE || F->action == F_ELEMENT)
+	{
+		return NAN; /* not a value (F_ELEMENT: only inside F_SUM or F_PROD) */
+	}
 
 	/* Operations */
 	p1 = _eval(F->arg1, args);
@@ -420,6 +630,11 @@ __attribute__((fastcall)) static double _eval(const formula F, const double *arg
 	return _calc(F->action, p1, p2);
 }
 
+double _formula_eval(const formula F, const double *args)
+{
+	return _eval(F, args);
+}
+
 double eval(const formula F, ...)
 {
 	double *args = NULL;
@@ -445,6 +660,7 @@ double eval(const formula F, ...)
 //	return _eval(F, args);
 
 	double d = _eval(F, args);
+	free(args);
 //	printf("eval() done. symtable_count(F->vars)=%i, symtable_count(F->args)=%i\n", symtable_count(F->vars), symtable_count(F->args));
 	return d;
 }
@@ -471,10 +687,8 @@ __attribute__((fastcall)) static double _simpson_eval(formula F, const double *a
 	formula expr = F->arg1;
 	double a = _eval(F->arg2, args);
 	double b = _eval(F->other_args->arg[0], args);
-	char variable[2];
-	variable[0] = (int) F->other_args->arg[1]->arg1;
-	variable[1] = '\0';
-	int var_order_in_args = symtable_order_raw(F->args, variable);
+	int variable = _VAR_ID(F->other_args->arg[1]);
+	int var_order_in_args = symtable_order_id(F->args, variable);
 
 	/* Deal with infinite values */
 	int a_isinf = isinf(a), b_isinf = isinf(b);
@@ -492,12 +706,12 @@ __attribute__((fastcall)) static double _simpson_eval(formula F, const double *a
 		args_copy[i] = args_copy[i - 1];
 	}
 
-//	printf("Integral by variable %s! №%i in args\n", variable, var_order_in_args);
+//	printf("Integral by variable %s! №%i in args\n", symtable_name(variable), var_order_in_args);
 
 	int swap = 1;
 	if(a > b)
 	{
-		int t = a;
+		double t = a;
 		a = b;
 		b = t;
 		swap = -1;
@@ -508,17 +722,20 @@ __attribute__((fastcall)) static double _simpson_eval(formula F, const double *a
 	int two_or_four = 4;
 
 	/* Temporarily: symtable_del() is being called when everything is done */
-	symtable_add(F->args, variable);
+	symtable_add_id(F->args, variable);
 
 	args_copy[var_order_in_args] = a;
+	_hoisted_refresh(expr, args_copy);
+
 	I = _eval(expr, args_copy);
 //	printf("F(%.2lf) = %.4lf\n", a, _eval(expr, args_copy));
 	args_copy[var_order_in_args] = b;
 	I += _eval(expr, args_copy);
 //	printf("F(%.2lf) = %.4lf\n", b, _eval(expr, args_copy));
 
-	for(x = a + step; x < b; x += step)
-	{
+	for(i = 1; i < steps; i ++)
+	{ /* not x += step: rounding errors would add an extra point near b */
+		x = a + i * step;
 		args_copy[var_order_in_args] = x;
 //		printf("args_copy[] = [ %lf, %lf ]\n", args_copy[0], args_copy[1]);
 //		printf("F(%.2lf) = %.4lf\n", x, _eval(expr, args_copy));
@@ -528,7 +745,7 @@ __attribute__((fastcall)) static double _simpson_eval(formula F, const double *a
 	}
 
 	/* Cleanup */
-	symtable_del(F->args, variable); /* F must not be modified by eval() call, so let's restore it's state */
+	symtable_del_id(F->args, variable); /* F must not be modified by eval() call, so let's restore it's state */
 	free(args_copy);
 
 	return swap * step * I / 3;
@@ -563,9 +780,368 @@ __attribute__((fastcall)) static double _derivative_eval(formula F, const double
 	return (b-a) / (2*offset);
 }
 
+/*
+	Calculate F_HOISTED nodes of the integrand 'F' (parts of it which
+	don't depend on the integration variable, see optimize()).
+	Called once per integral evaluation, before the integrand is sampled.
+
+	Nested integrals and derivatives refresh their own nodes,
+	so only the bounds of nested integrals are visited here.
+*/
+__attribute__((fastcall)) static void _hoisted_refresh(formula F, const double *args)
+{
+	int i;
+	switch(F->action)
+	{
+		case F_CONST:
+		case F_VAR:
+		case F_TABLE:
+		case F_DERIVATIVE:
+			return;
+
+		case F_HOISTED:
+			*(double *)F->arg2->arg1 = _eval(F->arg1, args);
+			return;
+
+		case F_INTEGRAL:
+		case F_CUBATURE:
+			break; /* only the bounds, see below */
+
+		default:
+			_hoisted_refresh(F->arg1, args);
+	}
+
+	if(F->arg2) _hoisted_refresh(F->arg2, args);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			_hoisted_refresh(F->other_args->arg[i], args);
+}
+
+/*
+	NOTE: F is the F_MEMO node created by formula_memoize():
+		F->arg1 is the formula being cached,
+		F->arg2 is F_TABLE with the cache.
+*/
+__attribute__((fastcall)) static double _memo_eval(formula F, const double *args)
+{
+	struct _memo *M = (struct _memo *) F->arg2->arg1;
+	int idx[MEMO_MAX_VARS], i;
+	double key[MEMO_MAX_VARS];
+	unsigned long long h = 0;
+
+	if(symtable_count(F->arg1->vars) != M->nvars)
+		return _eval(F->arg1, args);
+
+	symtable_orders(F->args, F->arg1->vars, idx);
+	for(i = 0; i < M->nvars; i ++)
+	{
+		unsigned long long bits;
+		key[i] = args[idx[i]];
+		memcpy(&bits, &key[i], sizeof(bits));
+
+		h = (h ^ bits) * 0x9e3779b97f4a7c15ULL;
+	}
+	/* Integer-valued keys have zero low bits: mix the high bits down */
+	h ^= h >> 32;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 29;
+
+	struct _memo_entry *e = &M->entry[h & (M->capacity - 1)];
+	if(e->used && !memcmp(e->key, key, sizeof(double) * M->nvars))
+	{
+		M->hits ++;
+		return e->value;
+	}
+
+	M->misses ++;
+	e->value = _eval(F->arg1, args);
+	memcpy(e->key, key, sizeof(double) * M->nvars);
+	e->used = 1;
+
+	return e->value;
+}
+
+struct _cumulative_integrand
+{
+	formula expr;
+	double *args;
+	int var_order;
+};
+static double _cumulative_integrand(void *ctx, double x)
+{
+	struct _cumulative_integrand *I = (struct _cumulative_integrand *) ctx;
+	I->args[I->var_order] = x;
+	return _eval(I->expr, I->args);
+}
+
+/*
+	NOTE: F is the F_CUMULATIVE node created by optimize():
+		F->arg1 is the integral, its integrand depends only on the integration variable
+			and the lower bound is constant,
+		F->arg2 is F_TABLE with the table of the antiderivative (struct _cumulative).
+*/
+__attribute__((fastcall)) static double _cumulative_eval(formula F, const double *args)
+{
+	formula N = F->arg1;
+	struct _cumulative *T = (struct _cumulative *) F->arg2->arg1;
+
+	double x = _eval(N->other_args->arg[0], args);
+	if(isnanl(x)) return NAN;
+
+	if(T->h == 0)
+	{ /* First call: the step is chosen so that [a; x] is divided into CUMULATIVE_INTERVALS cells */
+		double a = _eval(N->arg2, args);
+		if(isnanl(a)) return NAN;
+		if(x == a) return 0;
+		if(!isfinite(a) || !isfinite(x)) return _eval(N, args);
+
+		T->a = a;
+		T->h = fabs(x - a) / CUMULATIVE_INTERVALS;
+	}
+
+	double r = (x - T->a) / T->h;
+	if(!(fabs(r) < CUMULATIVE_MAX_CELLS))
+		return _eval(N, args); /* too far from the lower bound */
+
+	int k = (int) floor(r);
+	if(k < T->lo || k >= T->hi)
+	{
+		struct _cumulative_integrand I;
+		int variable = _VAR_ID(N->other_args->arg[1]);
+
+		/* Temporarily, as in _simpson_eval() */
+		symtable_add_id(N->args, variable);
+
+		I.expr = N->arg1;
+		I.var_order = symtable_order_id(N->args, variable);
+		I.args = calloc(symtable_count(N->args), sizeof(double)); /* the integrand has no other variables */
+
+		int ok = I.args && _cumulative_extend(&T, k, k + 1, _cumulative_integrand, &I);
+		F->arg2->arg1 = (formula) T;
+
+		symtable_del_id(N->args, variable);
+		free(I.args);
+
+		if(!ok) return _eval(N, args);
+	}
+	return _cumulative_value(T, x);
+}
+
+/* Sum of c[i] * T_i(t) for i = 0..n (Clenshaw's algorithm), stride is the distance between c[i] and c[i+1] */
+static inline double _chebyshev(const double *c, int n, int stride, double t)
+{
+	double b1 = 0, b2 = 0, b0;
+	int i;
+	for(i = n; i > 0; i --)
+	{
+		b0 = 2 * t * b1 - b2 + c[i * stride];
+		b2 = b1;
+		b1 = b0;
+	}
+	return t * b1 - b2 + c[0];
+}
+
+/*
+	NOTE: F is the F_APPROX node created by formula_approximate():
+		F->arg1 is the exact formula (used outside of the approximated region),
+		F->arg2 is F_TABLE with struct _approx,
+		F->other_args are the variables.
+*/
+__attribute__((fastcall)) static double _approx_eval(formula F, const double *args)
+{
+	const struct _approx *A = (const struct _approx *) F->arg2->arg1;
+	int n = A->degree + 1, i, k[APPROX_MAX_VARS];
+	double x[APPROX_MAX_VARS], t[APPROX_MAX_VARS];
+	const double *c;
+
+	for(i = 0; i < A->dims; i ++)
+	{
+		x[i] = _eval(F->other_args->arg[i], args);
+		if(!(x[i] >= A->lo[i] && x[i] <= A->hi[i]))
+			return _eval(F->arg1, args);
+	}
+
+	if(A->dims == 1)
+	{
+		/* Binary search of the piece */
+		const double *borders = A->data;
+		int lo = 0, hi = A->pieces[0];
+		while(hi - lo > 1)
+		{
+			int mid = (lo + hi) / 2;
+			if(x[0] < borders[mid]) hi = mid;
+			else lo = mid;
+		}
+
+		c = A->data + A->pieces[0] + 1 + lo * n;
+		if(isnanl(c[0])) return _eval(F->arg1, args);
+
+		t[0] = (2 * x[0] - borders[lo] - borders[lo + 1]) / (borders[lo + 1] - borders[lo]);
+		return _chebyshev(c, A->degree, 1, t[0]);
+	}
+
+	for(i = 0; i < 2; i ++)
+	{
+		double w = (A->hi[i] - A->lo[i]) / A->pieces[i];
+		k[i] = (int) ((x[i] - A->lo[i]) / w);
+		if(k[i] >= A->pieces[i]) k[i] = A->pieces[i] - 1;
+
+		double l = A->lo[i] + k[i] * w;
+		t[i] = (2 * (x[i] - l) - w) / w;
+	}
+
+	c = A->data + (k[0] * A->pieces[1] + k[1]) * n * n;
+	if(isnanl(c[0])) return _eval(F->arg1, args);
+
+	/* Coefficients of T_i(x) for the given y */
+	double cx[n];
+	for(i = 0; i < n; i ++)
+		cx[i] = _chebyshev(c + i * n, A->degree, 1, t[1]);
+
+	return _chebyshev(cx, A->degree, 1, t[0]);
+}
+
+/* Nodes and weights of n-point Gauss-Legendre rule on [-1; 1] */
+void _gauss_legendre(int n, double *x, double *w)
+{
+	int i, j, k;
+	for(i = 0; i < (n + 1) / 2; i ++)
+	{
+		double z = cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 1;
+
+		/* Newton's method for the i-th root of Legendre polynomial P_n */
+		for(k = 0; k < 100; k ++)
+		{
+			double p0 = 1, p1 = z, z_old = z;
+			for(j = 2; j <= n; j ++)
+			{
+				double p2 = ((2 * j - 1) * z * p1 - (j - 1) * p0) / j;
+				p0 = p1;
+				p1 = p2;
+			}
+			dp = n * (z * p1 - p0) / (z * z - 1);
+			z -= p1 / dp;
+			if(fabs(z - z_old) < 1e-15) break;
+		}
+
+		x[i] = -z;
+		x[n - 1 - i] = z;
+		w[i] = w[n - 1 - i] = 2 / ((1 - z * z) * dp * dp);
+	}
+}
+
+/*
+	NOTE: F is the cubature node created by optimize() from nested integrals:
+		F->arg1 is the integrand,
+		F->arg2 is the number of points (per dimension),
+		F->other_args are (lower bound, upper bound, variable) triples.
+*/
+__attribute__((fastcall)) static double _cubature_eval(formula F, const double *args)
+{
+	int dims = F->other_args->count / 3;
+	int n = _get_const(F->arg2);
+	int i, d;
+
+	if(dims > CUBATURE_MAX_DIMS || n < 1 || n > CUBATURE_MAX_POINTS) return NAN;
+
+	/*
+		Bounds don't depend on integration variables,
+		so they are calculated before the variables are added to F->args.
+	*/
+	double center[CUBATURE_MAX_DIMS], half[CUBATURE_MAX_DIMS], scale = 1;
+	for(d = 0; d < dims; d ++)
+	{
+		double a = _eval(F->other_args->arg[3 * d], args);
+		double b = _eval(F->other_args->arg[3 * d + 1], args);
+
+		/* Deal with infinite values (the same way as _simpson_eval() does) */
+		if(isinf(a)) a = 200 * isinf(a);
+		if(isinf(b)) b = 200 * isinf(b);
+		if(isnanl(a) || isnanl(b)) return NAN;
+
+		center[d] = (a + b) / 2;
+		half[d] = (b - a) / 2;
+		scale *= half[d];
+	}
+
+	int args_count = symtable_count(F->args);
+	int variable[CUBATURE_MAX_DIMS];
+	for(d = 0; d < dims; d ++)
+	{
+		variable[d] = _VAR_ID(F->other_args->arg[3 * d + 2]);
+
+		/* Temporarily: symtable_del() is being called when everything is done */
+		symtable_add_id(F->args, variable[d]);
+	}
+
+	/* Place of each integration variable in 'args_copy', other arguments fill the rest */
+	int total = symtable_count(F->args), slot[CUBATURE_MAX_DIMS];
+	double *args_copy = malloc(sizeof(double) * (total + 1));
+	char *is_var = calloc(total + 1, 1);
+	double I = NAN;
+	if(!args_copy || !is_var) goto cleanup;
+
+	for(d = 0; d < dims; d ++)
+	{
+		slot[d] = symtable_order_id(F->args, variable[d]);
+		is_var[slot[d]] = 1;
+	}
+	for(i = 0, d = 0; i < total; i ++)
+		if(!is_var[i] && d < args_count)
+			args_copy[i] = args[d ++];
+
+	/* All sample points: x[d][k] is k-th abscissa for dimension d */
+	double gx[CUBATURE_MAX_POINTS], gw[CUBATURE_MAX_POINTS];
+	double x[CUBATURE_MAX_DIMS][CUBATURE_MAX_POINTS];
+	_gauss_legendre(n, gx, gw);
+	for(d = 0; d < dims; d ++)
+		for(i = 0; i < n; i ++)
+			x[d][i] = center[d] + half[d] * gx[i];
+
+	/* Walk through the tensor-product grid, last dimension changes first */
+	int idx[CUBATURE_MAX_DIMS];
+	double w[CUBATURE_MAX_DIMS + 1]; /* w[d] is the product of weights of dimensions before d */
+	w[0] = 1;
+	for(d = 0; d < dims; d ++)
+	{
+		idx[d] = 0;
+		args_copy[slot[d]] = x[d][0];
+		w[d + 1] = w[d] * gw[0];
+	}
+	_hoisted_refresh(F->arg1, args_copy);
+
+	I = 0;
+	while(1)
+	{
+		I += w[dims] * _eval(F->arg1, args_copy);
+
+		for(d = dims - 1; d >= 0 && ++ idx[d] == n; d --)
+			idx[d] = 0;
+		if(d < 0) break;
+
+		for(; d < dims; d ++)
+		{
+			args_copy[slot[d]] = x[d][idx[d]];
+			w[d + 1] = w[d] * gw[idx[d]];
+		}
+	}
+	I *= scale;
+
+cleanup:
+	for(d = 0; d < dims; d ++)
+		symtable_del_id(F->args, variable[d]); /* F must not be modified by eval() call */
+	free(args_copy);
+	free(is_var);
+
+	return I;
+}
+
 void upgrade_derivative(formula *Fp, const char *by)
 {
-	formula by_f = _alloc1(F_VAR, (formula) (int) by[0]);
+	int id = symtable_id(by);
+	if(id == -1) return;
+
+	formula by_f = _alloc1(F_VAR, (formula) (long) id);
 	by_f->args = (*Fp)->args;
 	upgrade(F_DERIVATIVE, Fp, &by_f);
 }
@@ -620,6 +1196,17 @@ void upgrade(int action, ...)
 	}
 	va_end(params);
 
+	/* Nodes of the new formula must not be shared with other formulas, and all of them use P[0]->args */
+	_formula_own(*P[0], NULL);
+	for(i = 1; i < count; i ++)
+	{
+		symtable old = (*P[i])->args;
+		if(old == (*P[0])->args) continue;
+
+		_formula_own(*P[i], (*P[0])->args);
+		if(old) symtable_free(old);
+	}
+
 	formula ret = _alloc4(action, *P[0],
 		count > 1 ? *P[1] : NULL,
 		count > 2 ? *P[2] : NULL,
@@ -642,11 +1229,13 @@ void upgrade(int action, ...)
 	}
 }
 
-static void _reduce(formula F, const char *var, double val)
+static void _reduce(formula F, int var, double val)
 {
+	int i;
+
 	if(F->action == F_VAR)
 	{
-		if(symtable_isset(F->vars, var))
+		if(symtable_isset_id(F->vars, var))
 		{
 			symtable_clear(F->vars);
 
@@ -657,28 +1246,25 @@ static void _reduce(formula F, const char *var, double val)
 			F->arg1 = (formula) nr;
 		}
 	}
-	else if(F->action != F_CONST)
+	else if(F->action != F_CONST && F->action != F_TABLE)
 	{
 		_reduce(F->arg1, var, val);
 		if(F->arg2)
-		{
 			_reduce(F->arg2, var, val);
-			if(F->other_args)
-			{
-				_reduce(F->other_args->arg[0], var, val);
-				if(F->other_args->count > 1)
-				{
-					_reduce(F->other_args->arg[1], var, val);
-				}
-			}
+		if(F->other_args)
+		{
+			for(i = 0; i < F->other_args->count; i ++)
+				_reduce(F->other_args->arg[i], var, val);
 		}
-		symtable_del(F->vars, var);
+		symtable_del_id(F->vars, var);
 	}
 }
 void reduce(formula F, const char *var, double val)
 {
-	if(F) {
-		_reduce(F, var, val);
-		symtable_del(F->args, var);
+	int id = symtable_id(var);
+	if(F && id != -1) {
+		_formula_own(F, NULL);
+		_reduce(F, id, val);
+		symtable_del_id(F->args, id);
 	}
 }
@@ -46,18 +46,40 @@ typedef struct _formula
 
 	struct _symtable *vars; /* variables involved in current formula */
 	struct _symtable *args; /* 'vars' of most top-level formula: expected parameters to eval() */
+	int refs; /* number of formulas which use this node (see formula_clone()) */
 } *formula;
 
 /**
 	@brief Create formula object from text.
 	@param code Textual representation of the formula, e.g. "cos(A) + 3*B".
-	@returns Formula object.
+	@returns Formula object, NULL if \b code is not a valid formula.
 
-	@warning This function is not reentrant.
+	@note This function is reentrant (different threads can parse at the same time).
 	@note Returned memory must be formula_free()d by application.
 */
 formula parse(const char *code) __attribute__((malloc nonnull warn_unused_result)); /*  */
 
+/**
+	@brief Same as parse(), but reports where the error is.
+	@param pool Memory pool to allocate the formula from (or NULL, see formula_finish()).
+	@param code Textual representation of the formula.
+	@param error_pos Receives offset of the first character in \b code which couldn't be parsed,
+		-1 if there is no error (or if there was not enough memory). Can be NULL.
+	@returns Formula object, NULL on error.
+*/
+formula parse_checked(mpool pool, const char *code, int *error_pos) __attribute__((nonnull(2) warn_unused_result));
+
+/**
+	@brief Same as parse_checked(), but \b code is not NUL-terminated.
+	@param pool Memory pool (or NULL).
+	@param code Textual representation of the formula (e.g. a part of a larger text).
+	@param length Length of \b code in bytes.
+	@param error_pos Receives offset of the error in \b code or -1 (can be NULL).
+	@returns Formula object, NULL on error.
+	@note Only \b length bytes are read, so \b code can point into a read-only mmap()ed file.
+*/
+formula parse_n(mpool pool, const char *code, size_t length, int *error_pos) __attribute__((nonnull(2) warn_unused_result));
+
 
 /**
 	@brief Free all memory used by the formula object.
@@ -70,9 +92,22 @@ void formula_free(formula F) __attribute__((nonnull));
 	@param F Formula to be cloned.
 	@returns New formula object.
 	@note Returned memory must be formula_free()d by application.
+	@note The copy shares all nodes with F, so this takes O(1) time.
+		Shared nodes are copied when either formula is modified in place
+		(reduce(), upgrade(), optimize(), etc.)
+	@warning The copy can't be evaluated in another thread at the same time as F,
+		use formula_clone_deep() for that.
 */
 formula formula_clone(const formula F) __attribute__((malloc nonnull warn_unused_result));
 
+/**
+	@brief Create an independent copy of existing formula (nothing is shared with F).
+	@param F Formula to be cloned.
+	@returns New formula object, which can be used in another thread.
+	@note Returned memory must be formula_free()d by application.
+*/
+formula formula_clone_deep(const formula F) __attribute__((malloc nonnull warn_unused_result));
+
 /**
 	@brief Calculate the formula with all arguments specified.
 	@param F Formula to be evaluated.
@@ -95,6 +130,14 @@ double eval(const formula F, ...) __attribute__((const nonnull(1)));
 */
 double eval_array(const formula F, const double *args) __attribute__((nonnull(1)));
 
+/*
+	Accuracy of math functions (sin, exp, etc.) in batch evaluation,
+	see 'precision' in program.h.
+*/
+#define FORMULA_EXACT 0 /* the C library */
+#define FORMULA_FAST 1 /* error of at most 3.4 units in the last place (measured, see vecmath.c) */
+#define FORMULA_APPROX 2 /* relative error less than 1e-7 */
+
 /* TODO: Get rid of the ugly comment below by adressing the issue.
 
 	NOTE: even while 'F' parameter is declared 'const' here,
@@ -147,9 +190,93 @@ void upgrade(int action, ...); /* upgrade(F_ADD, &F1, &F2); // - the result is i
 	@param by Name of the argument to calculate derivative by (e.g. "Z").
 
 	@note Resulting formula will be placed into the first argument (*Fp).
+		Nothing is done if \b by is not a valid variable name.
 */
 void upgrade_derivative(formula *Fp, const char *by) __attribute__((nonnull));
 
+/*
+	Construction of formulas without parse(), e.g.
+		formula F = formula_finish(NULL, formula_op(NULL, F_MUL,
+			formula_const(NULL, 2), formula_op(NULL, F_SIN, formula_var(NULL, "X"), NULL)));
+	is the same as parse("2*sin(X)").
+
+	All functions take 'pool': if it's not NULL, the nodes are allocated there.
+	Such formula must not be formula_free()d or modified in place (reduce(), optimize(), etc.),
+	it's freed by mpool_free(pool). Use formula_clone_deep() to get a regular copy.
+
+	Operands are consumed (become parts of the result, or are freed on error).
+	If any operand is NULL (e.g. not enough memory), the result is NULL,
+	so only the result of formula_finish() has to be checked.
+*/
+
+/**
+	@brief Create formula node with the constant value.
+*/
+formula formula_const(mpool pool, double value) __attribute__((warn_unused_result));
+
+/**
+	@brief Create formula node with the variable.
+	@param pool Memory pool or NULL.
+	@param name Name of the variable (e.g. "X").
+	@returns The node, NULL if the name is not a valid variable name.
+*/
+formula formula_var(mpool pool, const char *name) __attribute__((warn_unused_result));
+
+/**
+	@brief Create formula node with the operation.
+	@param pool Memory pool or NULL.
+	@param action Operation, e.g. F_ADD or F_SIN (see formula_internal.h).
+	@param arg1 First operand.
+	@param arg2 Second operand (NULL for unary operations).
+	@returns The node, NULL if the action is unknown or the operands are missing.
+
+	@note Operations on constants are replaced with their values.
+*/
+formula formula_op(mpool pool, int action, formula arg1, formula arg2) __attribute__((warn_unused_result));
+
+/**
+	@brief Create the definite integral of 'expr' by variable 'var' from 'a' to 'b'.
+*/
+formula formula_integral(mpool pool, formula expr, const char *var, formula a, formula b)
+	__attribute__((warn_unused_result));
+
+/**
+	@brief Create the derivative of 'expr' by variable 'by'.
+*/
+formula formula_derivative(mpool pool, formula expr, const char *by) __attribute__((warn_unused_result));
+
+/**
+	@brief Create the element of the array 'array' (X[i] in "sum(i = 1..n, X[i])").
+	@param pool Memory pool or NULL.
+	@param array Name of the array (e.g. "X").
+	@param size Number of elements: X[1], ..., X[size].
+	@returns The node, NULL if arrays are not supported by the symtable (SYMTABLE = bitmask).
+	@note The index is the index of the sum (or product) which contains the element.
+	@note Elements of the array are consecutive arguments of the formula (see eval_array()).
+*/
+formula formula_element(mpool pool, const char *array, int size) __attribute__((warn_unused_result));
+
+/**
+	@brief Create the sum (or product) of 'body' for index from 'from' to 'to'.
+	@param pool Memory pool or NULL.
+	@param action F_SUM or F_PROD.
+	@param body Expression with elements of arrays (see formula_element()).
+	@param from First index (1 or more).
+	@param to Last index (arrays in 'body' must have at least 'to' elements).
+	@returns The node, NULL if 'body' can't be calculated element by element
+		(e.g. the element is inside of the integral).
+*/
+formula formula_sum(mpool pool, int action, formula body, int from, int to) __attribute__((warn_unused_result));
+
+/**
+	@brief Make the constructed formula ready for eval().
+	@param pool The same pool as in the calls which created F.
+	@param F Top-level node.
+	@returns F (NULL if F is NULL or there's not enough memory).
+	@note Must be called once, after the whole formula is constructed.
+*/
+formula formula_finish(mpool pool, formula F) __attribute__((warn_unused_result));
+
 /**
 	@brief Replace one of the arguments in F with the constant.
 	@param F Formula to be reduced.
@@ -159,7 +286,94 @@ void upgrade_derivative(formula *Fp, const char *by) __attribute__((nonnull));
 /* Replace a variable with the const value */
 void reduce(formula F, const char *var, double val) __attribute__((nonnull(1,2)));
 
-/* NOT YET IMPLEMENTED */
+/**
+	@brief Make a copy of F with some of the arguments replaced with constants.
+	@param F Formula object (not modified).
+	@param count Number of arguments to be replaced.
+	@param names Names of these arguments (e.g. "A", "C").
+	@param values Their values.
+	@returns New formula (must be formula_free()d), NULL if there's not enough memory.
+
+	@note Unlike reduce(), subexpressions which become constant
+		(including integrals with constant bounds) are replaced with their values.
+	@note Names of arguments not used in F are ignored.
+	@note The result is a full copy of F: nodes refer to the arguments of their formula,
+		and their order changes when some of them are removed, so no nodes can be shared with F.
+*/
+formula formula_specialize(const formula F, int count, const char *const *names, const double *values)
+	__attribute__((malloc nonnull(1) warn_unused_result));
+
+/**
+	@brief Make the formula faster to evaluate (modifies it in place).
+	@param F Formula to be optimized.
+
+	@note Nested integrals with independent bounds, e.g.
+		$[ $[ f(A,B) ]dA|0_1 ]dB|0_1,
+		are fused into one multi-dimensional Gauss-Legendre cubature.
+		Results may slightly differ from the ones calculated by Simpson's rule.
+	@note Parts of the integrand which don't depend on the integration
+		variable are calculated once per integral, e.g.
+		$[ g(A,C) * h(B) ]dB|0_3 becomes g(A,C) * $[ h(B) ]dB|0_3.
+	@note Integrals and derivatives without free variables are replaced
+		with their values (the parser already does this when it can).
+	@note In $[ f(B) ]dB|a_X the values for different X are looked up
+		in the table of antiderivative of f, which is built on demand.
+*/
 void optimize(formula F) __attribute__((nonnull));
 
+/**
+	@brief Rebuild long chains of additions and multiplications as balanced trees
+		(modifies the formula in place).
+	@param F Formula object.
+
+	@note A+B+C+D+..., as built by the parser or by repeated upgrade(F_ADD, ...),
+		becomes (A+B)+(C+D)+..., and A-B+C-D+... becomes (A+C+...) - (B+D+...).
+		Additions of different pairs don't wait for each other, and eval()
+		doesn't go into deep recursion on very long chains.
+	@note Floating-point operations are not associative, so the value
+		can differ in the last bits. That's why optimize() doesn't do it.
+*/
+void formula_balance(formula F) __attribute__((nonnull));
+
+/**
+	@brief Calculate polynomials in one variable by Horner's scheme
+		(modifies the formula in place).
+	@param F Formula object.
+
+	@note Polynomials written term by term, e.g. 3*X^3 - X^2/2 + 1
+		or the Taylor series 1 + 0.5*(X-2) + 0.25*(X-2)^2,
+		are calculated with one multiplication and one addition per degree
+		instead of pow() for each term. The degree is at most 32.
+	@note Like formula_balance(), this can change the value in the last bits.
+*/
+void formula_horner(formula F) __attribute__((nonnull));
+
+/**
+	@brief Remember the values of integrals (and derivatives) with few free variables.
+	@param F Formula object.
+	@param size Number of values to remember for each integral (0 to remove the caches).
+
+	@note Only integrals with 1 to 4 free variables are cached. The key is
+		the exact value of these variables, so this helps when the formula
+		is evaluated again and again with the same arguments.
+	@note The memory used is proportional to \b size for each integral.
+*/
+void formula_memoize(formula F, int size) __attribute__((nonnull));
+
+/**
+	@brief Replace the formula with piecewise polynomial approximation.
+	@param F Formula with one or two arguments.
+	@param ranges Array of [min, max] pairs, one pair for each argument (in the order of eval() parameters).
+	@param tolerance Maximum absolute error.
+	@returns New formula (must be formula_free()d), NULL if F has more than two arguments.
+
+	@note The result is calculated by Chebyshev polynomials, the pieces
+		are smaller where F changes faster. It is much faster than F
+		when F contains integrals or derivatives.
+	@note Outside of the ranges (and where the tolerance can't be met,
+		e.g. near discontinuities) the exact formula F is calculated.
+*/
+formula formula_approximate(const formula F, const double *ranges, double tolerance)
+	__attribute__((malloc warn_unused_result));
+
 #endif
@@ -21,11 +21,6 @@
 
 #define YYSTYPE formula
 
-#ifndef _FORMULA_C
-extern char *_formula_string_p; /* really defined in formula.c */
-extern formula _formula_top; /* really defined in formula.c */
-#endif
-
 typedef int F_TYPE;
 #define F_CONST 0
 #define F_VAR 1
@@ -50,6 +45,106 @@ typedef int F_TYPE;
 #define F_LOG2 20
 #define F_DERIVATIVE 21
 #define F_ABS 22
+#define F_CUBATURE 23 // fused nested integrals, created by optimize()
+#define F_HOISTED 24 // part of integrand which doesn't depend on integration variable, created by optimize()
+#define F_TABLE 25 // leaf: arg1 points to a data block (struct _table), not to a formula
+#define F_MEMO 26 // cache of values of arg1 (the cache is F_TABLE in arg2), created by formula_memoize()
+#define F_CUMULATIVE 27 // integral arg1 looked up in the table of its antiderivative (F_TABLE in arg2), created by optimize()
+#define F_APPROX 28 // polynomial approximation (F_TABLE in arg2) of arg1 by variables in other_args, created by formula_approximate()
+#define F_SUM 29 // sum of arg1 for index from arg2 to other_args[0] (both F_CONST)
+#define F_PROD 30 // product, the same arguments as F_SUM
+#define F_ELEMENT 31 // element of the array: arg1 is F_VAR with its first element, the index is the one of the innermost F_SUM/F_PROD
+#define F_POLY 32 // polynomial (F_TABLE in arg2) of other_args[0], the exact formula in arg1, created by formula_horner()
+
+#define CUBATURE_MAX_DIMS 8 /* F_CUBATURE */
+#define CUBATURE_MAX_POINTS 64
+
+/*
+	Data block of F_TABLE node. It is always allocated in one piece
+	(without pointers inside), so it can be copied with memcpy().
+*/
+struct _table
+{
+	size_t size; /* of the whole block, in bytes */
+};
+
+/* Cache of F_MEMO node: values of arg1 for the last used values of its variables */
+#define MEMO_MAX_VARS 4
+struct _memo_entry
+{
+	double key[MEMO_MAX_VARS];
+	double value;
+	int used;
+};
+struct _memo
+{
+	struct _table header;
+	int nvars;
+	int capacity; /* power of 2 */
+	unsigned long hits, misses;
+	struct _memo_entry entry[];
+};
+
+/*
+	Table of the antiderivative G(x) = integral of f from a to x.
+	Cell k covers [a + k*h; a + (k+1)*h], where f is replaced with
+	the polynomial of degree 4 through 5 equidistant points.
+*/
+#define CUMULATIVE_INTERVALS 256 /* cells between a and the first x (F_CUMULATIVE) */
+#define CUMULATIVE_MAX_CELLS (1 << 16)
+struct _cumulative_cell
+{
+	double sum; /* G(a + k*h) */
+	double coef[5]; /* G(a + k*h + u*h/4) - sum = u*(coef[0] + u*(coef[1] + ...)), 0 <= u <= 4 */
+};
+struct _cumulative
+{
+	struct _table header;
+	double a, h;
+	int lo, hi; /* cells lo..hi-1 are calculated, cell k is cell[k - lo] */
+	int capacity;
+	struct _cumulative_cell cell[];
+};
+struct _cumulative *_cumulative_new(double a, double h);
+int _cumulative_extend(struct _cumulative **T, int lo, int hi, double (*f)(void *, double), void *ctx) __attribute__((nonnull(1,4)));
+double _cumulative_value(const struct _cumulative *T, double x) __attribute__((nonnull));
+
+/*
+	Piecewise Chebyshev approximation (F_APPROX).
+	1 variable: pieces[0] pieces with their own borders,
+		data[] is pieces[0] + 1 borders, then (degree + 1) coefficients for each piece.
+	2 variables: [lo; hi] is divided into pieces[0] x pieces[1] equal rectangles,
+		data[] is (degree + 1)^2 coefficients for each rectangle (c[i][j] for T_i(x) T_j(y)).
+	If the first coefficient of the piece is NAN, the approximation there is not precise enough.
+*/
+#define APPROX_MAX_VARS 2
+struct _approx
+{
+	struct _table header;
+	int dims;
+	int degree;
+	int pieces[APPROX_MAX_VARS];
+	double lo[APPROX_MAX_VARS], hi[APPROX_MAX_VARS];
+	double data[];
+};
+
+/* Coefficients of F_POLY: c[0] + c[1]*x + ... + c[degree]*x^degree */
+#define POLY_MAX_DEGREE 32
+struct _poly
+{
+	struct _table header;
+	int degree;
+	double c[];
+};
+double _poly_value(const struct _poly *P, double x) __attribute__((nonnull));
+
+double _calc(F_TYPE action, double p1, double p2) __attribute__((const));
+double _sum_eval(formula F, const double *args) __attribute__((nonnull)); /* sum.c: F_SUM and F_PROD */
+double _poly_eval(formula F, const double *args) __attribute__((nonnull(1))); /* poly.c: F_POLY */
+void _vec_calc(F_TYPE action, const double *a, const double *b, double *out, int n, int precision)
+	__attribute__((nonnull(2,4))); /* vecmath.c: _calc() for n values, precision is FORMULA_EXACT, etc. */
+double _formula_eval(const formula F, const double *args) __attribute__((nonnull(1))); /* args in the order of F->args */
+void _gauss_legendre(int n, double *x, double *w) __attribute__((nonnull));
 
 YYSTYPE _palloc4(mpool optional_pool, F_TYPE type, YYSTYPE arg1, YYSTYPE arg2, YYSTYPE arg3, YYSTYPE arg4) __attribute__((fastcall malloc nonnull(3) warn_unused_result));
 #define _palloc3(pool, type, arg1, arg2, arg3) _palloc4(pool, type, arg1, arg2, arg3, 0)
@@ -63,4 +158,37 @@ YYSTYPE _palloc4(mpool optional_pool, F_TYPE type, YYSTYPE arg1, YYSTYPE arg2, Y
 #define _alloc1(type, arg) _palloc4(NULL, type, arg, 0, 0, 0)
 #define _alloc0(type) _palloc4(NULL, type, 0, 0, 0, 0)
 
+void _formula_free(formula F);
+formula _formula_clone(const formula F, const symtable args);
+void _formula_own(formula F, symtable args);
+
+/*
+	Run worker(&workers[i]) in 'threads' threads (workers[0] in the current thread).
+	The formula field of workers[i] (at 'offset' in the structure of 'size' bytes) is set to F
+	for workers[0] and to formula_clone_deep(F) for others: eval() of F may modify it temporarily.
+	Workers whose copy or thread can't be made are not run.
+*/
+void _formula_threads(formula F, int threads, void *(*worker)(void *), void *workers, size_t size, size_t offset);
+int _fold(formula F);
+void _fold_constants(formula F); /* optimize.c: _fold() for the largest constant subtrees */
+formula _table_alloc(void *table, symtable args);
+
+/* Explicit stack for walking the tree without recursion (long chains like A+A+...+A are very deep) */
+struct _node_stack
+{
+	int size, capacity;
+	formula *node;
+};
+int _node_stack_push(struct _node_stack *S, formula F); /* returns 0 if there is no memory */
+int _node_stack_push_args(struct _node_stack *S, formula F); /* arg1, arg2 and other_args of F (if F is not a leaf) */
+
+/* F parameter MUST be F_CONST, or this call will fail */
+static inline double _get_const(formula F)
+{
+	return *(double *)F->arg1;
+}
+
+/* F parameter MUST be F_VAR: returns the symbol stored in F->arg1 */
+#define _VAR_ID(F) ((int) (long) (F)->arg1)
+
 #endif
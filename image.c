@@ -0,0 +1,386 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "formula_internal.h"
+
+#define IMAGE_MAX_DEPTH 65536 /* formula_image_eval() is recursive */
+
+/*
+	Saving.
+*/
+
+struct _saver
+{
+	struct _image_header *header;
+	struct _image_node *nodes; /* NULL: only count the nodes */
+	int count;
+	int ids[FORMULA_IMAGE_MAX_SLOTS]; /* variable in each slot (symtable_id()) */
+};
+
+/* Nodes created by optimize(), formula_memoize(), etc. keep the exact formula in arg1 */
+static formula _exact(formula F)
+{
+	while(F->action == F_HOISTED || F->action == F_MEMO
+		|| F->action == F_CUMULATIVE || F->action == F_APPROX || F->action == F_POLY)
+		F = F->arg1;
+	return F;
+}
+
+/* Names longer than one letter are not kept in the header */
+static char _letter(int id)
+{
+	const char *name = symtable_name(id);
+	return name && name[0] && !name[1] ? name[0] : 0;
+}
+
+static int _slot(struct _saver *S, int id)
+{
+	struct _image_header *H = S->header;
+	int i;
+	for(i = 0; i < H->slots; i ++)
+		if(S->ids[i] == id)
+			return i;
+
+	if(H->slots == FORMULA_IMAGE_MAX_SLOTS) return -1;
+	S->ids[H->slots] = id;
+	H->names[H->slots] = _letter(id);
+	return H->slots ++;
+}
+
+/* Returns index of the node, -1 if F can't be saved */
+static int _save(struct _saver *S, formula F)
+{
+	struct _image_node N;
+	formula var = NULL;
+
+	F = _exact(F);
+	if(F->action < F_CONST || F->action > F_ABS) return -1; /* F_CUBATURE, F_TABLE */
+
+	memset(&N, 0, sizeof(N));
+	N.action = F->action;
+	N.arg1 = N.arg2 = N.arg3 = N.slot = -1;
+
+	switch(F->action)
+	{
+		case F_CONST:
+			N.value = _get_const(F);
+			break;
+
+		case F_VAR:
+			var = F;
+			break;
+
+		case F_INTEGRAL:
+			if(!F->other_args || F->other_args->count != 2) return -1;
+			var = F->other_args->arg[1];
+			if((N.arg3 = _save(S, F->other_args->arg[0])) == -1) return -1;
+			/* fall through */
+
+		default:
+			if((N.arg1 = _save(S, F->arg1)) == -1) return -1;
+			if(F->action == F_DERIVATIVE)
+				var = F->arg2;
+			else if(F->arg2 && (N.arg2 = _save(S, F->arg2)) == -1)
+				return -1;
+	}
+
+	if(var)
+	{
+		if(var->action != F_VAR) return -1;
+		if((N.slot = _slot(S, _VAR_ID(var))) == -1) return -1;
+	}
+
+	if(S->nodes) S->nodes[S->count] = N;
+	return S->count ++;
+}
+
+size_t formula_save_memory(const formula F, void *buf, size_t size)
+{
+	struct _image_header H;
+	struct _saver S;
+	int i;
+
+	memset(&H, 0, sizeof(H));
+	H.magic = FORMULA_IMAGE_MAGIC;
+
+	/* Arguments take the first slots (in the order of eval() parameters) */
+	if(F->args)
+	{
+		H.args = H.slots = symtable_count(F->args);
+		if(H.args > FORMULA_IMAGE_MAX_SLOTS) return 0;
+		symtable_ids(F->args, S.ids);
+		for(i = 0; i < H.args; i ++)
+			H.names[i] = _letter(S.ids[i]);
+	}
+
+	/* First pass: the size */
+	S.header = &H;
+	S.nodes = NULL;
+	S.count = 0;
+	if(_save(&S, F) == -1) return 0;
+
+	size_t total = sizeof(struct _image_header) + S.count * sizeof(struct _image_node);
+	if(total > UINT32_MAX) return 0;
+	if(!buf || size < total) return total;
+
+	H.count = S.count;
+	H.size = total;
+	H.slots = H.args; /* slots of integration variables are assigned again */
+	memset(H.names + H.args, 0, FORMULA_IMAGE_MAX_SLOTS - H.args);
+
+	S.nodes = (struct _image_node *) ((char *) buf + sizeof(struct _image_header));
+	S.count = 0;
+	_save(&S, F);
+
+	memcpy(buf, &H, sizeof(H));
+	return total;
+}
+
+int formula_save(const formula F, const char *filename)
+{
+	size_t size = formula_save_memory(F, NULL, 0);
+	if(!size) return 0;
+
+	void *buf = malloc(size);
+	if(!buf) return 0;
+	formula_save_memory(F, buf, size);
+
+	FILE *fp = fopen(filename, "wb");
+	int ok = fp && fwrite(buf, 1, size, fp) == size;
+	if(fp && fclose(fp)) ok = 0;
+
+	free(buf);
+	return ok;
+}
+
+/*
+	Loading.
+*/
+
+static int _arity(int action)
+{
+	switch(action)
+	{
+		case F_CONST: case F_VAR: return 0;
+		case F_ADD: case F_SUB: case F_MUL: case F_DIV: case F_POW: return 2;
+		case F_INTEGRAL: return 3;
+	}
+	return 1; /* functions, F_NOT, F_DERIVATIVE */
+}
+
+/* Check everything formula_image_eval() relies on, so that a damaged file can't crash it */
+static int _valid(const void *data, size_t size)
+{
+	const struct _image_header *H = data;
+	int i, ok = 1;
+
+	if((uintptr_t) data % sizeof(double)) return 0;
+	if(size < sizeof(struct _image_header) || H->magic != FORMULA_IMAGE_MAGIC) return 0;
+	if(H->size > size || H->size < sizeof(struct _image_header) || H->count < 1
+		|| (size_t) H->count > (H->size - sizeof(struct _image_header)) / sizeof(struct _image_node))
+		return 0;
+	if(H->args < 0 || H->slots < H->args || H->slots > FORMULA_IMAGE_MAX_SLOTS) return 0;
+
+	const struct _image_node *nodes = (const struct _image_node *) (H + 1);
+	int *depth = malloc(sizeof(int) * H->count);
+	if(!depth) return 0;
+
+	for(i = 0; i < H->count && ok; i ++)
+	{
+		const struct _image_node *N = &nodes[i];
+		if(N->action < F_CONST || N->action > F_ABS)
+		{
+			ok = 0;
+			break;
+		}
+
+		int arity = _arity(N->action), args[3] = { N->arg1, N->arg2, N->arg3 }, j, d = 0;
+		for(j = 0; j < 3; j ++)
+		{
+			if(j < arity ? (args[j] < 0 || args[j] >= i) : args[j] != -1)
+				ok = 0;
+			else if(j < arity && depth[args[j]] > d)
+				d = depth[args[j]];
+		}
+		depth[i] = d + 1;
+		if(depth[i] > IMAGE_MAX_DEPTH) ok = 0;
+
+		if((N->action == F_VAR || N->action == F_INTEGRAL || N->action == F_DERIVATIVE)
+			&& (N->slot < 0 || N->slot >= H->slots))
+			ok = 0;
+	}
+
+	free(depth);
+	return ok;
+}
+
+formula_image formula_load_memory(const void *data, size_t size)
+{
+	if(!_valid(data, size)) return NULL;
+
+	formula_image I = malloc(sizeof(struct _formula_image));
+	if(!I) return NULL;
+
+	I->header = data;
+	I->nodes = (const struct _image_node *) (I->header + 1);
+	I->map = NULL;
+	I->map_size = 0;
+	return I;
+}
+
+formula_image formula_load(const char *filename)
+{
+	struct stat st;
+
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) return NULL;
+	if(fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct _image_header))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); /* the mapping stays */
+	if(map == MAP_FAILED) return NULL;
+
+	formula_image I = formula_load_memory(map, st.st_size);
+	if(!I)
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	I->map = map;
+	I->map_size = st.st_size;
+	return I;
+}
+
+void formula_image_free(formula_image I)
+{
+	if(I->map) munmap(I->map, I->map_size);
+	free(I);
+}
+
+int formula_image_args(const formula_image I)
+{
+	return I->header->args;
+}
+
+/*
+	Evaluation: the same methods as in eval()
+	(Simpson's rule for integrals, central difference for derivatives).
+	Values of variables are kept in slots[], which is the only thing being modified.
+*/
+
+static double _image_eval(const struct _image_node *nodes, int i, double *slots);
+
+static double _image_integral(const struct _image_node *nodes, const struct _image_node *N, double *slots)
+{
+	int steps = 100, k;
+	double a = _image_eval(nodes, N->arg2, slots);
+	double b = _image_eval(nodes, N->arg3, slots);
+	double saved = slots[N->slot];
+
+	int a_isinf = isinf(a), b_isinf = isinf(b);
+	if(a_isinf != 0 || b_isinf != 0)
+	{
+		if(a_isinf != 0) a = 200 * a_isinf;
+		if(b_isinf != 0) b = 200 * b_isinf;
+		steps *= 100;
+	}
+
+	int swap = 1;
+	if(a > b)
+	{
+		double t = a;
+		a = b;
+		b = t;
+		swap = -1;
+	}
+
+	double step = (b - a) / steps, I;
+	int two_or_four = 4;
+
+	slots[N->slot] = a;
+	I = _image_eval(nodes, N->arg1, slots);
+	slots[N->slot] = b;
+	I += _image_eval(nodes, N->arg1, slots);
+
+	for(k = 1; k < steps; k ++)
+	{
+		slots[N->slot] = a + k * step;
+		I += _image_eval(nodes, N->arg1, slots) * two_or_four;
+		two_or_four = 6 - two_or_four;
+	}
+
+	slots[N->slot] = saved;
+	return swap * step * I / 3;
+}
+
+static double _image_derivative(const struct _image_node *nodes, const struct _image_node *N, double *slots)
+{
+	double offset = 0.01, saved = slots[N->slot], a, b;
+
+	slots[N->slot] -= offset;
+	a = _image_eval(nodes, N->arg1, slots);
+	slots[N->slot] += 2 * offset;
+	b = _image_eval(nodes, N->arg1, slots);
+	slots[N->slot] = saved;
+
+	return (b - a) / (2 * offset);
+}
+
+static double _image_eval(const struct _image_node *nodes, int i, double *slots)
+{
+	const struct _image_node *N = &nodes[i];
+	double p1, p2 = 0;
+
+	switch(N->action)
+	{
+		case F_CONST: return N->value;
+		case F_VAR: return slots[N->slot];
+		case F_INTEGRAL: return _image_integral(nodes, N, slots);
+		case F_DERIVATIVE: return _image_derivative(nodes, N, slots);
+	}
+
+	p1 = _image_eval(nodes, N->arg1, slots);
+	if(isnan(p1)) return NAN;
+
+	if(N->arg2 != -1)
+	{
+		p2 = _image_eval(nodes, N->arg2, slots);
+		if(isnan(p2)) return NAN;
+	}
+	return _calc(N->action, p1, p2);
+}
+
+double formula_image_eval(const formula_image I, const double *args)
+{
+	double slots[FORMULA_IMAGE_MAX_SLOTS];
+	int i;
+
+	for(i = 0; i < I->header->slots; i ++)
+		slots[i] = i < I->header->args ? args[i] : 0;
+	return _image_eval(I->nodes, I->header->count - 1, slots);
+}
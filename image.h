@@ -0,0 +1,124 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdint.h>
+
+#include "formula.h"
+
+/*
+	Binary image of the formula: a header and an array of nodes,
+	where operands are referred to by indexes (not pointers).
+	The image doesn't need any changes after loading, so a file (or shared memory)
+	can be mmap()ed read-only by many processes and evaluated in place.
+
+	The image is in the native byte order (formula_load() rejects images
+	from machines with another byte order).
+*/
+
+#define FORMULA_IMAGE_MAGIC 0x31494d46 /* "FMI1" */
+#define FORMULA_IMAGE_MAX_SLOTS 64 /* arguments and variables of integrals */
+
+struct _image_header
+{
+	uint32_t magic;
+	uint32_t size; /* of the whole image, in bytes */
+	int32_t count; /* number of nodes, the last one is the root */
+	int32_t args; /* number of arguments: they are in slots [0; args) */
+	int32_t slots;
+	int32_t reserved;
+	char names[FORMULA_IMAGE_MAX_SLOTS]; /* variable in each slot (0 if its name is longer than one letter) */
+};
+
+struct _image_node
+{
+	int32_t action; /* F_CONST, F_VAR, F_INTEGRAL, F_DERIVATIVE or operation (F_ADD, F_SIN, etc.) */
+	int32_t arg1, arg2, arg3; /* indexes of the operands (always less than the index of the node), -1 if none;
+		F_INTEGRAL: arg1 is the integrand, arg2 and arg3 are the bounds */
+	int32_t slot; /* F_VAR: the variable, F_INTEGRAL and F_DERIVATIVE: the variable of integration/differentiation */
+	int32_t reserved;
+	double value; /* F_CONST */
+};
+
+typedef struct _formula_image
+{
+	const struct _image_header *header;
+	const struct _image_node *nodes;
+
+	void *map; /* mmap()ed file (NULL for formula_load_memory()) */
+	size_t map_size;
+} *formula_image;
+
+/**
+	@brief Write the binary image of the formula into memory.
+	@param F Formula object.
+	@param buf Buffer for the image (can be NULL to find out the size).
+	@param size Size of \b buf in bytes.
+	@returns Size of the image (nothing is written if it's greater than \b size),
+		0 if the formula can't be saved.
+
+	@note Integrals fused by optimize() (F_CUBATURE) can't be saved.
+		Caches and approximations (formula_memoize(), formula_approximate(), etc.)
+		are not saved: the exact subexpression is saved instead of them.
+*/
+size_t formula_save_memory(const formula F, void *buf, size_t size) __attribute__((nonnull(1)));
+
+/**
+	@brief Write the binary image of the formula into the file.
+	@param F Formula object.
+	@param filename Path to the file.
+	@returns 1 if ok, 0 on error.
+*/
+int formula_save(const formula F, const char *filename) __attribute__((nonnull));
+
+/**
+	@brief mmap() the image saved by formula_save().
+	@param filename Path to the file.
+	@returns Image object, NULL if the file can't be read or is not a valid image.
+	@note The file is mapped read-only and shared, nothing is copied.
+*/
+formula_image formula_load(const char *filename) __attribute__((nonnull warn_unused_result));
+
+/**
+	@brief Use the image saved by formula_save_memory() (e.g. in shared memory).
+	@param data The image (aligned to 8 bytes). It's not copied, so it must not be freed
+		before formula_image_free().
+	@param size Size of \b data in bytes.
+	@returns Image object, NULL if \b data is not a valid image.
+*/
+formula_image formula_load_memory(const void *data, size_t size) __attribute__((nonnull warn_unused_result));
+
+/**
+	@brief Calculate the value of the formula.
+	@param I Image object.
+	@param args Arguments (in the same order as in eval_array()).
+	@returns Value of the formula, same as eval_array() of the saved formula.
+	@note The image is never modified, so many threads can use it at the same time.
+*/
+double formula_image_eval(const formula_image I, const double *args) __attribute__((nonnull(1)));
+
+/**
+	@brief Number of arguments of the saved formula (same as formula_args()).
+*/
+int formula_image_args(const formula_image I) __attribute__((nonnull));
+
+/**
+	@brief Free the image object (and unmap its file).
+*/
+void formula_image_free(formula_image I) __attribute__((nonnull));
+
+#endif
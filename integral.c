@@ -14,9 +14,15 @@
 */
 
 #include "integral.h"
+#include "formula_internal.h"
+#include "program.h"
+#include "interval.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 
 inline void randomize()
 {
@@ -27,14 +33,49 @@ inline double random_ab(double a, double b)
 	return a + (b-a)*(random() / RAND_MAX);
 }
 
+/*
+	Check (before the integral is calculated) whether F is undefined in any of the points
+	a + i * step, i = i0..i1. Interval arithmetic finds the suspicious parts of [a; b],
+	and only the points in them are calculated.
+*/
+static int _undefined_somewhere(formula F, double a, double step, int i0, int i1)
+{
+	interval x;
+	x.lo = a + i0 * step;
+	x.hi = a + i1 * step;
+	if(x.lo > x.hi)
+	{
+		double t = x.lo;
+		x.lo = x.hi;
+		x.hi = t;
+	}
+
+	interval r = eval_interval(F, &x);
+	if(r.undefined == INTERVAL_DEFINED) return 0;
+	if(r.undefined == INTERVAL_UNDEFINED) return 1;
+
+	if(i1 - i0 <= 8)
+	{
+		int i;
+		for(i = i0; i <= i1; i ++)
+			if(isnanl(eval(F, a + i * step))) return 1;
+		return 0;
+	}
+
+	int mid = (i0 + i1) / 2;
+	return _undefined_somewhere(F, a, step, i0, mid) || _undefined_somewhere(F, a, step, mid, i1);
+}
+
 double simpson(formula F, int steps, double a, double b)
 {
 	if(!F || !steps) return NAN;
+	if(formula_args(F) == 1 && _undefined_somewhere(F, a, (b - a) / steps, 0, steps))
+		return NAN;
 
 	int swap = 1;
 	if(a > b)
 	{
-		int t = a;
+		double t = a;
 		a = b;
 		b = t;
 		swap = -1;
@@ -50,8 +91,10 @@ double simpson(formula F, int steps, double a, double b)
 	printf("F(%.2lf) = %.2lf\n", b, eval(F, b));
 #endif
 	I = eval(F, a) + eval(F, b);
-	for(x = a + step; x < b; x += step)
-	{
+	int i;
+	for(i = 1; i < steps; i ++)
+	{ /* not x += step: rounding errors would add an extra point near b */
+		x = a + i * step;
 //		printf("F(%.2lf) = %.2lf\n", x, eval(F, x));
 
 		I += eval(F, x) * two_or_four;
@@ -72,11 +115,13 @@ double simpson(formula F, int steps, double a, double b)
 double trap(formula F, int steps, double a, double b)
 {
 	if(!F || !steps) return NAN;
+	if(formula_args(F) == 1 && _undefined_somewhere(F, a, (b - a) / steps, 0, steps))
+		return NAN;
 
 	int swap = 1;
 	if(a > b)
 	{
-		int t = a;
+		double t = a;
 		a = b;
 		b = t;
 		swap = -1;
@@ -94,3 +139,552 @@ double trap(formula F, int steps, double a, double b)
 	return swap * step * I / 2;
 }
 
+int integrate_many(const formula *F, int count, double a, double b, int rule, int points, double *out)
+{
+	int i, j, ok = 0;
+	if(count <= 0 || points <= 0) return 0;
+	if(rule == QUAD_SIMPSON) points += points % 2 + 1; /* even number of steps */
+
+	program P = program_new(F, count);
+	double *values = P ? malloc(sizeof(double) * (P->count + 1)) : NULL;
+	double *x = malloc(sizeof(double) * points), *w = malloc(sizeof(double) * points);
+	if(!values || !x || !w || program_args(P) > 1)
+		goto cleanup;
+
+	if(rule == QUAD_SIMPSON)
+	{
+		double step = (b - a) / (points - 1);
+		for(i = 0; i < points; i ++)
+		{
+			x[i] = a + i * step; /* not x += step: rounding errors would accumulate */
+			w[i] = step / 3 * ((i == 0 || i == points - 1) ? 1 : (i % 2 ? 4 : 2));
+		}
+	}
+	else if(rule == QUAD_GAUSS)
+	{
+		_gauss_legendre(points, x, w);
+		for(i = 0; i < points; i ++)
+		{
+			x[i] = (a + b) / 2 + (b - a) / 2 * x[i];
+			w[i] *= (b - a) / 2;
+		}
+	}
+	else goto cleanup;
+
+	for(j = 0; j < count; j ++)
+		out[j] = 0;
+
+	for(i = 0; i < points; i ++)
+	{
+		program_run(P, &x[i], values);
+		for(j = 0; j < count; j ++)
+			out[j] += w[i] * values[P->roots[j]];
+	}
+	ok = 1;
+
+cleanup:
+	free(x);
+	free(w);
+	free(values);
+	program_free(P);
+	return ok;
+}
+
+/*
+	Cumulative integral tables.
+*/
+
+struct _cumulative *_cumulative_new(double a, double h)
+{
+	struct _cumulative *T = calloc(1, sizeof(struct _cumulative));
+	if(!T) return NULL;
+
+	T->header.size = sizeof(struct _cumulative);
+	T->a = a;
+	T->h = h;
+	return T;
+}
+
+/* Antiderivative of the polynomial through (j, y[j]), j = 0..4, see struct _cumulative_cell */
+static void _cumulative_cell(struct _cumulative_cell *C, const double *y, double h)
+{
+	double d[5], basis[6] = { 1, 0, 0, 0, 0, 0 }, c[5] = { 0, 0, 0, 0, 0 };
+	int j, k;
+
+	/* Newton's forward differences */
+	memcpy(d, y, sizeof(d));
+	for(k = 1; k < 5; k ++)
+		for(j = 4; j >= k; j --)
+			d[j] -= d[j - 1];
+
+	/* p(u) = sum of d[k] * u(u-1)...(u-k+1) / k! */
+	for(k = 0; k < 5; k ++)
+	{
+		for(j = 0; j <= k; j ++)
+			c[j] += d[k] * basis[j];
+
+		for(j = k + 1; j > 0; j --) /* basis *= (u - k) / (k + 1) */
+			basis[j] = (basis[j - 1] - k * basis[j]) / (k + 1);
+		basis[0] = -k * basis[0] / (k + 1);
+	}
+
+	for(j = 0; j < 5; j ++)
+		C->coef[j] = h / 4 * c[j] / (j + 1);
+}
+
+static inline double _cumulative_cell_value(const struct _cumulative_cell *C, double u)
+{
+	return u * (C->coef[0] + u * (C->coef[1] + u * (C->coef[2] + u * (C->coef[3] + u * C->coef[4]))));
+}
+
+/*
+	Calculate cells lo..hi-1 of the table (the cells which are already there are kept).
+	NOTE: *T may be realloc()ed.
+*/
+int _cumulative_extend(struct _cumulative **T, int lo, int hi, double (*f)(void *, double), void *ctx)
+{
+	struct _cumulative *C = *T;
+	double y[5];
+	int k, j;
+
+	if(C->lo == C->hi)
+		C->lo = C->hi = 0; /* the table always starts from G(a) = 0 */
+	if(lo > C->lo) lo = C->lo;
+	if(hi < C->hi) hi = C->hi;
+	if(lo > 0) lo = 0;
+	if(hi < 0) hi = 0;
+	if(hi - lo > CUMULATIVE_MAX_CELLS) return 0;
+
+	if(hi - lo > C->capacity)
+	{
+		int capacity = C->capacity ? C->capacity : 16;
+		while(capacity < hi - lo) capacity *= 2;
+
+		size_t size = sizeof(struct _cumulative) + sizeof(struct _cumulative_cell) * capacity;
+		C = realloc(C, size);
+		if(!C) return 0;
+
+		C->header.size = size;
+		C->capacity = capacity;
+		*T = C;
+	}
+
+	/* Cells below lo are added at the beginning */
+	if(lo < C->lo)
+	{
+		memmove(C->cell + (C->lo - lo), C->cell, sizeof(struct _cumulative_cell) * (C->hi - C->lo));
+
+		y[0] = f(ctx, C->a + C->lo * C->h);
+		for(k = C->lo - 1; k >= lo; k --)
+		{
+			struct _cumulative_cell *cell = &C->cell[k - lo];
+			y[4] = y[0];
+			for(j = 0; j < 4; j ++)
+				y[j] = f(ctx, C->a + (k + j / 4.) * C->h);
+
+			_cumulative_cell(cell, y, C->h);
+			cell->sum = (k == -1 ? 0 : cell[1].sum) - _cumulative_cell_value(cell, 4);
+		}
+		C->lo = lo;
+	}
+
+	/* Cells from hi onwards are added at the end */
+	if(hi > C->hi)
+	{
+		y[4] = f(ctx, C->a + C->hi * C->h);
+		for(k = C->hi; k < hi; k ++)
+		{
+			struct _cumulative_cell *cell = &C->cell[k - C->lo];
+			y[0] = y[4];
+			for(j = 1; j < 5; j ++)
+				y[j] = f(ctx, C->a + (k + j / 4.) * C->h);
+
+			_cumulative_cell(cell, y, C->h);
+			cell->sum = (k == 0) ? 0 : cell[-1].sum + _cumulative_cell_value(&cell[-1], 4);
+		}
+		C->hi = hi;
+	}
+	return 1;
+}
+
+double _cumulative_value(const struct _cumulative *T, double x)
+{
+	if(T->lo == T->hi) return x == T->a ? 0 : NAN;
+
+	double r = (x - T->a) / T->h;
+	if(isnan(r) || r < T->lo || r > T->hi) return NAN;
+
+	int k = (int) floor(r);
+	if(k == T->hi) k --; /* right end of the last cell */
+
+	const struct _cumulative_cell *cell = &T->cell[k - T->lo];
+	return cell->sum + _cumulative_cell_value(cell, 4 * (r - k));
+}
+
+static double _cumulative_formula(void *F, double x)
+{
+	return eval((formula) F, x);
+}
+
+cumulative cumulative_new(const formula F, double a, double b, int intervals)
+{
+	if(!F || intervals <= 0 || formula_args(F) != 1 || !isfinite(a) || !isfinite(b))
+		return NULL;
+
+	cumulative T = _cumulative_new(a, (b - a) / intervals);
+	if(!T) return NULL;
+
+	if(a != b && !_cumulative_extend(&T, 0, intervals, _cumulative_formula, F))
+	{
+		free(T);
+		return NULL;
+	}
+	return T;
+}
+
+double cumulative_value(const cumulative T, double x)
+{
+	return _cumulative_value(T, x);
+}
+
+void cumulative_free(cumulative T)
+{
+	free(T);
+}
+
+/*
+	Monte Carlo and quasi-Monte Carlo integration.
+*/
+
+/*
+	Counter-based random numbers (SplitMix64 finalizer):
+	value number 'counter' of the stream 'key' doesn't depend
+	on previous values, so every thread can jump anywhere in the stream.
+*/
+static inline uint64_t _mix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+static inline uint64_t _random_u64(uint64_t key, uint64_t counter)
+{
+	return _mix64(_mix64(key) + counter * 0x9e3779b97f4a7c15ULL);
+}
+
+/*
+	Sobol sequence, direction numbers from Joe & Kuo (new-joe-kuo-6.21201).
+	Dimension 0 is the van der Corput sequence and has no entry here.
+*/
+static const struct
+{
+	int s; /* degree of the primitive polynomial */
+	int a; /* its inner coefficients */
+	uint32_t m[7];
+} sobol_table[] = {
+	{ 1, 0, { 1 } },
+	{ 2, 1, { 1, 3 } },
+	{ 3, 1, { 1, 3, 1 } },
+	{ 3, 2, { 1, 1, 1 } },
+	{ 4, 1, { 1, 1, 3, 3 } },
+	{ 4, 4, { 1, 3, 5, 13 } },
+	{ 5, 2, { 1, 1, 5, 5, 17 } },
+	{ 5, 4, { 1, 1, 5, 5, 5 } },
+	{ 5, 7, { 1, 1, 7, 11, 19 } },
+	{ 5, 11, { 1, 1, 5, 1, 1 } },
+	{ 5, 13, { 1, 1, 1, 3, 11 } },
+	{ 5, 14, { 1, 3, 5, 5, 31 } },
+	{ 6, 1, { 1, 3, 3, 9, 7, 49 } },
+	{ 6, 13, { 1, 1, 1, 15, 21, 21 } },
+	{ 6, 16, { 1, 3, 1, 13, 27, 49 } },
+	{ 6, 19, { 1, 1, 1, 15, 7, 5 } },
+	{ 6, 22, { 1, 3, 1, 15, 13, 25 } },
+	{ 6, 25, { 1, 1, 5, 5, 19, 61 } },
+	{ 7, 1, { 1, 3, 7, 11, 23, 15, 103 } },
+	{ 7, 4, { 1, 3, 7, 13, 13, 15, 69 } }
+};
+#define SOBOL_MAX_DIMS ((int) (1 + sizeof(sobol_table) / sizeof(sobol_table[0])))
+#define SOBOL_BITS 32
+
+static uint32_t sobol_v[SOBOL_MAX_DIMS][SOBOL_BITS];
+static int sobol_ready = 0;
+
+static void _sobol_init()
+{
+	int d, k, j;
+	if(sobol_ready) return;
+
+	for(k = 0; k < SOBOL_BITS; k ++)
+		sobol_v[0][k] = (uint32_t) 1 << (SOBOL_BITS - 1 - k);
+
+	for(d = 1; d < SOBOL_MAX_DIMS; d ++)
+	{
+		int s = sobol_table[d - 1].s, a = sobol_table[d - 1].a;
+		uint32_t m[SOBOL_BITS];
+
+		for(k = 0; k < SOBOL_BITS; k ++)
+		{
+			if(k < s)
+				m[k] = sobol_table[d - 1].m[k];
+			else
+			{
+				m[k] = m[k - s] ^ (m[k - s] << s);
+				for(j = 1; j < s; j ++)
+					if((a >> (s - 1 - j)) & 1)
+						m[k] ^= m[k - j] << j;
+			}
+			sobol_v[d][k] = m[k] << (SOBOL_BITS - 1 - k);
+		}
+	}
+	sobol_ready = 1;
+}
+
+static inline uint32_t _sobol(uint64_t i, int d)
+{
+	uint32_t x = 0;
+	int k;
+	for(k = 0; i; i >>= 1, k ++)
+		if(i & 1) x ^= sobol_v[d][k];
+	return x;
+}
+
+static inline uint32_t _reverse_bits(uint32_t x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+/* Owen scrambling via hashing (Burley, "Practical Hash-based Owen Scrambling", 2020) */
+static inline uint32_t _owen_scramble(uint32_t x, uint32_t seed)
+{
+	x = _reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return _reverse_bits(x);
+}
+
+static const int halton_primes[] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+	59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+};
+#define HALTON_MAX_DIMS ((int) (sizeof(halton_primes) / sizeof(halton_primes[0])))
+
+static inline double _radical_inverse(uint64_t i, int base)
+{
+	double inv = 1.0 / base, f = inv, r = 0;
+	for(; i; i /= base, f *= inv)
+		r += f * (i % base);
+	return r;
+}
+
+/* Quasi-Monte Carlo: error is estimated from this number of randomizations */
+#define QMC_REPLICATES 8
+
+struct _mc_job
+{
+	formula F; /* own copy of the formula: eval() is not reentrant */
+	int dims, method;
+	const double *a, *b;
+	uint64_t seed;
+	long from, to; /* points [from; to) of the current round */
+	double *x;
+
+	/* Results */
+	int undefined;
+	long n; double mean, m2; /* MC_RANDOM: running mean and variance */
+	double sum[QMC_REPLICATES]; /* MC_SOBOL, MC_HALTON: sums for every randomization */
+};
+
+static void _mc_point(const struct _mc_job *J, int replicate, long i, double *x)
+{
+	int d;
+	for(d = 0; d < J->dims; d ++)
+	{
+		uint64_t key = J->seed + (uint64_t) replicate * 0x632be59bd9b4e019ULL + d;
+		double u;
+
+		if(J->method == MC_SOBOL)
+			u = (_owen_scramble(_sobol(i, d), (uint32_t) _random_u64(key, 0)) + 0.5) / 4294967296.0;
+		else if(J->method == MC_HALTON)
+		{
+			u = _radical_inverse(i + 1, halton_primes[d]) + (_random_u64(key, 0) >> 11) / 9007199254740992.0;
+			if(u >= 1) u -= 1;
+		}
+		else
+			u = ((_random_u64(key, i) >> 11) + 0.5) / 9007199254740992.0;
+
+		x[d] = J->a[d] + (J->b[d] - J->a[d]) * u;
+	}
+}
+
+static void *_mc_worker(void *arg)
+{
+	struct _mc_job *J = arg;
+	long i;
+	int r;
+
+	J->n = 0; J->mean = J->m2 = 0;
+	memset(J->sum, 0, sizeof(J->sum));
+
+	for(i = J->from; i < J->to && !J->undefined; i ++)
+	{
+		if(J->method == MC_RANDOM)
+		{
+			_mc_point(J, 0, i, J->x);
+			double v = eval_array(J->F, J->x);
+			if(isnanl(v)) J->undefined = 1;
+
+			/* Welford's algorithm */
+			double delta = v - J->mean;
+			J->n ++;
+			J->mean += delta / J->n;
+			J->m2 += delta * (v - J->mean);
+		}
+		else for(r = 0; r < QMC_REPLICATES; r ++)
+		{
+			_mc_point(J, r, i, J->x);
+			double v = eval_array(J->F, J->x);
+			if(isnanl(v)) J->undefined = 1;
+			J->sum[r] += v;
+		}
+	}
+	return NULL;
+}
+
+#define MC_MAX_THREADS 64
+double montecarlo(const formula F, const double *a, const double *b, int method,
+	long max_points, double target_error, int threads, unsigned long seed, double *error)
+{
+	struct _mc_job J[MC_MAX_THREADS];
+	pthread_t tid[MC_MAX_THREADS];
+	int t, r, d, dims = formula_args(F);
+
+	if(error) *error = NAN;
+	if(dims < 1 || max_points < 1) return NAN;
+	if(method == MC_SOBOL && dims > SOBOL_MAX_DIMS) return NAN;
+	if(method == MC_HALTON && dims > HALTON_MAX_DIMS) return NAN;
+	if(method != MC_RANDOM && method != MC_SOBOL && method != MC_HALTON) return NAN;
+
+	if(threads < 1) threads = 1;
+	if(threads > MC_MAX_THREADS) threads = MC_MAX_THREADS;
+
+	if(method == MC_SOBOL) _sobol_init(); /* before any threads are started */
+
+	double volume = 1;
+	for(d = 0; d < dims; d ++)
+		volume *= b[d] - a[d];
+
+	memset(J, 0, sizeof(J));
+	int failed = 0;
+	for(t = 0; t < threads; t ++)
+	{
+		J[t].F = t ? formula_clone_deep(F) : F;
+		J[t].x = malloc(sizeof(double) * dims);
+		J[t].dims = dims;
+		J[t].method = method;
+		J[t].a = a;
+		J[t].b = b;
+		J[t].seed = _mix64(seed);
+		if(!J[t].F || !J[t].x) failed = 1;
+	}
+	if(failed)
+	{ /* not enough memory */
+		for(t = 0; t < threads; t ++)
+		{
+			if(t && J[t].F) formula_free(J[t].F);
+			free(J[t].x);
+		}
+		return NAN;
+	}
+
+	/* For quasi-Monte Carlo every point is evaluated for each randomization */
+	long limit = method == MC_RANDOM ? max_points : max_points / QMC_REPLICATES;
+	if(limit < 1) limit = 1;
+
+	long done = 0, round = 256;
+	long n = 0; double mean = 0, m2 = 0;
+	double sum[QMC_REPLICATES];
+	double result = NAN, err = NAN;
+	int undefined = 0;
+
+	memset(sum, 0, sizeof(sum));
+	while(done < limit)
+	{
+		long next = done + round > limit ? limit : done + round;
+
+		/* Split [done; next) between threads */
+		for(t = 0; t < threads; t ++)
+		{
+			J[t].from = done + (next - done) * t / threads;
+			J[t].to = done + (next - done) * (t + 1) / threads;
+		}
+		for(t = 1; t < threads; t ++)
+			if(pthread_create(&tid[t], NULL, _mc_worker, &J[t]))
+			{ /* Not enough resources: do it in this thread */
+				_mc_worker(&J[t]);
+				tid[t] = 0;
+			}
+		_mc_worker(&J[0]);
+		for(t = 1; t < threads; t ++)
+			if(tid[t]) pthread_join(tid[t], NULL);
+
+		for(t = 0; t < threads; t ++)
+		{
+			if(J[t].undefined) undefined = 1;
+			if(method == MC_RANDOM)
+			{ /* Chan et al. formula for combining variances */
+				if(!J[t].n) continue;
+
+				long total = n + J[t].n;
+				double delta = J[t].mean - mean;
+				mean += delta * J[t].n / total;
+				m2 += J[t].m2 + delta * delta * n * J[t].n / total;
+				n = total;
+			}
+			else
+				for(r = 0; r < QMC_REPLICATES; r ++)
+					sum[r] += J[t].sum[r];
+		}
+		done = next;
+		if(undefined) break;
+
+		if(method == MC_RANDOM)
+		{
+			result = volume * mean;
+			err = n > 1 ? fabs(volume) * sqrt(m2 / (n - 1) / n) : INFINITY;
+		}
+		else
+		{
+			double est_mean = 0, est_m2 = 0;
+			for(r = 0; r < QMC_REPLICATES; r ++)
+			{
+				double est = volume * sum[r] / done;
+				double delta = est - est_mean;
+				est_mean += delta / (r + 1);
+				est_m2 += delta * (est - est_mean);
+			}
+			result = est_mean;
+			err = sqrt(est_m2 / (QMC_REPLICATES - 1) / QMC_REPLICATES);
+		}
+
+		if(target_error > 0 && err <= target_error)
+			break;
+		round = done; /* double the number of points */
+	}
+
+	for(t = 0; t < threads; t ++)
+	{
+		if(t) formula_free(J[t].F);
+		free(J[t].x);
+	}
+
+	if(undefined) return NAN;
+	if(error) *error = err;
+	return result;
+}
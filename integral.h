@@ -21,4 +21,89 @@
 double simpson(formula F, int steps, double a, double b);
 double trap(formula F, int steps, double a, double b);
 
+/* Rules for integrate_many() */
+#define QUAD_SIMPSON 0 /* composite Simpson's rule, 'points' is the number of steps */
+#define QUAD_GAUSS 1 /* Gauss-Legendre rule with 'points' nodes */
+
+/**
+	@brief Calculate integrals of several formulas over the same segment.
+	@param F Array of formulas, each with one argument (the same for all of them).
+	@param count Number of formulas.
+	@param a Lower bound of the integrals.
+	@param b Upper bound of the integrals.
+	@param rule QUAD_SIMPSON or QUAD_GAUSS.
+	@param points Number of steps (QUAD_SIMPSON) or nodes (QUAD_GAUSS).
+	@param out Array of \b count doubles, receives the integrals.
+	@returns 1 on success, 0 if formulas use more than one variable (or not enough memory).
+
+	@note All formulas are calculated in the same points, and the subexpressions
+		they have in common (e.g. f(X) in X*f(X), X^2*f(X), ...) are calculated once.
+*/
+int integrate_many(const formula *F, int count, double a, double b, int rule, int points, double *out)
+	__attribute__((nonnull(1,7)));
+
+/**
+	@brief Table of the integral of F from \b a to x, for any x between \b a and \b b.
+	@see cumulative_new()
+*/
+typedef struct _cumulative *cumulative;
+
+/**
+	@brief Precalculate the integral of F from \b a to x for all x in [a; b].
+	@param F Formula with one argument.
+	@param a Lower bound of the integral.
+	@param b Last value of the upper bound.
+	@param intervals Number of intervals the segment [a; b] is divided into
+		(F is calculated in 4 * intervals + 1 points).
+	@returns Table for cumulative_value(), NULL if F has more than one argument.
+
+	@note Within each interval F is replaced with the polynomial of degree 4
+		(like in Boole's rule), so the table gives the same precision
+		in all points, not only in the ends of intervals.
+	@note The table returned must be cumulative_free()d.
+*/
+cumulative cumulative_new(const formula F, double a, double b, int intervals)
+	__attribute__((malloc warn_unused_result));
+
+/**
+	@brief Integral of F from \b a to \b x, where F and \b a were passed to cumulative_new().
+	@returns Value of the integral, NAN if x is outside of [a; b].
+	@note Time doesn't depend on the number of intervals.
+*/
+double cumulative_value(const cumulative T, double x) __attribute__((nonnull));
+
+/**
+	@brief Free the table returned by cumulative_new().
+*/
+void cumulative_free(cumulative T);
+
+/* Methods for montecarlo() */
+#define MC_RANDOM 0 /* pseudo-random points */
+#define MC_SOBOL 1 /* scrambled Sobol sequence (up to 21 arguments) */
+#define MC_HALTON 2 /* randomized Halton sequence (up to 32 arguments) */
+
+/**
+	@brief Calculate multi-dimensional integral of F over a hyper-rectangle
+		by Monte Carlo (or quasi-Monte Carlo) method.
+
+	@param F Formula object. Integral is taken by all its arguments.
+	@param a Array of formula_args(F) lower bounds (in the order of eval() parameters).
+	@param b Array of formula_args(F) upper bounds.
+	@param method One of MC_RANDOM, MC_SOBOL, MC_HALTON.
+	@param max_points Maximum number of evaluations of F.
+	@param target_error Stop as soon as the estimated error is smaller (0 to never stop early).
+	@param threads Number of threads to use (1 to run in the current thread).
+	@param seed Seed of the random generator: same seed gives the same result.
+	@param error If not NULL, receives the estimated error (one standard deviation).
+	@returns Value of the integral, NAN if F is undefined somewhere in the region.
+
+	@note Random numbers are counter-based: point number i is the same
+		regardless of the number of threads, so the results are reproducible.
+	@note For MC_SOBOL and MC_HALTON the error is estimated from
+		several independent randomizations of the sequence.
+*/
+double montecarlo(const formula F, const double *a, const double *b, int method,
+	long max_points, double target_error, int threads, unsigned long seed, double *error)
+	__attribute__((nonnull(1,2,3)));
+
 #endif
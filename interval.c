@@ -0,0 +1,623 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "interval.h"
+#include "formula_internal.h"
+
+/*
+	Interval arithmetic.
+
+	Every operation returns the range of its values, widened by 1 ulp
+	(2 ulp for library functions) so that rounding errors can't make it too narrow.
+	Parts of the arguments where the operation is undefined (e.g. ln(-1))
+	set 'undefined' flag and are excluded from the range.
+*/
+
+#define INTERVAL_INTEGRAL_PIECES 8 /* integrals: the range of the integrand is found in 8 parts of [a; b] */
+
+static interval _interval(formula F, const interval *args);
+static interval _apply(int action, interval x, interval y);
+
+static inline interval _make(double lo, double hi, int undefined)
+{
+	interval r;
+	r.lo = lo;
+	r.hi = hi;
+	r.undefined = undefined;
+	return r;
+}
+
+static inline interval _whole(int undefined)
+{
+	return _make(-INFINITY, INFINITY, undefined);
+}
+
+static inline interval _nowhere()
+{
+	return _make(NAN, NAN, INTERVAL_UNDEFINED);
+}
+
+/* Widen [lo; hi] by 'ulps' units in the last place */
+static inline interval _outward(double lo, double hi, int ulps, int undefined)
+{
+	if(isnan(lo)) lo = -INFINITY;
+	if(isnan(hi)) hi = INFINITY;
+	while(ulps --)
+	{
+		lo = nextafter(lo, -INFINITY);
+		hi = nextafter(hi, INFINITY);
+	}
+	return _make(lo, hi, undefined);
+}
+
+static inline int _merge(int u1, int u2)
+{
+	if(u1 == INTERVAL_UNDEFINED || u2 == INTERVAL_UNDEFINED) return INTERVAL_UNDEFINED;
+	return u1 | u2;
+}
+
+/* 0 * inf is 0 here: the infinite end is never reached */
+static inline double _mul(double x, double y)
+{
+	return (x == 0 || y == 0) ? 0 : x * y;
+}
+
+static interval _multiply(interval x, interval y, int undefined)
+{
+	double p[4] = { _mul(x.lo, y.lo), _mul(x.lo, y.hi), _mul(x.hi, y.lo), _mul(x.hi, y.hi) };
+	double lo = p[0], hi = p[0];
+	int i;
+	for(i = 1; i < 4; i ++)
+	{
+		if(p[i] < lo) lo = p[i];
+		if(p[i] > hi) hi = p[i];
+	}
+	return _outward(lo, hi, 1, undefined);
+}
+
+static interval _divide(interval x, interval y, int undefined)
+{
+	/* _calc() returns NAN if the divisor is 0 */
+	if(y.lo == 0 && y.hi == 0) return _nowhere();
+	if(y.lo <= 0 && y.hi >= 0)
+	{
+		undefined |= INTERVAL_MAYBE_UNDEFINED;
+		if(y.lo < 0 && y.hi > 0) return _whole(undefined);
+
+		/* 0 is the end of the divisor: 1/y is [1/hi; +inf] or [-inf; 1/lo] */
+		if(y.lo == 0) y = _make(1 / y.hi, INFINITY, 0);
+		else y = _make(-INFINITY, 1 / y.lo, 0);
+	}
+	else
+		y = _outward(1 / y.hi, 1 / y.lo, 1, 0);
+
+	return _multiply(x, y, undefined);
+}
+
+/* Range of monotone function f (increasing if 'increasing' is 1) */
+static interval _monotone(double (*f)(double), interval x, int increasing, int undefined)
+{
+	if(increasing) return _outward(f(x.lo), f(x.hi), 2, undefined);
+	return _outward(f(x.hi), f(x.lo), 2, undefined);
+}
+
+/* Does [lo; hi] contain any point phase + k * period? */
+static int _contains_periodic(double lo, double hi, double phase, double period)
+{
+	double k = ceil((lo - phase) / period);
+	return phase + k * period <= hi;
+}
+
+static interval _sin_cos(interval x, double shift, int undefined)
+{
+	/* cos(x) = sin(x + pi/2), maximums of sin are pi/2 + 2k*pi, minimums are -pi/2 + 2k*pi */
+	double lo = x.lo + shift, hi = x.hi + shift;
+	if(!isfinite(lo) || !isfinite(hi) || hi - lo >= 2 * M_PI)
+		return _make(-1, 1, undefined);
+
+	double a = sin(lo), b = sin(hi);
+	double rlo = a < b ? a : b, rhi = a < b ? b : a;
+
+	/* The periodic points are checked with some slack: M_PI is not exactly pi */
+	if(_contains_periodic(lo - 1e-9, hi + 1e-9, M_PI / 2, 2 * M_PI)) rhi = 1;
+	if(_contains_periodic(lo - 1e-9, hi + 1e-9, -M_PI / 2, 2 * M_PI)) rlo = -1;
+
+	interval r = _outward(rlo, rhi, 2, undefined);
+	if(r.lo < -1) r.lo = -1;
+	if(r.hi > 1) r.hi = 1;
+	return r;
+}
+
+static interval _pow(interval x, interval y, int undefined)
+{
+	/* Integer exponent: x^n */
+	if(y.lo == y.hi && y.lo == floor(y.lo) && fabs(y.lo) < 1e15)
+	{
+		double n = y.lo;
+		if(n == 0) return _make(1, 1, undefined);
+
+		interval r;
+		if(n < 0)
+		{ /* negative power: x^n = 1 / x^(-n), pow(0, n) is infinity (not a value of x^n) */
+			if(x.lo <= 0 && x.hi >= 0) return _whole(undefined | INTERVAL_MAYBE_UNDEFINED);
+			interval p = _pow(x, _make(-n, -n, 0), undefined);
+			return _outward(1 / p.hi, 1 / p.lo, 1, undefined);
+		}
+
+		int even = fmod(n, 2) == 0;
+		if(x.lo >= 0 || !even)
+			r = _outward(pow(x.lo, n), pow(x.hi, n), 2, undefined); /* increasing */
+		else if(x.hi <= 0)
+			r = _outward(pow(x.hi, n), pow(x.lo, n), 2, undefined);
+		else /* even power, 0 is inside */
+		{
+			double a = pow(x.lo, n), b = pow(x.hi, n);
+			r = _outward(0, a > b ? a : b, 2, undefined);
+			r.lo = 0;
+		}
+		return r;
+	}
+
+	/* Negative base: NAN for non-integer exponents, any value for integer ones */
+	if(x.lo < 0 && y.lo != y.hi) return _whole(undefined | INTERVAL_MAYBE_UNDEFINED);
+	if(x.hi < 0) return _nowhere();
+	if(x.lo < 0)
+	{
+		undefined |= INTERVAL_MAYBE_UNDEFINED;
+		x.lo = 0;
+	}
+
+	/* For positive base pow() is monotone in each argument, so the range is between the corners */
+	double p[4] = { pow(x.lo, y.lo), pow(x.lo, y.hi), pow(x.hi, y.lo), pow(x.hi, y.hi) };
+	double lo = p[0], hi = p[0];
+	int i;
+	for(i = 1; i < 4; i ++)
+	{
+		if(p[i] < lo) lo = p[i];
+		if(p[i] > hi) hi = p[i];
+	}
+
+	/* 0^y is 1 for y = 0, when the exponent crosses 0 */
+	if(x.lo == 0 && y.lo < 0 && y.hi > 0) hi = INFINITY;
+	return _outward(lo, hi, 2, undefined);
+}
+
+/* Logarithms: undefined for x < 0, log(0) is -infinity */
+static interval _log(double (*f)(double), interval x, int undefined)
+{
+	if(x.hi < 0) return _nowhere();
+	if(x.lo < 0)
+	{
+		undefined |= INTERVAL_MAYBE_UNDEFINED;
+		x.lo = 0;
+	}
+	return _monotone(f, x, 1, undefined);
+}
+
+/* asin() and acos(): undefined outside of [-1; 1] */
+static interval _arc(double (*f)(double), interval x, int increasing, int undefined)
+{
+	if(x.lo > 1 || x.hi < -1) return _nowhere();
+	if(x.lo < -1 || x.hi > 1)
+	{
+		undefined |= INTERVAL_MAYBE_UNDEFINED;
+		if(x.lo < -1) x.lo = -1;
+		if(x.hi > 1) x.hi = 1;
+	}
+	return _monotone(f, x, increasing, undefined);
+}
+
+static interval _tan(interval x, int undefined)
+{
+	if(!isfinite(x.lo) || !isfinite(x.hi) || x.hi - x.lo >= M_PI
+		|| _contains_periodic(x.lo - 1e-9, x.hi + 1e-9, M_PI / 2, M_PI))
+			return _whole(undefined);
+	return _monotone(tan, x, 1, undefined);
+}
+
+static interval _ctg(interval x, int undefined)
+{
+	/* _calc() returns NAN where tan(x) is 0 */
+	if(!isfinite(x.lo) || !isfinite(x.hi) || x.hi - x.lo >= M_PI
+		|| _contains_periodic(x.lo - 1e-9, x.hi + 1e-9, 0, M_PI))
+	{
+		if(x.lo == x.hi && tan(x.lo) == 0) return _nowhere();
+		return _whole(undefined | INTERVAL_MAYBE_UNDEFINED);
+	}
+
+	/* ctg is decreasing between its poles */
+	return _outward(1 / tan(x.hi), 1 / tan(x.lo), 3, undefined);
+}
+
+/*
+	Evaluate 'expr' (a part of the node 'F') with additional variables,
+	e.g. the integrand with the range of the integration variable.
+*/
+static interval _with_vars(formula F, formula expr, const interval *args, int count, formula *vars, const interval *ranges)
+{
+	int args_count = symtable_count(F->args), i, d;
+	int *names = malloc(sizeof(int) * (count + 1));
+	if(!names) return _whole(INTERVAL_MAYBE_UNDEFINED);
+
+	for(d = 0; d < count; d ++)
+	{
+		names[d] = _VAR_ID(vars[d]);
+
+		/* Temporarily: symtable_del() is being called when everything is done (as in _simpson_eval()) */
+		symtable_add_id(F->args, names[d]);
+	}
+
+	int total = symtable_count(F->args);
+	interval *copy = malloc(sizeof(interval) * (total + 1));
+	char *is_var = calloc(total + 1, 1);
+	interval r = _whole(INTERVAL_MAYBE_UNDEFINED);
+
+	if(copy && is_var)
+	{
+		for(d = 0; d < count; d ++)
+		{
+			int slot = symtable_order_id(F->args, names[d]);
+			is_var[slot] = 1;
+			copy[slot] = ranges[d];
+		}
+		for(i = 0, d = 0; i < total; i ++)
+			if(!is_var[i] && d < args_count)
+				copy[i] = args[d ++];
+
+		r = _interval(expr, copy);
+	}
+
+	for(d = 0; d < count; d ++)
+		symtable_del_id(F->args, names[d]);
+
+	free(copy);
+	free(is_var);
+	free(names);
+	return r;
+}
+
+/* Hull of two intervals */
+static interval _hull(interval a, interval b)
+{
+	return _make(a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi, _merge(a.undefined, b.undefined));
+}
+
+/* Infinite bounds are replaced with 200 (as in _simpson_eval()), the result is still guaranteed */
+static interval _bound(interval b)
+{
+	if(b.lo == INFINITY) b.lo = 200;
+	if(b.lo == -INFINITY) b.lo = -200;
+	if(b.hi == INFINITY) b.hi = 200;
+	if(b.hi == -INFINITY) b.hi = -200;
+	return b;
+}
+
+/*
+	Integral of f from a to b is (b - a) * m, where m is the mean value of f,
+	which is in the range of f at the hull of [a; b].
+*/
+static interval _integral(formula F, const interval *args)
+{
+	interval a = _bound(_interval(F->arg2, args));
+	interval b = _bound(_interval(F->other_args->arg[0], args));
+	if(a.undefined == INTERVAL_UNDEFINED || b.undefined == INTERVAL_UNDEFINED)
+		return _nowhere();
+
+	int undefined = _merge(a.undefined, b.undefined), i;
+	formula *var = &F->other_args->arg[1];
+
+	if(a.hi > b.lo)
+	{ /* the bounds overlap (or b < a) */
+		interval x = _hull(a, b);
+		interval f = _with_vars(F, F->arg1, args, 1, var, &x);
+		if(f.undefined == INTERVAL_UNDEFINED) return _nowhere();
+
+		interval length = _outward(b.lo - a.hi, b.hi - a.lo, 1, 0);
+		return _multiply(length, f, _merge(undefined, f.undefined));
+	}
+
+	/*
+		Integral from a to b = (a.hi - a) * f([a.lo; a.hi]) + integral from a.hi to b.lo
+			+ (b - b.lo) * f([b.lo; b.hi]),
+		and the middle part is divided into pieces to make the range narrower.
+	*/
+	interval sum = _make(0, 0, undefined), x, f, length;
+	for(i = 0; i < INTERVAL_INTEGRAL_PIECES + 2; i ++)
+	{
+		if(i == 0)
+		{
+			x = a;
+			length = _make(0, a.hi - a.lo, 0);
+		}
+		else if(i == INTERVAL_INTEGRAL_PIECES + 1)
+		{
+			x = b;
+			length = _make(0, b.hi - b.lo, 0);
+		}
+		else
+		{
+			double step = (b.lo - a.hi) / INTERVAL_INTEGRAL_PIECES;
+			x.lo = a.hi + (i - 1) * step;
+			x.hi = (i == INTERVAL_INTEGRAL_PIECES) ? b.lo : a.hi + i * step;
+			length = _outward(x.hi - x.lo, x.hi - x.lo, 1, 0);
+		}
+		if(length.hi == 0) continue;
+
+		f = _with_vars(F, F->arg1, args, 1, var, &x);
+		if(f.undefined == INTERVAL_UNDEFINED) return _nowhere();
+
+		f = _multiply(length, f, f.undefined);
+		sum = _outward(sum.lo + f.lo, sum.hi + f.hi, 1, _merge(sum.undefined, f.undefined));
+	}
+	return sum;
+}
+
+static interval _cubature(formula F, const interval *args)
+{
+	int dims = F->other_args->count / 3, d, undefined = 0;
+	interval volume = _make(1, 1, 0);
+	formula vars[CUBATURE_MAX_DIMS];
+	interval ranges[CUBATURE_MAX_DIMS];
+
+	if(dims > CUBATURE_MAX_DIMS) return _whole(INTERVAL_MAYBE_UNDEFINED);
+	for(d = 0; d < dims; d ++)
+	{
+		interval a = _bound(_interval(F->other_args->arg[3 * d], args));
+		interval b = _bound(_interval(F->other_args->arg[3 * d + 1], args));
+		if(a.undefined == INTERVAL_UNDEFINED || b.undefined == INTERVAL_UNDEFINED)
+			return _nowhere();
+
+		undefined = _merge(undefined, _merge(a.undefined, b.undefined));
+		volume = _multiply(volume, _outward(b.lo - a.hi, b.hi - a.lo, 1, 0), 0);
+		ranges[d] = _hull(a, b);
+		vars[d] = F->other_args->arg[3 * d + 2];
+	}
+
+	interval f = _with_vars(F, F->arg1, args, dims, vars, ranges);
+	if(f.undefined == INTERVAL_UNDEFINED) return _nowhere();
+	return _multiply(volume, f, _merge(undefined, f.undefined));
+}
+
+/* Derivative is calculated from the values in X-0.01 and X+0.01 (see _derivative_eval()) */
+static interval _derivative(formula F, const interval *args)
+{
+	if(F->arg2->action != F_VAR) return _nowhere();
+
+	int n = symtable_count(F->args), idx = symtable_order(F->arg2);
+	interval *copy = malloc(sizeof(interval) * (n + 1));
+	if(!copy) return _whole(INTERVAL_MAYBE_UNDEFINED);
+
+	memcpy(copy, args, sizeof(interval) * n);
+	copy[idx].lo -= 0.01;
+	copy[idx].hi += 0.01;
+
+	interval f = _interval(F->arg1, copy);
+	free(copy);
+
+	if(f.undefined == INTERVAL_UNDEFINED) return _nowhere();
+	return _whole(f.undefined);
+}
+
+static interval _interval(formula F, const interval *args)
+{
+	interval x, y;
+
+	switch(F->action)
+	{
+		case F_CONST:
+			return _make(_get_const(F), _get_const(F), INTERVAL_DEFINED);
+		case F_VAR:
+			x = args[symtable_order(F)];
+			x.undefined = (isnan(x.lo) || isnan(x.hi)) ? INTERVAL_UNDEFINED : INTERVAL_DEFINED;
+			return x;
+		case F_INTEGRAL:
+			return _integral(F, args);
+		case F_CUBATURE:
+			return _cubature(F, args);
+		case F_DERIVATIVE:
+			return _derivative(F, args);
+		case F_HOISTED:
+		case F_MEMO:
+		case F_CUMULATIVE:
+		case F_APPROX:
+		case F_POLY:
+			return _interval(F->arg1, args); /* the exact formula */
+		case F_TABLE:
+			return _nowhere();
+		case F_SUM:
+		case F_PROD:
+		case F_ELEMENT:
+			return _whole(INTERVAL_MAYBE_UNDEFINED); /* not supported */
+	}
+
+	x = _interval(F->arg1, args);
+	if(x.undefined == INTERVAL_UNDEFINED) return _nowhere();
+	if(F->arg2)
+	{
+		y = _interval(F->arg2, args);
+		if(y.undefined == INTERVAL_UNDEFINED) return _nowhere();
+	}
+	else
+		y = _make(0, 0, INTERVAL_DEFINED);
+
+	return _apply(F->action, x, y);
+}
+
+/* Operation of _calc() applied to the ranges of its operands */
+static interval _apply(int action, interval x, interval y)
+{
+	int u = x.undefined | y.undefined;
+	switch(action)
+	{
+		case F_NOT: return _make(-x.hi, -x.lo, u);
+		case F_ADD: return _outward(x.lo + y.lo, x.hi + y.hi, 1, u);
+		case F_SUB: return _outward(x.lo - y.hi, x.hi - y.lo, 1, u);
+		case F_MUL: return _multiply(x, y, u);
+		case F_DIV: return _divide(x, y, u);
+		case F_POW: return _pow(x, y, u);
+		case F_EXP: return _monotone(exp, x, 1, u);
+		case F_SIN: return _sin_cos(x, 0, u);
+		case F_COS: return _sin_cos(x, M_PI / 2, u);
+		case F_TAN: return _tan(x, u);
+		case F_CTG: return _ctg(x, u);
+		case F_D2R: return _multiply(x, _make(3.14 / 180, 3.14 / 180, 0), u);
+		case F_ASIN: return _arc(asin, x, 1, u);
+		case F_ACOS: return _arc(acos, x, 0, u);
+		case F_ATAN: return _monotone(atan, x, 1, u);
+		case F_LN: return _log(log, x, u);
+		case F_LG: return _log(log10, x, u);
+		case F_LOG2: return _log(log2, x, u);
+		case F_ABS:
+			if(x.lo >= 0) return x;
+			if(x.hi <= 0) return _make(-x.hi, -x.lo, u);
+			return _make(0, -x.lo > x.hi ? -x.lo : x.hi, u);
+	}
+	return _whole(INTERVAL_MAYBE_UNDEFINED);
+}
+
+/*
+	Partial derivatives (forward mode): r receives the range of F, g[i] the range of dF/dx_i.
+	Returns 0 if F is not differentiable (or may be undefined) somewhere in the box.
+*/
+static int _gradient(formula F, const interval *args, int n, interval *r, interval *g)
+{
+	const interval zero = _make(0, 0, INTERVAL_DEFINED), one = _make(1, 1, INTERVAL_DEFINED);
+	int i;
+
+	switch(F->action)
+	{
+		case F_CONST:
+			*r = _make(_get_const(F), _get_const(F), INTERVAL_DEFINED);
+			for(i = 0; i < n; i ++) g[i] = zero;
+			return 1;
+		case F_VAR:
+			*r = args[symtable_order(F)];
+			r->undefined = INTERVAL_DEFINED;
+			for(i = 0; i < n; i ++) g[i] = zero;
+			g[symtable_order(F)] = one;
+			return 1;
+		case F_HOISTED:
+		case F_MEMO:
+		case F_CUMULATIVE:
+		case F_APPROX:
+		case F_POLY:
+			return _gradient(F->arg1, args, n, r, g);
+		case F_INTEGRAL:
+		case F_CUBATURE:
+		case F_DERIVATIVE:
+		case F_TABLE:
+		case F_SUM:
+		case F_PROD:
+		case F_ELEMENT:
+			return 0;
+	}
+
+	interval x, y = zero, gx[n], gy[n];
+	if(!_gradient(F->arg1, args, n, &x, gx)) return 0;
+	if(F->arg2)
+	{
+		if(!_gradient(F->arg2, args, n, &y, gy)) return 0;
+	}
+	else
+		for(i = 0; i < n; i ++) gy[i] = zero;
+
+	*r = _apply(F->action, x, y);
+	if(r->undefined != INTERVAL_DEFINED) return 0;
+
+	/* dF = a * dx + b * dy */
+	interval a = zero, b = zero, t;
+	switch(F->action)
+	{
+		case F_NOT: a = _make(-1, -1, 0); break;
+		case F_ADD: a = b = one; break;
+		case F_SUB: a = one; b = _make(-1, -1, 0); break;
+		case F_MUL: a = y; b = x; break;
+		case F_DIV:
+			a = _divide(one, y, 0);
+			t = _divide(*r, y, 0);
+			b = _make(-t.hi, -t.lo, t.undefined);
+			break;
+		case F_POW:
+			/* y - 1 is calculated exactly if possible: x^(n-1) is simpler for integer n */
+			t = (y.lo == y.hi && (y.lo - 1) + 1 == y.lo) ? _make(y.lo - 1, y.lo - 1, 0) : _apply(F_SUB, y, one);
+			a = _multiply(y, _pow(x, t, 0), 0);
+			if(x.lo > 0)
+				b = _multiply(*r, _log(log, x, 0), 0);
+			else
+				for(i = 0; i < n; i ++)
+					if(gy[i].lo != 0 || gy[i].hi != 0) return 0; /* x^y with variable y needs x > 0 */
+			break;
+		case F_EXP: a = *r; break;
+		case F_SIN: a = _sin_cos(x, M_PI / 2, 0); break;
+		case F_COS: t = _sin_cos(x, 0, 0); a = _make(-t.hi, -t.lo, 0); break;
+		case F_TAN: a = _apply(F_ADD, one, _pow(*r, _make(2, 2, 0), 0)); break;
+		case F_CTG: t = _apply(F_ADD, one, _pow(*r, _make(2, 2, 0), 0)); a = _make(-t.hi, -t.lo, 0); break;
+		case F_D2R: a = _make(3.14 / 180, 3.14 / 180, 0); break;
+		case F_ASIN:
+		case F_ACOS:
+			if(x.lo <= -1 || x.hi >= 1) return 0;
+			t = _divide(one, _pow(_apply(F_SUB, one, _pow(x, _make(2, 2, 0), 0)), _make(0.5, 0.5, 0), 0), 0);
+			a = F->action == F_ASIN ? t : _make(-t.hi, -t.lo, 0);
+			break;
+		case F_ATAN: a = _divide(one, _apply(F_ADD, one, _pow(x, _make(2, 2, 0), 0)), 0); break;
+		case F_LN:
+		case F_LG:
+		case F_LOG2:
+			if(x.lo <= 0) return 0;
+			a = _divide(one, x, 0);
+			if(F->action == F_LG) a = _divide(a, _outward(M_LN10, M_LN10, 1, 0), 0);
+			if(F->action == F_LOG2) a = _divide(a, _outward(M_LN2, M_LN2, 1, 0), 0);
+			break;
+		case F_ABS:
+			if(x.lo >= 0) a = one;
+			else if(x.hi <= 0) a = _make(-1, -1, 0);
+			else a = _make(-1, 1, 0); /* F is still Lipschitz, this is enough for the mean value form */
+			break;
+		default:
+			return 0;
+	}
+
+	for(i = 0; i < n; i ++)
+	{
+		g[i] = _apply(F_ADD, _multiply(a, gx[i], 0), _multiply(b, gy[i], 0));
+		if(g[i].undefined != INTERVAL_DEFINED) return 0;
+	}
+	return 1;
+}
+
+interval eval_interval_gradient(const formula F, const interval *args, interval *gradient)
+{
+	int i, n = symtable_count(F->vars);
+	interval r = eval_interval(F, args), v;
+
+	if(r.undefined != INTERVAL_DEFINED || !_gradient(F, args, n, &v, gradient))
+		for(i = 0; i < n; i ++)
+			gradient[i] = _whole(INTERVAL_MAYBE_UNDEFINED);
+	return r;
+}
+
+interval eval_interval(const formula F, const interval *args)
+{
+	int i, n = symtable_count(F->vars);
+	for(i = 0; i < n; i ++)
+		if(!(args[i].lo <= args[i].hi)) return _nowhere();
+
+	interval r = _interval(F, args);
+	if(r.undefined == INTERVAL_UNDEFINED) return _nowhere();
+	return r;
+}
@@ -0,0 +1,62 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _INTERVAL_H
+#define _INTERVAL_H
+
+#include "formula.h"
+
+/* Values of interval.undefined */
+#define INTERVAL_DEFINED 0 /* the formula is defined everywhere in the box */
+#define INTERVAL_MAYBE_UNDEFINED 1 /* eval() may return NAN somewhere in the box */
+#define INTERVAL_UNDEFINED 2 /* eval() returns NAN everywhere in the box */
+
+/**
+	@brief Range of values [lo; hi].
+*/
+typedef struct _interval
+{
+	double lo, hi;
+	int undefined; /* one of INTERVAL_* constants above (only in results of eval_interval()) */
+} interval;
+
+/**
+	@brief Calculate the range of values of F when its arguments are in the given ranges.
+	@param F Formula object.
+	@param args Array of formula_args(F) ranges of arguments (in the order of eval() parameters).
+	@returns Range which contains all values of F (where F is defined).
+		Its 'undefined' field tells if eval() may return NAN for some arguments.
+
+	@note The range is guaranteed (rounding errors are taken into account),
+		but it may be wider than the exact range of values.
+	@note For integrals, the range contains the exact value of the integral,
+		not necessarily the value calculated numerically.
+	@note Like eval(), this is not thread-safe for the same formula.
+*/
+interval eval_interval(const formula F, const interval *args) __attribute__((nonnull(1)));
+
+/**
+	@brief Calculate the range of values of F and the ranges of its partial derivatives.
+	@param F Formula object.
+	@param args Array of formula_args(F) ranges of arguments.
+	@param gradient Array of formula_args(F) ranges, receives the range of dF/dx_i for each argument.
+		If F contains integrals or derivatives (or may be undefined in the box),
+		the ranges are [-inf; inf] with INTERVAL_MAYBE_UNDEFINED flag.
+	@returns The same as eval_interval().
+*/
+interval eval_interval_gradient(const formula F, const interval *args, interval *gradient)
+	__attribute__((nonnull(1,3)));
+
+#endif
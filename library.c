@@ -0,0 +1,312 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "library.h"
+
+#define LIBRARY_MIN_CHUNK 65536 /* don't start a thread for less text than this */
+
+/* Part of the text parsed by one thread */
+struct _chunk
+{
+	const char *start, *end; /* both are at the beginning of a line */
+	struct _library_entry *entries;
+	int count, size;
+	int lines; /* number of lines in the chunk */
+	int error_line; /* first invalid line (from 1, within the chunk), 0 if none */
+	int failed; /* not enough memory */
+};
+
+static int _name_char(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
+		|| (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+static int _space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Parse one line [p; end), returns 0 if it's invalid */
+static int _line(struct _chunk *C, const char *p, const char *end, int line)
+{
+	while(p < end && _space(*p)) p ++;
+	if(p == end || *p == '#') return 1;
+
+	const char *name = p;
+	while(p < end && _name_char(*p)) p ++;
+	int name_length = p - name;
+
+	while(p < end && _space(*p)) p ++;
+	if(!name_length || p == end || *p != '=') return 0;
+	p ++;
+
+	if(C->count == C->size)
+	{
+		int size = C->size ? C->size * 2 : 64;
+		struct _library_entry *entries = realloc(C->entries, sizeof(struct _library_entry) * size);
+		if(!entries)
+		{
+			C->failed = 1;
+			return 0;
+		}
+		C->entries = entries;
+		C->size = size;
+	}
+
+	formula F = parse_n(NULL, p, end - p, NULL);
+	if(!F) return 0;
+
+	struct _library_entry *E = &C->entries[C->count ++];
+	E->name = name;
+	E->name_length = name_length;
+	E->line = line;
+	E->F = F;
+	return 1;
+}
+
+static void *_parse_chunk(void *arg)
+{
+	struct _chunk *C = (struct _chunk *) arg;
+	const char *p = C->start, *eol;
+
+	for(C->lines = 0; p < C->end; p = eol + 1)
+	{
+		eol = memchr(p, '\n', C->end - p);
+		if(!eol) eol = C->end;
+
+		C->lines ++;
+		if(!_line(C, p, eol, C->lines))
+		{
+			C->error_line = C->lines;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static uint32_t _hash(const char *name, int length)
+{ /* FNV-1a */
+	uint32_t h = 2166136261u;
+	int i;
+	for(i = 0; i < length; i ++)
+		h = (h ^ (unsigned char) name[i]) * 16777619u;
+	return h;
+}
+
+/* Slot of the name in L->index (the slot with -1 if the name is not there) */
+static int _slot(const library L, const char *name, int length)
+{
+	int mask = L->index_size - 1, i = _hash(name, length) & mask;
+	while(L->index[i] != -1)
+	{
+		struct _library_entry *E = &L->entries[L->index[i]];
+		if(E->name_length == length && !memcmp(E->name, name, length))
+			break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/* Returns the line with the duplicate name (-1 if not enough memory, 0 if no error) */
+static int _build_index(library L)
+{
+	int i;
+	for(L->index_size = 16; L->index_size < 2 * L->count; L->index_size *= 2);
+
+	L->index = malloc(sizeof(int) * L->index_size);
+	if(!L->index) return -1;
+	for(i = 0; i < L->index_size; i ++)
+		L->index[i] = -1;
+
+	for(i = 0; i < L->count; i ++)
+	{
+		struct _library_entry *E = &L->entries[i];
+		int slot = _slot(L, E->name, E->name_length);
+		if(L->index[slot] != -1) return E->line;
+		L->index[slot] = i;
+	}
+	return 0;
+}
+
+static library _load(const char *text, size_t length, int threads, int *error_line)
+{
+	int i, j, lines = 0, error = 0, failed = 0;
+	if(error_line) *error_line = 0;
+
+	if(threads > (int) (length / LIBRARY_MIN_CHUNK) + 1)
+		threads = length / LIBRARY_MIN_CHUNK + 1;
+	if(threads < 1) threads = 1;
+
+	library L = calloc(1, sizeof(struct _library));
+	struct _chunk *chunks = calloc(threads, sizeof(struct _chunk));
+	pthread_t *tid = calloc(threads, sizeof(pthread_t));
+	if(!L || !chunks || !tid)
+	{
+		free(L);
+		free(chunks);
+		free(tid);
+		return NULL;
+	}
+
+	/* Split the text into chunks of nearly equal length (at line boundaries) */
+	const char *p = text, *end = text + length;
+	for(i = 0; i < threads; i ++)
+	{
+		const char *chunk_end = (i == threads - 1) ? end : text + length / threads * (i + 1);
+		if(chunk_end < p) chunk_end = p;
+		if(chunk_end < end)
+		{
+			const char *eol = memchr(chunk_end, '\n', end - chunk_end);
+			chunk_end = eol ? eol + 1 : end;
+		}
+		chunks[i].start = p;
+		chunks[i].end = chunk_end;
+		p = chunk_end;
+	}
+
+	for(i = 1; i < threads; i ++)
+		if(pthread_create(&tid[i], NULL, _parse_chunk, &chunks[i]))
+		{
+			tid[i] = 0;
+			_parse_chunk(&chunks[i]);
+		}
+	_parse_chunk(&chunks[0]);
+	for(i = 1; i < threads; i ++)
+		if(tid[i]) pthread_join(tid[i], NULL);
+
+	/* Merge the chunks */
+	for(i = 0; i < threads; i ++)
+	{
+		if(chunks[i].failed) failed = 1;
+		if(chunks[i].error_line && !error)
+			error = lines + chunks[i].error_line;
+		lines += chunks[i].lines;
+		L->count += chunks[i].count;
+	}
+
+	if(!error && !failed)
+	{
+		L->entries = malloc(sizeof(struct _library_entry) * (L->count ? L->count : 1));
+		if(L->entries)
+		{
+			for(i = 0, lines = 0, L->count = 0; i < threads; i ++)
+			{
+				for(j = 0; j < chunks[i].count; j ++)
+				{
+					L->entries[L->count] = chunks[i].entries[j];
+					L->entries[L->count ++].line += lines;
+				}
+				lines += chunks[i].lines;
+				chunks[i].count = 0;
+			}
+
+			error = _build_index(L);
+			if(error == -1)
+			{
+				error = 0;
+				failed = 1;
+			}
+		}
+		else failed = 1;
+	}
+
+	for(i = 0; i < threads; i ++)
+	{
+		for(j = 0; j < chunks[i].count; j ++)
+			formula_free(chunks[i].entries[j].F);
+		free(chunks[i].entries);
+	}
+	free(chunks);
+	free(tid);
+
+	if(error || failed)
+	{
+		if(error_line && !failed) *error_line = error;
+		library_free(L); /* frees the formulas if they were moved to L->entries */
+		return NULL;
+	}
+	return L;
+}
+
+library library_load_memory(const char *text, size_t length, int threads, int *error_line)
+{
+	return _load(text, length, threads, error_line);
+}
+
+library library_load(const char *filename, int threads, int *error_line)
+{
+	struct stat st;
+	void *map = NULL;
+
+	if(error_line) *error_line = 0;
+
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) return NULL;
+	if(fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return NULL;
+	}
+	if(st.st_size > 0)
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED)
+		{
+			close(fd);
+			return NULL;
+		}
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd); /* the mapping stays */
+
+	library L = _load(map ? map : "", st.st_size, threads, error_line);
+	if(!L)
+	{
+		if(map) munmap(map, st.st_size);
+		return NULL;
+	}
+	L->map = map;
+	L->map_size = st.st_size;
+	return L;
+}
+
+formula library_get(const library L, const char *name)
+{
+	int length = strlen(name);
+	int i = L->index[_slot(L, name, length)];
+	return i == -1 ? NULL : L->entries[i].F;
+}
+
+void library_free(library L)
+{
+	int i;
+	if(L->entries)
+		for(i = 0; i < L->count; i ++)
+			formula_free(L->entries[i].F);
+	free(L->entries);
+	free(L->index);
+	if(L->map) munmap(L->map, L->map_size);
+	free(L);
+}
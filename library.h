@@ -0,0 +1,93 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _LIBRARY_H
+#define _LIBRARY_H
+
+#include "formula.h"
+
+/*
+	Library of named formulas, loaded from a text file:
+
+		# comment
+		area = X*Y
+		gauss = $[exp(-X^2/2)]dX|0_A / 2.5066
+
+	One formula per line, "name = formula". Names consist of
+	letters, digits, '_' and '.'; empty lines and lines starting with '#' are ignored.
+*/
+
+struct _library_entry
+{
+	const char *name; /* not NUL-terminated, points into the text of the library */
+	int name_length;
+	int line;
+	formula F;
+};
+
+typedef struct _library
+{
+	int count;
+	struct _library_entry *entries; /* in the order of lines */
+	int *index; /* hash table: indexes in entries (-1 if the slot is empty) */
+	int index_size; /* power of 2 */
+
+	void *map; /* mmap()ed file (NULL for library_load_memory()) */
+	size_t map_size;
+} *library;
+
+/**
+	@brief Load the library from the file.
+	@param filename Path to the file.
+	@param threads Number of threads parsing the formulas (1 to parse in the current thread).
+	@param error_line Receives the number of the first invalid line (from 1), 0 if the error
+		is not in the file (e.g. it can't be read). Can be NULL.
+	@returns Library object, NULL on error.
+
+	@note The file is mmap()ed, formulas are parsed right from the mapped memory
+		(see parse_n()), names are not copied. The file is unmapped by library_free().
+*/
+library library_load(const char *filename, int threads, int *error_line)
+	__attribute__((nonnull(1) warn_unused_result));
+
+/**
+	@brief Load the library from the text in memory.
+	@param text The library, same as the contents of the file in library_load().
+	@param length Length of \b text in bytes (it doesn't need to be NUL-terminated).
+	@param threads Number of threads.
+	@param error_line Receives the number of the first invalid line (from 1) or 0. Can be NULL.
+	@returns Library object, NULL on error.
+
+	@warning Names of formulas point into \b text, so it must not be freed before library_free().
+*/
+library library_load_memory(const char *text, size_t length, int threads, int *error_line)
+	__attribute__((nonnull(1) warn_unused_result));
+
+/**
+	@brief Find the formula by name.
+	@param L Library object.
+	@param name Name of the formula.
+	@returns Formula object (owned by the library), NULL if there's no such formula.
+	@note Use formula_clone() to keep the formula after library_free().
+*/
+formula library_get(const library L, const char *name) __attribute__((nonnull(1,2)));
+
+/**
+	@brief Free all formulas of the library and unmap its file.
+	@param L Library object.
+*/
+void library_free(library L) __attribute__((nonnull));
+
+#endif
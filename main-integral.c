@@ -151,7 +151,7 @@ int main(int argc, char **argv)
 			return 1;
 		}
 
-		// Not needed if spaces are ignored by grammar (check lex_rules.l, yacc.y).
+		// Not needed if spaces are ignored by grammar (check parser.c).
 		// Just for compability.
 		code[j ++] = ' ';
 	}
@@ -15,10 +15,18 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <float.h>
 
 #include "minNvars.h"
 #include "min1var.h"
 #include "formula.h"
+#include "interval.h"
+#include "formula_internal.h"
 
 static inline point newpoint(int N)
 {
@@ -37,3 +45,395 @@ point minify_fastest_down(const formula F, double precision)
 
 	return X;
 }
+
+/*
+	Branch and bound.
+*/
+
+#define GLOBAL_MAX_BOXES (1 << 18) /* then the remaining boxes are not divided anymore */
+#define GLOBAL_MIN_WIDTH 1e-7 /* relative to the initial box */
+
+struct _box
+{
+	double bound; /* F >= bound everywhere in the box */
+	double x[]; /* N lower bounds, then N upper bounds */
+};
+
+/* Double-ended queue of boxes: the owner works at the tail, other threads steal from the head */
+struct _deque
+{
+	pthread_mutex_t lock;
+	struct _box **box;
+	int head, tail, capacity;
+};
+
+struct _global_job
+{
+	const formula F;
+	int N;
+	int threads;
+	double precision;
+	const double *lo, *hi; /* the initial box */
+	const double *width;
+
+	struct _deque *deques;
+	long pending; /* boxes in the queues or being processed */
+	long processed;
+
+	pthread_mutex_t lock; /* for the fields below */
+	double best; /* the smallest value found */
+	double *best_point;
+	double bound; /* the smallest bound of the boxes which were not divided */
+};
+
+struct _global_worker
+{
+	struct _global_job *J;
+	formula F; /* eval() is not thread-safe, so each thread has its own copy of F */
+	int id;
+};
+
+static int _deque_push(struct _deque *D, struct _box *b)
+{
+	pthread_mutex_lock(&D->lock);
+	if(D->tail == D->capacity)
+	{
+		if(D->head > 0)
+		{
+			memmove(D->box, D->box + D->head, sizeof(struct _box *) * (D->tail - D->head));
+			D->tail -= D->head;
+			D->head = 0;
+		}
+		else
+		{
+			int capacity = D->capacity ? D->capacity * 2 : 64;
+			struct _box **box = realloc(D->box, sizeof(struct _box *) * capacity);
+			if(!box)
+			{
+				pthread_mutex_unlock(&D->lock);
+				return 0;
+			}
+			D->box = box;
+			D->capacity = capacity;
+		}
+	}
+	D->box[D->tail ++] = b;
+	pthread_mutex_unlock(&D->lock);
+	return 1;
+}
+
+static struct _box *_deque_take(struct _deque *D, int steal)
+{
+	struct _box *b = NULL;
+	pthread_mutex_lock(&D->lock);
+	if(D->tail > D->head)
+		b = steal ? D->box[D->head ++] : D->box[-- D->tail];
+	pthread_mutex_unlock(&D->lock);
+	return b;
+}
+
+static double _best(struct _global_job *J)
+{
+	double best;
+	pthread_mutex_lock(&J->lock);
+	best = J->best;
+	pthread_mutex_unlock(&J->lock);
+	return best;
+}
+
+/*
+	Calculate the bound of the box, returns 0 if the box can be thrown away
+	(F is undefined everywhere in it, or it can't contain the minimum).
+	'ranges' is the array of 3 * N intervals for temporary data.
+*/
+static int _box_bound(struct _global_job *J, const formula F, struct _box *b, interval *ranges)
+{
+	int N = J->N, i;
+	interval *gradient = ranges + N, *center = ranges + 2 * N;
+
+	for(i = 0; i < N; i ++)
+	{
+		ranges[i].lo = b->x[i];
+		ranges[i].hi = b->x[N + i];
+	}
+
+	interval r = eval_interval_gradient(F, ranges, gradient);
+	if(r.undefined == INTERVAL_UNDEFINED) return 0;
+	b->bound = r.lo;
+
+	if(gradient[0].undefined != INTERVAL_DEFINED)
+		return 1; /* no derivatives, e.g. F contains integrals */
+
+	/*
+		Monotonicity: if F increases by x_i, its minimum is at the lower face of the box.
+		If this face is inside the initial box, it also belongs to the neighbour box.
+	*/
+	for(i = 0; i < N; i ++)
+	{
+		if(gradient[i].lo > 0)
+		{
+			if(b->x[i] > J->lo[i]) return 0;
+			b->x[N + i] = b->x[i];
+		}
+		else if(gradient[i].hi < 0)
+		{
+			if(b->x[N + i] < J->hi[i]) return 0;
+			b->x[i] = b->x[N + i];
+		}
+	}
+
+	/* Mean value form: F(X) is within F(c) + sum of dF/dx_i(X) * (X_i - c_i) */
+	for(i = 0; i < N; i ++)
+	{
+		double c = (b->x[i] + b->x[N + i]) / 2;
+		center[i].lo = center[i].hi = c;
+		ranges[i].lo = b->x[i] - c;
+		ranges[i].hi = b->x[N + i] - c;
+	}
+	interval fc = eval_interval(F, center);
+	if(fc.undefined != INTERVAL_DEFINED) return 1;
+
+	double mv = fc.lo, magnitude = fabs(fc.lo);
+	for(i = 0; i < N; i ++)
+	{ /* the smallest product of [g.lo; g.hi] and [d.lo; d.hi], d.lo <= 0 <= d.hi */
+		double p1 = gradient[i].hi * ranges[i].lo, p2 = gradient[i].lo * ranges[i].hi;
+		if(ranges[i].lo == 0) p1 = 0;
+		if(ranges[i].hi == 0) p2 = 0;
+		mv += p1 < p2 ? p1 : p2;
+		magnitude += fabs(p1 < p2 ? p1 : p2);
+	}
+	mv -= magnitude * (N + 2) * DBL_EPSILON; /* rounding errors of the sum */
+
+	if(mv > b->bound) b->bound = mv;
+	return 1;
+}
+
+static void _box_done(struct _global_job *J, struct _box *b)
+{
+	pthread_mutex_lock(&J->lock);
+	if(b->bound < J->bound) J->bound = b->bound;
+	pthread_mutex_unlock(&J->lock);
+	free(b);
+}
+
+static void _process_box(struct _global_worker *W, const formula F, struct _box *b, double *mid, interval *ranges)
+{
+	struct _global_job *J = W->J;
+	int N = J->N, i, d = 0;
+
+	if(b->bound >= _best(J) - J->precision)
+	{ /* can't contain anything better */
+		free(b);
+		return;
+	}
+
+	/* The value in the middle of the box: the best one may be improved */
+	double widest = -1;
+	for(i = 0; i < N; i ++)
+	{
+		mid[i] = (b->x[i] + b->x[N + i]) / 2;
+
+		double w = (b->x[N + i] - b->x[i]) / (J->width[i] ? J->width[i] : 1);
+		if(w > widest)
+		{
+			widest = w;
+			d = i;
+		}
+	}
+
+	double v = eval_array(F, mid);
+	if(!isnanl(v))
+	{
+		pthread_mutex_lock(&J->lock);
+		if(v < J->best)
+		{
+			J->best = v;
+			memcpy(J->best_point, mid, sizeof(double) * N);
+		}
+		pthread_mutex_unlock(&J->lock);
+	}
+
+	if(b->bound >= _best(J) - J->precision)
+	{
+		free(b);
+		return;
+	}
+
+	if(widest < GLOBAL_MIN_WIDTH || __sync_add_and_fetch(&J->processed, 1) > GLOBAL_MAX_BOXES)
+	{ /* can't divide it anymore, its bound is used in the final lower bound */
+		_box_done(J, b);
+		return;
+	}
+
+	/* Divide the box in two halves along the widest side */
+	size_t size = sizeof(struct _box) + sizeof(double) * 2 * N;
+	struct _box *half[2];
+	half[0] = b;
+	half[1] = malloc(size);
+	if(!half[1])
+	{
+		_box_done(J, b);
+		return;
+	}
+	memcpy(half[1], b, size);
+	half[0]->x[N + d] = mid[d];
+	half[1]->x[d] = mid[d];
+
+	int defined[2];
+	for(i = 0; i < 2; i ++)
+		defined[i] = _box_bound(J, F, half[i], ranges);
+
+	/* The half with smaller bound is pushed last, so it is processed first */
+	if(defined[0] && (!defined[1] || half[0]->bound < half[1]->bound))
+	{
+		struct _box *t = half[0];
+		half[0] = half[1];
+		half[1] = t;
+		int u = defined[0];
+		defined[0] = defined[1];
+		defined[1] = u;
+	}
+
+	for(i = 0; i < 2; i ++)
+	{
+		if(!defined[i] || half[i]->bound >= _best(J) - J->precision)
+		{
+			free(half[i]);
+			continue;
+		}
+
+		__sync_add_and_fetch(&J->pending, 1);
+		if(!_deque_push(&J->deques[W->id], half[i]))
+		{
+			__sync_sub_and_fetch(&J->pending, 1);
+			_box_done(J, half[i]);
+		}
+	}
+}
+
+static void *_global_worker(void *arg)
+{
+	struct _global_worker *W = (struct _global_worker *) arg;
+	struct _global_job *J = W->J;
+	int N = J->N, i;
+
+	formula F = W->F;
+	double *mid = malloc(sizeof(double) * N);
+	interval *ranges = malloc(sizeof(interval) * 3 * N);
+	if(!F || !mid || !ranges) goto cleanup;
+
+	while(__sync_add_and_fetch(&J->pending, 0) > 0)
+	{
+		struct _box *b = _deque_take(&J->deques[W->id], 0);
+		for(i = 1; !b && i < J->threads; i ++)
+			b = _deque_take(&J->deques[(W->id + i) % J->threads], 1);
+
+		if(!b)
+		{
+			sched_yield();
+			continue;
+		}
+
+		_process_box(W, F, b, mid, ranges);
+		__sync_sub_and_fetch(&J->pending, 1);
+	}
+
+cleanup:
+	free(mid);
+	free(ranges);
+	return NULL;
+}
+
+point minify_global(const formula F, const double *lo, const double *hi, double precision,
+	int threads, double *value, double *lower_bound)
+{
+	int N = formula_args(F), i;
+	if(N < 1 || !(precision > 0)) return NULL;
+	if(threads < 1) threads = 1;
+
+	size_t size = sizeof(struct _box) + sizeof(double) * 2 * N;
+	struct _box *root = malloc(size);
+	double *width = malloc(sizeof(double) * N);
+	interval *ranges = malloc(sizeof(interval) * 3 * N);
+	struct _deque *deques = calloc(threads, sizeof(struct _deque));
+	struct _global_worker *workers = malloc(sizeof(struct _global_worker) * threads);
+	point X = newpoint(N);
+
+	if(!root || !width || !ranges || !deques || !workers || !X)
+		goto fail;
+
+	for(i = 0; i < N; i ++)
+	{
+		if(!(lo[i] <= hi[i])) goto fail;
+		root->x[i] = lo[i];
+		root->x[N + i] = hi[i];
+		width[i] = hi[i] - lo[i];
+	}
+	struct _global_job J = {
+		.F = F,
+		.N = N,
+		.threads = threads,
+		.precision = precision,
+		.lo = lo,
+		.hi = hi,
+		.width = width,
+		.deques = deques,
+		.pending = 1,
+		.processed = 0,
+		.best = INFINITY,
+		.best_point = X,
+		.bound = INFINITY
+	};
+	if(!_box_bound(&J, F, root, ranges))
+		goto fail; /* undefined everywhere */
+
+	pthread_mutex_init(&J.lock, NULL);
+	for(i = 0; i < threads; i ++)
+		pthread_mutex_init(&deques[i].lock, NULL);
+
+	_deque_push(&deques[0], root);
+	root = NULL;
+
+	for(i = 0; i < threads; i ++)
+	{
+		workers[i].J = &J;
+		workers[i].id = i;
+	}
+	_formula_threads(F, threads, _global_worker, workers, sizeof(struct _global_worker), offsetof(struct _global_worker, F));
+
+	/* Boxes left if some thread failed to start (or had no memory) */
+	for(i = 0; i < threads; i ++)
+	{
+		struct _box *b;
+		while((b = _deque_take(&deques[i], 0)))
+			_box_done(&J, b);
+		free(deques[i].box);
+		pthread_mutex_destroy(&deques[i].lock);
+	}
+	pthread_mutex_destroy(&J.lock);
+
+	free(width);
+	free(ranges);
+	free(deques);
+	free(workers);
+
+	if(isinf(J.best) && J.best > 0)
+	{ /* F is undefined in all points which were checked */
+		free(X);
+		return NULL;
+	}
+
+	/* Boxes which were thrown away have F >= best - precision */
+	if(value) *value = J.best;
+	if(lower_bound) *lower_bound = J.bound < J.best - precision ? J.bound : J.best - precision;
+	return X;
+
+fail:
+	free(root);
+	free(width);
+	free(ranges);
+	free(deques);
+	free(workers);
+	free(X);
+	return NULL;
+}
@@ -29,4 +29,32 @@ typedef double *point; /* array of double values */
 */
 point minify_fastest_down(const formula F, double precision);
 
+/**
+	@brief Find the global minimum of F(x1, x2, ...) in the box lo <= x <= hi
+		by branch and bound method.
+
+	@param F Formula object.
+	@param lo Array of formula_args(F) lower bounds of the arguments.
+	@param hi Array of formula_args(F) upper bounds of the arguments.
+	@param precision Needed precision of the minimal value (e.g. 1e-6).
+	@param threads Number of threads to use (1 to run in the current thread).
+	@param value If not NULL, receives the smallest value of F found.
+	@param lower_bound If not NULL, receives the proven lower bound:
+		F >= lower_bound everywhere in the box (where F is defined).
+	@returns Point where F has the smallest value found (must be free()d),
+		NULL if F is undefined everywhere.
+
+	@note The box is divided into smaller boxes, and eval_interval() tells
+		which of them can't contain values smaller than the best one found.
+		Unless F is very hard to bound, lower_bound = value - precision.
+		It is not so for integrals with a variable integrand, because eval_interval()
+		bounds them with the range of the integrand in a few parts of [a; b]:
+		e.g. for $[X*X*A]dX|0_1 + B*B the minimum is -1/3, and lower_bound is -0.398.
+	@note Boxes are processed in parallel: each thread has its own queue
+		and takes boxes from the queues of other threads when it is empty.
+*/
+point minify_global(const formula F, const double *lo, const double *hi, double precision,
+	int threads, double *value, double *lower_bound)
+	__attribute__((nonnull(1,2,3) warn_unused_result));
+
 #endif
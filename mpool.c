@@ -18,11 +18,21 @@
 #include <malloc.h>
 #include <stdio.h>
 
+#define MPOOL_ALIGN 16 /* enough for any type */
+#define MPOOL_ROUND(size) (((size) + MPOOL_ALIGN - 1) & ~(MPOOL_ALIGN - 1))
+
+/* Blocks are never moved (realloc() would break pointers returned earlier) */
+struct _mpool_block
+{
+	struct _mpool_block *prev;
+};
+#define MPOOL_HEADER MPOOL_ROUND(sizeof(struct _mpool_block))
+
 struct _mpool
 {
-	void *start; /* the beginning of allocated memory */
-	void *pos; /* will be returned by next mpool_alloc() call */
-	void *end;
+	struct _mpool_block *last; /* the most recently allocated block */
+	char *pos; /* will be returned by next mpool_alloc() call */
+	char *end;
 };
 
 const int mpool_prealloc_size = 10240; // 10K
@@ -31,9 +41,8 @@ mpool mpool_new()
 	mpool pool = (mpool) malloc(sizeof(struct _mpool));
 	if(!pool) return NULL;
 
-	pool->start = malloc(mpool_prealloc_size);
-	pool->pos = pool->start;
-	pool->end = pool->start + mpool_prealloc_size;
+	pool->last = NULL;
+	pool->pos = pool->end = NULL;
 
 	return pool;
 }
@@ -41,28 +50,35 @@ mpool mpool_new()
 /* Destroy a memory pool and free everything allocated using this pool */
 void mpool_free(mpool pool)
 {
-	if(pool && pool->start)
+	if(!pool) return;
+
+	while(pool->last)
 	{
-		free(pool->start);
-		pool->start = NULL; /* double-free protection */
+		struct _mpool_block *prev = pool->last->prev;
+		free(pool->last);
+		pool->last = prev;
 	}
+	free(pool);
 }
 
 /* Allocate some memory.
 	NOTE: this memory can't be freed (will be released only after mpool is destroyed) */
 void *mpool_alloc(mpool pool, int size)
 {
-	while(pool->pos + size > pool->end)
+	size = MPOOL_ROUND(size);
+	if(!pool->pos || pool->pos + size > pool->end)
 	{
-		int newsize = pool->end - pool->start + mpool_prealloc_size;
-		void *newptr = realloc(pool->start, newsize);
-		if(!newptr)
+		int newsize = size > mpool_prealloc_size ? size : mpool_prealloc_size;
+		struct _mpool_block *block = malloc(MPOOL_HEADER + newsize);
+		if(!block)
 		{
 			fprintf(stderr, "MPOOL failed to extend: mpool_alloc() failed.\n");
 			return NULL;
 		}
-		pool->start = newptr;
-		pool->end = newptr + newsize;
+		block->prev = pool->last;
+		pool->last = block;
+		pool->pos = (char *) block + MPOOL_HEADER;
+		pool->end = pool->pos + newsize;
 	}
 
 	void *ret = pool->pos;
@@ -0,0 +1,680 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "formula_internal.h"
+
+/*
+	Optimizations which are too expensive to be done in _palloc4()
+	while the formula is being parsed.
+*/
+
+/*
+	Number of Gauss-Legendre points (per dimension) for fused integrals,
+	indexed by the number of dimensions. It is chosen so that
+	the number of evaluations stays within several thousands.
+*/
+static const int cubature_points[] = { 0, 0, 20, 12, 8, 6, 5 };
+#define FUSE_MAX_DIMS ((int) (sizeof(cubature_points) / sizeof(cubature_points[0])) - 1)
+
+/* Check whether any of the bounds depends on the variable */
+static int _bounds_depend_on(formula *bounds, int count, formula var)
+{
+	int i;
+	for(i = 0; i < count; i ++)
+		if(i % 3 != 2 && symtable_isset_id(bounds[i]->vars, _VAR_ID(var)))
+			return 1;
+	return 0;
+}
+
+/*
+	Nested integrals
+		$[ $[ f(A,B) ]dA|a_b ]dB|c_d
+	are replaced with one F_CUBATURE node (multi-dimensional Gauss-Legendre rule),
+	if the bounds of inner integrals don't depend on outer variables.
+
+	The outer node is modified in place, so the pointer to it remains valid.
+*/
+static void _fuse_integrals(formula F)
+{
+	if(F->action != F_INTEGRAL) return;
+
+	formula inner = F->arg1;
+	formula inner_bounds[3], *bounds;
+	int count, inner_dims;
+
+	if(inner->action == F_INTEGRAL)
+	{
+		inner_bounds[0] = inner->arg2;
+		inner_bounds[1] = inner->other_args->arg[0];
+		inner_bounds[2] = inner->other_args->arg[1];
+		bounds = inner_bounds;
+		count = 3;
+	}
+	else if(inner->action == F_CUBATURE)
+	{
+		bounds = inner->other_args->arg;
+		count = inner->other_args->count;
+	}
+	else return;
+
+	inner_dims = count / 3;
+	if(inner_dims + 1 > FUSE_MAX_DIMS) return;
+	if(_bounds_depend_on(bounds, count, F->other_args->arg[1])) return;
+
+	formula *list = malloc(sizeof(formula) * (count + 3));
+	double *points = malloc(sizeof(double));
+	if(!list || !points)
+	{
+		free(list);
+		free(points);
+		return;
+	}
+
+	/* Outer integral goes first */
+	list[0] = F->arg2;
+	list[1] = F->other_args->arg[0];
+	list[2] = F->other_args->arg[1];
+	memcpy(list + 3, bounds, sizeof(formula) * count);
+
+	*points = cubature_points[inner_dims + 1];
+	formula points_f = _alloc1(F_CONST, (formula) points);
+	points_f->args = F->args;
+
+	F->action = F_CUBATURE;
+	F->arg1 = inner->arg1;
+	F->arg2 = points_f;
+	free(F->other_args->arg);
+	F->other_args->arg = list;
+	F->other_args->count = count + 3;
+
+	/* Free the inner node itself (but not its arguments, which are now used by F) */
+	if(inner->action == F_CUBATURE)
+		_formula_free(inner->arg2);
+	free(inner->other_args->arg);
+	free(inner->other_args);
+	symtable_free(inner->vars);
+	free(inner);
+}
+
+/* Recalculate F->vars from the arguments (e.g. after they were moved) */
+static void _update_vars(formula F)
+{
+	int i;
+
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return;
+
+	symtable_clear(F->vars);
+	symtable_import(F->vars, F->arg1->vars);
+	if(F->arg2) symtable_import(F->vars, F->arg2->vars);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			symtable_import(F->vars, F->other_args->arg[i]->vars);
+
+	if(F->action == F_INTEGRAL)
+		symtable_del_id(F->vars, _VAR_ID(F->other_args->arg[1]));
+	else if(F->action == F_CUBATURE)
+		for(i = 2; i < F->other_args->count; i += 3)
+			symtable_del_id(F->vars, _VAR_ID(F->other_args->arg[i]));
+}
+
+/* Check whether X doesn't depend on integration variable(s) of F_INTEGRAL or F_CUBATURE node */
+static int _invariant(formula X, formula integral)
+{
+	int i = integral->action == F_INTEGRAL ? 1 : 2;
+	for(; i < integral->other_args->count; i += 3)
+		if(symtable_isset_id(X->vars, _VAR_ID(integral->other_args->arg[i])))
+			return 0;
+	return 1;
+}
+
+static formula _node2(int action, formula arg1, formula arg2, symtable args)
+{
+	formula N = _alloc2(action, arg1, arg2);
+	if(N) N->args = args;
+	return N;
+}
+
+/* (b - a) for F_INTEGRAL, product of such differences for F_CUBATURE */
+static formula _integration_volume(formula integral)
+{
+	formula V = NULL;
+	int i;
+
+	if(integral->action == F_INTEGRAL)
+		return _node2(F_SUB,
+			_formula_clone(integral->other_args->arg[0], integral->args),
+			_formula_clone(integral->arg2, integral->args), integral->args);
+
+	for(i = 0; i < integral->other_args->count; i += 3)
+	{
+		formula W = _node2(F_SUB,
+			_formula_clone(integral->other_args->arg[i + 1], integral->args),
+			_formula_clone(integral->other_args->arg[i], integral->args), integral->args);
+		if(!W) break;
+		V = V ? _node2(F_MUL, V, W, integral->args) : W;
+	}
+	return V;
+}
+
+/*
+	Linearity of the integral:
+		$[ c * h ]  ->  c * $[ h ]
+		$[ h / c ]  ->  $[ h ] / c
+		$[ -h ]  ->  - $[ h ]
+		$[ c + h ]  ->  c * (b - a) + $[ h ]
+	where 'c' doesn't depend on the integration variable.
+
+	F is modified in place (becomes the operation), the integral is moved
+	into a new node. Returns the integral node (F if nothing was done).
+*/
+static formula _pull_out(formula F)
+{
+	formula I = F->arg1, c, h, other = NULL;
+	int c_first;
+
+	if(I->action != F_MUL && I->action != F_DIV && I->action != F_NOT
+	&& I->action != F_ADD && I->action != F_SUB)
+		return F;
+	if(_invariant(I, F)) return F; /* nothing depends on the variable */
+
+	c_first = I->arg2 && _invariant(I->arg1, F);
+	c = c_first ? I->arg1 : I->arg2;
+	h = c_first ? I->arg2 : I->arg1;
+
+	if(I->action == F_NOT)
+		h = I->arg1;
+	else if(!_invariant(c, F) || (I->action == F_DIV && c_first))
+		return F;
+
+	if(I->action == F_ADD || I->action == F_SUB)
+	{
+		other = _integration_volume(F);
+		if(!other) return F;
+		other = _node2(F_MUL, _formula_clone(c, F->args), other, F->args);
+		if(!other) return F;
+	}
+
+	/* G is the integral of 'h' */
+	formula G = malloc(sizeof(struct _formula));
+	if(!G)
+	{
+		if(other) _formula_free(other);
+		return F;
+	}
+	memcpy(G, F, sizeof(struct _formula));
+	G->arg1 = h;
+	G->vars = symtable_new();
+	_update_vars(G);
+
+	/* F is now the operation */
+	F->action = I->action;
+	F->other_args = NULL;
+	switch(I->action)
+	{
+		case F_NOT:
+			F->arg1 = G;
+			F->arg2 = NULL;
+			break;
+		case F_MUL:
+			F->arg1 = c;
+			F->arg2 = G;
+			break;
+		case F_DIV:
+			F->arg1 = G;
+			F->arg2 = c;
+			break;
+		default: /* F_ADD, F_SUB */
+			F->arg1 = c_first ? other : G;
+			F->arg2 = c_first ? G : other;
+			_formula_free(c);
+	}
+
+	/* Free the old integrand node itself (but not its arguments) */
+	symtable_free(I->vars);
+	free(I);
+
+	/* Maybe something else can be pulled out, e.g. from $[ c1 * c2 * h ] */
+	return _pull_out(G);
+}
+
+/*
+	Replace F with F_HOISTED node, which keeps the value of F
+	(updated once per integral evaluation, see _hoisted_refresh() in formula.c).
+*/
+static void _hoist(formula F)
+{
+	formula N = malloc(sizeof(struct _formula));
+	double *value = malloc(sizeof(double));
+	if(!N || !value)
+	{
+		free(N);
+		free(value);
+		return;
+	}
+
+	memcpy(N, F, sizeof(struct _formula));
+	N->vars = symtable_clone(F->vars);
+
+	*value = NAN;
+	F->action = F_HOISTED;
+	F->arg1 = N;
+	F->arg2 = _alloc1(F_CONST, (formula) value);
+	F->arg2->args = F->args;
+	F->other_args = NULL;
+}
+
+static void _hoist_invariants(formula X, formula integral)
+{
+	int i;
+	switch(X->action)
+	{
+		case F_CONST:
+		case F_VAR:
+		case F_TABLE:
+		case F_HOISTED:
+			return;
+	}
+
+	if(_invariant(X, integral))
+	{
+		_hoist(X);
+		return;
+	}
+
+	switch(X->action)
+	{
+		case F_DERIVATIVE:
+			return; /* changes its variable while being calculated */
+
+		case F_SUM:
+		case F_PROD:
+			return; /* elements of arrays in its body can't be calculated separately */
+
+		case F_INTEGRAL:
+		case F_CUBATURE:
+			break; /* its own integrand is processed separately */
+
+		default:
+			_hoist_invariants(X->arg1, integral);
+	}
+
+	if(X->arg2) _hoist_invariants(X->arg2, integral);
+	if(X->other_args)
+		for(i = 0; i < X->other_args->count; i ++)
+			_hoist_invariants(X->other_args->arg[i], integral);
+}
+
+typedef void (*_pass)(formula F);
+
+/* Bottom-up: arguments are processed before F itself */
+static void _walk(formula F, _pass pass)
+{
+	int i;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return;
+	if(F->action == F_CUMULATIVE) return; /* optimized already */
+
+	_walk(F->arg1, pass);
+	if(F->arg2) _walk(F->arg2, pass);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			_walk(F->other_args->arg[i], pass);
+
+	pass(F);
+}
+
+static void _pass_pull_out(formula F)
+{
+	if(F->action == F_INTEGRAL || F->action == F_CUBATURE)
+		_pull_out(F);
+}
+
+static void _pass_hoist(formula F)
+{
+	if(F->action == F_INTEGRAL || F->action == F_CUBATURE)
+		_hoist_invariants(F->arg1, F);
+}
+
+static int _wrap(formula F, int action, void *table);
+
+/*
+	$[ f(B) ]dB|a_X, where only the upper bound X varies, becomes F_CUMULATIVE:
+	the table of the antiderivative of f is built on demand while X changes,
+	and each next value is looked up instead of integrating from a again.
+*/
+static void _pass_cumulative(formula F)
+{
+	if(F->action != F_INTEGRAL || F->other_args->count != 2) return;
+
+	int variable = _VAR_ID(F->other_args->arg[1]);
+	if(symtable_count(F->arg1->vars) - symtable_isset_id(F->arg1->vars, variable) != 0) return;
+	if(symtable_count(F->arg2->vars) != 0) return;
+
+	_wrap(F, F_CUMULATIVE, _cumulative_new(0, 0));
+}
+
+/* Top-down: the largest subtrees without variables (e.g. integrals with constant bounds) are calculated */
+void _fold_constants(formula F)
+{
+	struct _node_stack S = { 0, 0, NULL };
+	int ok = _node_stack_push(&S, F);
+
+	while(ok && S.size)
+	{
+		formula N = S.node[-- S.size];
+		if(!_fold(N))
+			ok = _node_stack_push_args(&S, N);
+	}
+	free(S.node);
+}
+
+void optimize(formula F)
+{
+	if(!F) return;
+	_formula_own(F, NULL);
+
+	/* Pulling constants out of integrals first: $[ $[ f(A) * g(B) ]dA ]dB becomes separable */
+	_walk(F, _pass_pull_out);
+	_walk(F, _fuse_integrals);
+	_fold_constants(F);
+	_walk(F, _pass_hoist);
+	_walk(F, _pass_cumulative);
+}
+
+/*
+	Chains of additions/subtractions (or multiplications) for formula_balance().
+	The chain is collected without recursion: it can be very long.
+*/
+struct _chain
+{
+	int action; /* F_ADD (for F_ADD and F_SUB) or F_MUL */
+	int count, nodes_count, capacity;
+	formula *terms; /* in the original order */
+	int *signs; /* -1 if the term is subtracted */
+	formula *nodes; /* operations of the chain, they are reused */
+};
+
+static int _chain_family(int action)
+{
+	if(action == F_ADD || action == F_SUB) return F_ADD;
+	if(action == F_MUL) return F_MUL;
+	return 0;
+}
+
+static int _chain_grow(struct _chain *C)
+{
+	int capacity = C->capacity ? 2 * C->capacity : 64;
+	formula *terms = realloc(C->terms, sizeof(formula) * capacity);
+	if(terms) C->terms = terms;
+	int *signs = realloc(C->signs, sizeof(int) * capacity);
+	if(signs) C->signs = signs;
+	formula *nodes = realloc(C->nodes, sizeof(formula) * capacity);
+	if(nodes) C->nodes = nodes;
+
+	if(!terms || !signs || !nodes) return 0;
+	C->capacity = capacity;
+	return 1;
+}
+
+static int _flatten(formula F, struct _chain *C)
+{
+	/* Stack of subtrees which are not processed yet (and their signs) */
+	int size = 0, capacity = 64, ok = 1;
+	formula *stack = malloc(sizeof(formula) * capacity);
+	int *stack_signs = malloc(sizeof(int) * capacity);
+
+	if(stack && stack_signs)
+	{
+		stack[size] = F;
+		stack_signs[size ++] = 1;
+	}
+	else ok = 0;
+
+	while(ok && size)
+	{
+		formula N = stack[-- size];
+		int sign = stack_signs[size];
+
+		if(_chain_family(N->action) != C->action)
+		{
+			if(C->count == C->capacity && !_chain_grow(C)) ok = 0;
+			else
+			{
+				C->terms[C->count] = N;
+				C->signs[C->count ++] = sign;
+			}
+			continue;
+		}
+
+		if(C->nodes_count == C->capacity && !_chain_grow(C))
+		{
+			ok = 0;
+			break;
+		}
+		C->nodes[C->nodes_count ++] = N;
+
+		if(size + 2 > capacity)
+		{
+			capacity *= 2;
+			formula *s = realloc(stack, sizeof(formula) * capacity);
+			if(s) stack = s;
+			int *ss = realloc(stack_signs, sizeof(int) * capacity);
+			if(ss) stack_signs = ss;
+			if(!s || !ss) ok = 0;
+		}
+		if(ok)
+		{ /* arg1 is processed first, so the order of terms remains the same */
+			stack[size] = N->arg2;
+			stack_signs[size ++] = N->action == F_SUB ? -sign : sign;
+			stack[size] = N->arg1;
+			stack_signs[size ++] = sign;
+		}
+	}
+
+	free(stack);
+	free(stack_signs);
+	return ok;
+}
+
+/* Balanced tree of 'count' terms, nodes are taken from the end of C->nodes */
+static formula _balanced(struct _chain *C, formula *terms, int count)
+{
+	if(count == 1) return terms[0];
+
+	formula N = C->nodes[-- C->nodes_count];
+	N->action = C->action;
+	N->arg1 = _balanced(C, terms, count / 2);
+	N->arg2 = _balanced(C, terms + count / 2, count - count / 2);
+	_update_vars(N);
+	return N;
+}
+
+#define BALANCE_MIN_TERMS 4 /* shorter chains are balanced already */
+
+static void _balance(formula F)
+{
+	int i;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return;
+
+	if(!_chain_family(F->action))
+	{
+		_balance(F->arg1);
+		if(F->arg2) _balance(F->arg2);
+		if(F->other_args)
+			for(i = 0; i < F->other_args->count; i ++)
+				_balance(F->other_args->arg[i]);
+		return;
+	}
+
+	struct _chain C;
+	memset(&C, 0, sizeof(C));
+	C.action = _chain_family(F->action);
+
+	if(_flatten(F, &C) && C.count >= BALANCE_MIN_TERMS)
+	{
+		/* Added terms first, then subtracted ones (F_ADD chains only) */
+		int plus = 0, minus = 0;
+		formula *sorted = malloc(sizeof(formula) * C.count);
+		if(sorted)
+		{
+			for(i = 0; i < C.count; i ++)
+				if(C.signs[i] > 0) sorted[plus ++] = C.terms[i];
+			for(i = 0; i < C.count; i ++)
+				if(C.signs[i] < 0) sorted[plus + minus ++] = C.terms[i];
+
+			/* F (the first node of the chain) remains the top node: the pointer to it must stay valid */
+			C.nodes[0] = C.nodes[-- C.nodes_count];
+			if(minus)
+			{
+				F->action = F_SUB;
+				F->arg1 = _balanced(&C, sorted, plus);
+				F->arg2 = _balanced(&C, sorted + plus, minus);
+			}
+			else
+			{
+				F->action = C.action;
+				F->arg1 = _balanced(&C, sorted, plus / 2);
+				F->arg2 = _balanced(&C, sorted + plus / 2, plus - plus / 2);
+			}
+			_update_vars(F);
+			free(sorted);
+		}
+	}
+
+	for(i = 0; i < C.count; i ++)
+		_balance(C.terms[i]);
+
+	free(C.terms);
+	free(C.signs);
+	free(C.nodes);
+}
+
+void formula_balance(formula F)
+{
+	if(!F) return;
+	_formula_own(F, NULL);
+	_balance(F);
+}
+
+formula formula_specialize(const formula F, int count, const char *const *names, const double *values)
+{
+	int i;
+	formula R = formula_clone_deep(F);
+	if(!R) return NULL;
+
+	for(i = 0; i < count; i ++)
+		if(symtable_isset(R->args, names[i]))
+			reduce(R, names[i], values[i]);
+
+	_fold_constants(R);
+	return R;
+}
+
+static struct _memo *_memo_new(int nvars, int size)
+{
+	int capacity = 1;
+	while(capacity < size) capacity <<= 1;
+
+	size_t bytes = sizeof(struct _memo) + sizeof(struct _memo_entry) * capacity;
+	struct _memo *M = calloc(1, bytes);
+	if(!M) return NULL;
+
+	M->header.size = bytes;
+	M->nvars = nvars;
+	M->capacity = capacity;
+	return M;
+}
+
+/*
+	F becomes the node of type 'action' with the old contents of F in arg1
+	and F_TABLE with 'table' in arg2. The pointer to F remains valid.
+*/
+static int _wrap(formula F, int action, void *table)
+{
+	formula N = malloc(sizeof(struct _formula));
+	formula T = table ? _table_alloc(table, F->args) : NULL;
+	if(!N || !T)
+	{
+		free(N);
+		if(T) _formula_free(T); else free(table);
+		return 0;
+	}
+
+	memcpy(N, F, sizeof(struct _formula));
+	F->vars = symtable_clone(N->vars);
+	F->action = action;
+	F->arg1 = N;
+	F->arg2 = T;
+	F->other_args = NULL;
+	return 1;
+}
+
+static void _memoize(formula F, int size)
+{
+	int i;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return;
+
+	if(F->action == F_MEMO)
+	{
+		formula T = F->arg2;
+		struct _memo *M = size ? _memo_new(((struct _memo *) T->arg1)->nvars, size) : NULL;
+
+		if(size)
+		{ /* Resize the cache */
+			if(M)
+			{
+				free(T->arg1);
+				T->arg1 = (formula) M;
+			}
+			return;
+		}
+
+		/* Remove the cache: F becomes what it was before formula_memoize() */
+		formula N = F->arg1;
+		_formula_free(T);
+		symtable_free(F->vars);
+		memcpy(F, N, sizeof(struct _formula));
+		free(N);
+	}
+	else if(F->action == F_CUMULATIVE)
+		return;
+	else
+	{
+		int nvars = symtable_count(F->vars);
+		if(size && nvars > 0 && nvars <= MEMO_MAX_VARS
+			&& (F->action == F_INTEGRAL || F->action == F_CUBATURE || F->action == F_DERIVATIVE))
+		{
+			_wrap(F, F_MEMO, _memo_new(nvars, size));
+			return; /* arguments of the integral are not cached: they change while it is calculated */
+		}
+	}
+
+	_memoize(F->arg1, size);
+	if(F->arg2) _memoize(F->arg2, size);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			_memoize(F->other_args->arg[i], size);
+}
+
+void formula_memoize(formula F, int size)
+{
+	if(F && size >= 0)
+	{
+		_formula_own(F, NULL);
+		_memoize(F, size);
+	}
+}
@@ -0,0 +1,292 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "parse_cache.h"
+#include "formula_internal.h"
+
+#define PARSE_CACHE_SHARDS 16 /* each shard has its own lock */
+#define PARSE_CACHE_KEY_BUF 256 /* longer keys are normalized into malloc()ed memory */
+
+struct _cache_entry
+{
+	uint64_t hash;
+	char *key; /* normalized text (NULL if the entry is free) */
+	formula F;
+	int shareable; /* 0 if F must be copied with formula_clone_deep() */
+	int referenced; /* CLOCK: used since the last visit of the hand */
+	int next; /* next entry in the same bucket, -1 if none */
+};
+
+struct _cache_shard
+{
+	pthread_rwlock_t lock; /* lookups take it for reading, only insertion for writing */
+	struct _cache_entry *entries;
+	int size, count;
+	int *buckets; /* first entry in each bucket (-1 if none) */
+	int buckets_mask;
+	int hand; /* CLOCK */
+};
+
+struct _parse_cache
+{
+	int shards_count;
+	struct _cache_shard *shards;
+	long hits, misses, evictions; /* updated atomically */
+};
+
+/*
+	Whitespace next to operators doesn't change the meaning of the formula,
+	other whitespace (e.g. between "1 2" or "s in") is replaced with one space.
+	Returns length of the normalized text in 'out' (its size must be at least strlen(code) + 1).
+*/
+static int _separator(char c)
+{
+	return c && strchr("+-*/^()|]_,=", c);
+}
+
+static int _space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int _normalize(const char *code, char *out)
+{
+	int length = 0;
+	while(*code)
+	{
+		if(!_space(*code))
+		{
+			out[length ++] = *code ++;
+			continue;
+		}
+
+		while(_space(*code)) code ++;
+		if(length && *code && !_separator(out[length - 1]) && !_separator(*code))
+			out[length ++] = ' ';
+	}
+	out[length] = '\0';
+	return length;
+}
+
+static uint64_t _hash(const char *key, int length)
+{ /* FNV-1a */
+	uint64_t h = 14695981039346656037ull;
+	int i;
+	for(i = 0; i < length; i ++)
+		h = (h ^ (unsigned char) key[i]) * 1099511628211ull;
+	return h;
+}
+
+/* eval() of integrals changes F->args for a while, so such formulas can't be shared between threads */
+static int _shareable(formula F)
+{
+	int i;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return 1;
+	if(F->action == F_INTEGRAL || F->action == F_CUBATURE || F->action == F_MEMO
+		|| F->action == F_CUMULATIVE || F->action == F_HOISTED)
+		return 0;
+
+	if(!_shareable(F->arg1)) return 0;
+	if(F->arg2 && !_shareable(F->arg2)) return 0;
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			if(!_shareable(F->other_args->arg[i])) return 0;
+	return 1;
+}
+
+parse_cache parse_cache_new(int capacity)
+{
+	int i, j;
+	if(capacity < 1) capacity = 1;
+
+	parse_cache C = calloc(1, sizeof(struct _parse_cache));
+	if(!C) return NULL;
+
+	C->shards_count = capacity < PARSE_CACHE_SHARDS ? capacity : PARSE_CACHE_SHARDS;
+	C->shards = calloc(C->shards_count, sizeof(struct _cache_shard));
+	if(!C->shards)
+	{
+		free(C);
+		return NULL;
+	}
+
+	for(i = 0; i < C->shards_count; i ++)
+	{
+		struct _cache_shard *S = &C->shards[i];
+		S->size = (capacity + C->shards_count - 1) / C->shards_count;
+		for(S->buckets_mask = 1; S->buckets_mask < S->size; S->buckets_mask *= 2);
+		S->entries = calloc(S->size, sizeof(struct _cache_entry));
+		S->buckets = malloc(sizeof(int) * S->buckets_mask);
+		if(!S->entries || !S->buckets || pthread_rwlock_init(&S->lock, NULL))
+		{
+			free(S->entries);
+			free(S->buckets);
+			S->entries = NULL;
+			S->buckets = NULL;
+			C->shards_count = i;
+			parse_cache_free(C);
+			return NULL;
+		}
+
+		for(j = 0; j < S->buckets_mask; j ++)
+			S->buckets[j] = -1;
+		S->buckets_mask --;
+	}
+	return C;
+}
+
+static struct _cache_entry *_find(struct _cache_shard *S, uint64_t hash, const char *key)
+{
+	int i;
+	for(i = S->buckets[hash & S->buckets_mask]; i != -1; i = S->entries[i].next)
+		if(S->entries[i].hash == hash && !strcmp(S->entries[i].key, key))
+			return &S->entries[i];
+	return NULL;
+}
+
+static formula _copy(struct _cache_entry *E)
+{
+	__atomic_store_n(&E->referenced, 1, __ATOMIC_RELAXED);
+	return E->shareable ? formula_clone(E->F) : formula_clone_deep(E->F);
+}
+
+/* Free a place for the new entry (the shard is locked for writing) */
+static int _evict(parse_cache C, struct _cache_shard *S)
+{
+	if(S->count < S->size)
+		return S->count ++;
+
+	while(S->entries[S->hand].referenced)
+	{
+		S->entries[S->hand].referenced = 0;
+		S->hand = (S->hand + 1) % S->size;
+	}
+
+	int victim = S->hand, *p;
+	struct _cache_entry *E = &S->entries[victim];
+	S->hand = (S->hand + 1) % S->size;
+
+	for(p = &S->buckets[E->hash & S->buckets_mask]; *p != victim; p = &S->entries[*p].next);
+	*p = E->next;
+
+	formula_free(E->F);
+	free(E->key);
+	E->key = NULL;
+	__sync_fetch_and_add(&C->evictions, 1);
+	return victim;
+}
+
+formula parse_cache_get(parse_cache C, const char *code)
+{
+	char buf[PARSE_CACHE_KEY_BUF];
+	size_t code_length = strlen(code);
+	char *key = code_length < sizeof(buf) ? buf : malloc(code_length + 1);
+	if(!key) return NULL;
+
+	int length = _normalize(code, key);
+	uint64_t hash = _hash(key, length);
+	struct _cache_shard *S = &C->shards[(hash >> 32) % C->shards_count];
+	struct _cache_entry *E;
+	formula F = NULL;
+
+	/* Hit */
+	pthread_rwlock_rdlock(&S->lock);
+	E = _find(S, hash, key);
+	if(E) F = _copy(E);
+	pthread_rwlock_unlock(&S->lock);
+
+	if(E)
+	{
+		__sync_fetch_and_add(&C->hits, 1);
+		if(key != buf) free(key);
+		return F;
+	}
+
+	/* Miss: parse without locks, then insert (unless another thread was faster) */
+	__sync_fetch_and_add(&C->misses, 1);
+	formula parsed = parse_n(NULL, key, length, NULL);
+	char *saved_key = parsed ? malloc(length + 1) : NULL;
+	if(!saved_key)
+	{
+		if(parsed) formula_free(parsed);
+		if(key != buf) free(key);
+		return NULL;
+	}
+	memcpy(saved_key, key, length + 1);
+	if(key != buf) free(key);
+
+	pthread_rwlock_wrlock(&S->lock);
+	E = _find(S, hash, saved_key);
+	if(!E)
+	{
+		int i = _evict(C, S);
+		E = &S->entries[i];
+		E->hash = hash;
+		E->key = saved_key;
+		E->F = parsed;
+		E->shareable = _shareable(parsed);
+		E->referenced = 0;
+		E->next = S->buckets[hash & S->buckets_mask];
+		S->buckets[hash & S->buckets_mask] = i;
+		saved_key = NULL;
+		parsed = NULL;
+	}
+	F = _copy(E);
+	pthread_rwlock_unlock(&S->lock);
+
+	if(parsed) formula_free(parsed);
+	free(saved_key);
+	return F;
+}
+
+void parse_cache_statistics(const parse_cache C, struct parse_cache_stats *stats)
+{
+	int i;
+	stats->hits = __sync_add_and_fetch(&C->hits, 0);
+	stats->misses = __sync_add_and_fetch(&C->misses, 0);
+	stats->evictions = __sync_add_and_fetch(&C->evictions, 0);
+	stats->count = 0;
+
+	for(i = 0; i < C->shards_count; i ++)
+	{
+		pthread_rwlock_rdlock(&C->shards[i].lock);
+		stats->count += C->shards[i].count;
+		pthread_rwlock_unlock(&C->shards[i].lock);
+	}
+}
+
+void parse_cache_free(parse_cache C)
+{
+	int i, j;
+	for(i = 0; i < C->shards_count; i ++)
+	{
+		struct _cache_shard *S = &C->shards[i];
+		for(j = 0; j < S->count; j ++)
+		{
+			formula_free(S->entries[j].F);
+			free(S->entries[j].key);
+		}
+		free(S->entries);
+		free(S->buckets);
+		pthread_rwlock_destroy(&S->lock);
+	}
+	free(C->shards);
+	free(C);
+}
@@ -0,0 +1,72 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _PARSE_CACHE_H
+#define _PARSE_CACHE_H
+
+#include "formula.h"
+
+/*
+	Cache of parsed formulas, keyed by their text.
+	Can be used by many threads at the same time.
+*/
+
+typedef struct _parse_cache *parse_cache;
+
+struct parse_cache_stats
+{
+	long hits;
+	long misses; /* including invalid formulas (they are not cached) */
+	long evictions;
+	int count; /* number of formulas in the cache */
+};
+
+/**
+	@brief Create the cache.
+	@param capacity Maximum number of formulas in the cache.
+	@returns Cache object, NULL if there's not enough memory.
+	@note When the cache is full, rarely used formulas are evicted (CLOCK algorithm).
+*/
+parse_cache parse_cache_new(int capacity) __attribute__((malloc warn_unused_result));
+
+/**
+	@brief Same as parse(), but the formula is parsed only once.
+	@param C Cache object.
+	@param code Textual representation of the formula. Spaces which don't change
+		the meaning are ignored, e.g. "A + B" and "A+B" is the same formula.
+	@returns Formula object (must be formula_free()d), NULL if \b code is not a valid formula.
+
+	@note The result shares its nodes with the cached formula (see formula_clone()),
+		so it takes O(1) time. Formulas with integrals are copied with formula_clone_deep(),
+		because eval() of integrals temporarily changes the formula.
+	@note Lookups by different threads don't block each other.
+*/
+formula parse_cache_get(parse_cache C, const char *code) __attribute__((nonnull warn_unused_result));
+
+/**
+	@brief Get the number of hits, misses, etc.
+	@param C Cache object.
+	@param stats Receives the statistics.
+*/
+void parse_cache_statistics(const parse_cache C, struct parse_cache_stats *stats) __attribute__((nonnull));
+
+/**
+	@brief Free the cache and all cached formulas.
+	@param C Cache object.
+	@note Formulas returned by parse_cache_get() remain valid.
+*/
+void parse_cache_free(parse_cache C) __attribute__((nonnull));
+
+#endif
@@ -0,0 +1,637 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "formula_internal.h"
+
+/*
+	Recursive descent parser with operator precedence (Pratt parser).
+
+	Grammar (from the lowest precedence to the highest):
+		A + B, A - B
+		A * B, A / B
+		sin A, cos A, tg A, ctg A, arcsin A, arccos A, arctg A, exp A, ln A, lg A, log2 A
+		-A
+		A ^ B (left-associative: 2^3^2 is 64)
+		$[ f ]dX|a_b (integral), dF/dX (derivative)
+	and (A), |A|, numbers (123, 1.5, INF) and variables: a latin letter
+	with optional digits (X, X1, Y25) or any name in braces ({alpha}, {x_max}).
+
+	sum(i = 1..n, f) and prod(i = 1..n, f) are the sum and the product of f
+	for i from 1 to n (both are integer numbers). Inside of f, X[i] is
+	the element of array X, which has n elements X[1], ..., X[n].
+	Lowercase 'd' is always the derivative/integral mark, not a variable.
+	Names other than single letters are accepted only if the symtable supports them.
+*/
+
+#define PREC_ADD 1
+#define PREC_MUL 2
+#define PREC_FUNC 3
+#define PREC_MINUS 4
+#define PREC_POW 5
+#define PREC_INTEGRAL 6
+
+#define PARSE_MAX_DEPTH 20000 /* nested parentheses, functions, etc. (limited by the C stack) */
+#define PARSE_MAX_NAME 64 /* length of variable name */
+
+enum
+{
+	T_END,
+	T_NUMBER,
+	T_VARIABLE, /* 'name' */
+	T_FUNCTION, /* 'action' is F_SIN, etc. */
+	T_DIFF, /* 'd' */
+	T_IOPEN, /* '$[' */
+	T_CHAR /* any other character: 'c' */
+};
+
+struct _parser
+{
+	const char *code, *end;
+	const char *p; /* after the current token */
+	mpool pool;
+	int depth;
+	int stop_at_diff; /* numerator of dF/dX: "/d" ends the expression */
+	const char *error; /* the first token which couldn't be parsed (NULL if none) */
+
+	/* Current token */
+	const char *start;
+	int token;
+	int action; /* T_FUNCTION */
+	char c; /* T_CHAR */
+	const char *name; /* T_VARIABLE (not null-terminated) */
+	int name_length;
+
+	/* Index of the innermost sum (NULL if none), arrays have 'index_to' elements */
+	const char *index;
+	int index_length, index_to;
+	double value; /* T_NUMBER */
+};
+
+static const struct
+{
+	const char *name;
+	int length;
+	int action;
+} _functions[] = {
+	/* No name is a prefix of another one, so the first match is the longest one */
+	{ "arcsin", 6, F_ASIN },
+	{ "prod", 4, F_PROD },
+	{ "arccos", 6, F_ACOS },
+	{ "arctg", 5, F_ATAN },
+	{ "log2", 4, F_LOG2 },
+	{ "sin", 3, F_SIN },
+	{ "sum", 3, F_SUM },
+	{ "cos", 3, F_COS },
+	{ "ctg", 3, F_CTG },
+	{ "exp", 3, F_EXP },
+	{ "tg", 2, F_TAN },
+	{ "ln", 2, F_LN },
+	{ "lg", 2, F_LG },
+	{ NULL, 0, 0 }
+};
+
+static const double _powers_of_10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int _digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline int _letter(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static inline int _space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Does the text [p; end) start with 'prefix'? */
+static inline int _starts(const char *p, const char *end, const char *prefix, int length)
+{
+	return end - p >= length && !memcmp(p, prefix, length);
+}
+
+/*
+	[0-9]+("."[0-9]*)?
+	Up to 15 significant digits and 22 digits after the point, the value
+	is (integer) / 10^n, which is correctly rounded. Otherwise strtod() is used.
+*/
+static double _number(const char **pp, const char *end)
+{
+	const char *p = *pp, *start = p;
+	uint64_t mantissa = 0;
+	int digits = 0, scale = 0;
+
+	for(; p < end && _digit(*p); p ++)
+	{
+		mantissa = mantissa * 10 + (*p - '0');
+		if(mantissa) digits ++;
+		if(digits > 18) break;
+	}
+	if(p < end && *p == '.' && !(p + 1 < end && p[1] == '.') && digits <= 18) /* "1..n" is not "1." */
+		for(p ++; p < end && _digit(*p); p ++)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			scale ++;
+			if(mantissa) digits ++;
+			if(digits > 18) break;
+		}
+
+	if(digits <= 15 && scale <= 22 && (p == end || !_digit(*p)))
+	{
+		*pp = p;
+		return (double) mantissa / _powers_of_10[scale];
+	}
+
+	/* Long number: find its end, then let strtod() do the rounding */
+	for(p = start; p < end && _digit(*p); p ++);
+	if(p < end && *p == '.' && !(p + 1 < end && p[1] == '.'))
+		for(p ++; p < end && _digit(*p); p ++);
+
+	size_t length = p - start;
+	char buf[64], *copy = length < sizeof(buf) ? buf : malloc(length + 1);
+	double value = NAN;
+	if(copy)
+	{
+		memcpy(copy, start, length);
+		copy[length] = '\0';
+		value = strtod(copy, NULL);
+		if(copy != buf) free(copy);
+	}
+
+	*pp = p;
+	return value;
+}
+
+static void _next(struct _parser *P)
+{
+	const char *p = P->p, *end = P->end;
+	int i;
+
+	while(p < end && _space(*p))
+		p ++;
+	P->start = p;
+
+	if(p == end)
+	{
+		P->token = T_END;
+	}
+	else if(_digit(*p))
+	{
+		P->token = T_NUMBER;
+		P->value = _number(&p, end);
+	}
+	else if(_starts(p, end, "$[", 2))
+	{
+		P->token = T_IOPEN;
+		p += 2;
+	}
+	else if(_starts(p, end, "INF", 3))
+	{
+		P->token = T_NUMBER;
+		P->value = INFINITY;
+		p += 3;
+	}
+	else if(*p == 'd')
+	{
+		P->token = T_DIFF;
+		p ++;
+	}
+	else if(_letter(*p))
+	{
+		for(i = 0; _functions[i].name; i ++)
+			if(_starts(p, end, _functions[i].name, _functions[i].length))
+				break;
+
+		if(_functions[i].name)
+		{
+			P->token = T_FUNCTION;
+			P->action = _functions[i].action;
+			p += _functions[i].length;
+		}
+		else
+		{
+			P->token = T_VARIABLE;
+			P->name = p ++;
+			while(p < end && _digit(*p))
+				p ++;
+			P->name_length = p - P->name;
+		}
+	}
+	else if(*p == '{' && (P->name = memchr(p, '}', end - p)))
+	{
+		P->token = T_VARIABLE;
+		P->name_length = P->name - p - 1;
+		P->name = p + 1;
+		p += P->name_length + 2;
+	}
+	else
+	{
+		P->token = T_CHAR;
+		P->c = *p ++;
+	}
+
+	P->p = p;
+}
+
+static formula _fail(struct _parser *P, const char *where)
+{
+	if(!P->error) P->error = where;
+	return NULL;
+}
+
+static void _release(struct _parser *P, formula F)
+{
+	if(F && !P->pool) _formula_free(F);
+}
+
+/* Skip the expected character */
+static int _expect(struct _parser *P, char c)
+{
+	if(P->token != T_CHAR || P->c != c)
+	{
+		_fail(P, P->start);
+		return 0;
+	}
+	_next(P);
+	return 1;
+}
+
+static formula _expr(struct _parser *P, int min_prec);
+
+/* Operations on constants with NAN result (e.g. "1/0") make the formula invalid */
+static formula _operation(struct _parser *P, int action, formula arg1, formula arg2, const char *where)
+{
+	if(!arg1) goto fail;
+
+	if(arg1->action == F_CONST && (!arg2 || arg2->action == F_CONST)
+		&& isnan(_calc(action, _get_const(arg1), arg2 ? _get_const(arg2) : 0)))
+	{
+		_fail(P, where);
+		goto fail;
+	}
+
+	formula F = formula_op(P->pool, action, arg1, arg2);
+	if(!F) _fail(P, where); /* not enough memory */
+	return F;
+
+fail:
+	_release(P, arg1);
+	_release(P, arg2);
+	return NULL;
+}
+
+/* Expression inside (), [], etc., where "/d" can be division by a derivative */
+static formula _nested(struct _parser *P)
+{
+	int stop_at_diff = P->stop_at_diff;
+	P->stop_at_diff = 0;
+	formula F = _expr(P, 0);
+	P->stop_at_diff = stop_at_diff;
+	return F;
+}
+
+/* Variable name after 'd', e.g. X in dX */
+static formula _variable(struct _parser *P, int min_prec, int *id)
+{
+	const char *where = P->start;
+	formula V = _expr(P, min_prec);
+	if(!V) return NULL;
+
+	if(V->action != F_VAR)
+	{
+		_release(P, V);
+		return _fail(P, where);
+	}
+	*id = _VAR_ID(V);
+	return V;
+}
+
+static formula _integral(struct _parser *P)
+{
+	formula expr = NULL, V = NULL, a = NULL, b = NULL;
+	int id;
+
+	expr = _nested(P);
+	if(!expr || !_expect(P, ']')) goto fail;
+
+	if(P->token != T_DIFF)
+	{
+		_fail(P, P->start);
+		goto fail;
+	}
+	_next(P);
+
+	V = _variable(P, 0, &id);
+	if(!V || !_expect(P, '|')) goto fail;
+
+	a = _nested(P);
+	if(!a || !_expect(P, '_')) goto fail;
+
+	b = _expr(P, PREC_INTEGRAL);
+	if(!b) goto fail;
+
+	_release(P, V);
+	formula F = formula_integral(P->pool, expr, symtable_name(id), a, b);
+	return F ? F : _fail(P, P->start);
+
+fail:
+	_release(P, expr);
+	_release(P, V);
+	_release(P, a);
+	_release(P, b);
+	return NULL;
+}
+
+static formula _derivative(struct _parser *P)
+{
+	formula expr = NULL, V = NULL;
+	int id;
+
+	int stop_at_diff = P->stop_at_diff;
+	P->stop_at_diff = 1;
+	expr = _expr(P, 0);
+	P->stop_at_diff = stop_at_diff;
+
+	if(!expr || !_expect(P, '/')) goto fail;
+	if(P->token != T_DIFF)
+	{
+		_fail(P, P->start);
+		goto fail;
+	}
+	_next(P);
+
+	V = _variable(P, PREC_INTEGRAL, &id);
+	if(!V) goto fail;
+
+	_release(P, V);
+	formula F = formula_derivative(P->pool, expr, symtable_name(id));
+	return F ? F : _fail(P, P->start);
+
+fail:
+	_release(P, expr);
+	_release(P, V);
+	return NULL;
+}
+
+/*
+	Variable (size is 0) or element of the array with 'size' elements.
+	Not inlined, so that the buffer doesn't take the stack in every level of recursion.
+*/
+static __attribute__((noinline)) formula _var(struct _parser *P, const char *text, int length, int size)
+{
+	char name[PARSE_MAX_NAME + 1];
+	if(length > PARSE_MAX_NAME) return NULL;
+
+	memcpy(name, text, length);
+	name[length] = '\0';
+	if(size)
+		return formula_element(P->pool, name, size); /* NULL if arrays are not supported */
+	return formula_var(P->pool, name); /* NULL for lowercase letters if CASE_SENSITIVE, etc. */
+}
+
+/* X[i]: 'name' is X, the current token is '[' */
+static formula _element(struct _parser *P, const char *name, int length)
+{
+	_next(P);
+	if(!P->index || P->token != T_VARIABLE || P->name_length != P->index_length
+		|| memcmp(P->name, P->index, P->index_length))
+			return _fail(P, P->start); /* only the index of the sum can be used */
+
+	_next(P);
+	if(!_expect(P, ']')) return NULL;
+
+	formula F = _var(P, name, length, P->index_to);
+	return F ? F : _fail(P, name);
+}
+
+/* Integer number from..to in sum() */
+static int _bound(struct _parser *P, int *value)
+{
+	if(P->token != T_NUMBER || !(P->value >= 1 && P->value <= 1e9) || P->value != floor(P->value))
+	{
+		_fail(P, P->start);
+		return 0;
+	}
+	*value = (int) P->value;
+	_next(P);
+	return 1;
+}
+
+/* sum(i = from..to, body) */
+static formula _sum(struct _parser *P, int action)
+{
+	const char *index = P->index, *where;
+	int index_length = P->index_length, index_to = P->index_to, from, to;
+
+	if(!_expect(P, '(')) return NULL;
+	if(P->token != T_VARIABLE) return _fail(P, P->start);
+	const char *name = P->name;
+	int length = P->name_length;
+	_next(P);
+
+	if(!_expect(P, '=') || !_bound(P, &from) || !_expect(P, '.') || !_expect(P, '.')
+		|| !_bound(P, &to) || !_expect(P, ','))
+			return NULL;
+
+	P->index = name;
+	P->index_length = length;
+	P->index_to = to;
+
+	where = P->start;
+	formula body = _nested(P);
+
+	P->index = index;
+	P->index_length = index_length;
+	P->index_to = index_to;
+
+	if(!body || !_expect(P, ')'))
+	{
+		_release(P, body);
+		return NULL;
+	}
+
+	formula F = formula_sum(P->pool, action, body, from, to);
+	return F ? F : _fail(P, where); /* e.g. X[i] inside of the integral */
+}
+
+static formula _prefix(struct _parser *P)
+{
+	const char *where = P->start;
+	formula F;
+	int action;
+
+	switch(P->token)
+	{
+		case T_NUMBER:
+			F = formula_const(P->pool, P->value);
+			_next(P);
+			return F ? F : _fail(P, where);
+
+		case T_VARIABLE:
+		{
+			const char *name = P->name;
+			int length = P->name_length;
+			_next(P);
+
+			if(P->token == T_CHAR && P->c == '[')
+				return _element(P, name, length);
+
+			F = _var(P, name, length, 0);
+			return F ? F : _fail(P, where);
+		}
+
+		case T_FUNCTION:
+			action = P->action;
+			_next(P);
+			if(action == F_SUM || action == F_PROD)
+				return _sum(P, action);
+			return _operation(P, action, _expr(P, PREC_FUNC), NULL, where);
+
+		case T_DIFF:
+			_next(P);
+			return _derivative(P);
+
+		case T_IOPEN:
+			_next(P);
+			return _integral(P);
+
+		case T_CHAR:
+			if(P->c == '-')
+			{
+				_next(P);
+				return _operation(P, F_NOT, _expr(P, PREC_MINUS), NULL, where);
+			}
+			if(P->c == '(' || P->c == '|')
+			{
+				char closing = P->c == '(' ? ')' : '|';
+				_next(P);
+
+				F = _nested(P);
+				if(F && !_expect(P, closing))
+				{
+					_release(P, F);
+					return NULL;
+				}
+				return closing == '|' ? _operation(P, F_ABS, F, NULL, where) : F;
+			}
+	}
+	return _fail(P, where);
+}
+
+static int _infix(struct _parser *P, int *action)
+{
+	if(P->token != T_CHAR) return 0;
+	switch(P->c)
+	{
+		case '+': *action = F_ADD; return PREC_ADD;
+		case '-': *action = F_SUB; return PREC_ADD;
+		case '*': *action = F_MUL; return PREC_MUL;
+		case '/': *action = F_DIV; return PREC_MUL;
+		case '^': *action = F_POW; return PREC_POW;
+	}
+	return 0;
+}
+
+/* Expression with operations of precedence higher than 'min_prec' */
+static formula _expr(struct _parser *P, int min_prec)
+{
+	const char *p;
+	int action, prec;
+
+	if(++ P->depth > PARSE_MAX_DEPTH)
+	{
+		P->depth --;
+		return _fail(P, P->start);
+	}
+
+	formula F = _prefix(P);
+	while(F && (prec = _infix(P, &action)) > min_prec)
+	{
+		if(action == F_DIV && P->stop_at_diff)
+		{ /* dF/dX: this is not a division */
+			for(p = P->p; p < P->end && _space(*p); p ++);
+			if(p < P->end && *p == 'd') break;
+		}
+
+		const char *where = P->start;
+		_next(P);
+
+		formula arg2 = _expr(P, prec);
+		if(!arg2)
+		{
+			_release(P, F);
+			F = NULL;
+			break;
+		}
+		F = _operation(P, action, F, arg2, where);
+	}
+
+	P->depth --;
+	return F;
+}
+
+formula parse_n(mpool pool, const char *code, size_t length, int *error_pos)
+{
+	struct _parser P;
+	memset(&P, 0, sizeof(P));
+	P.code = P.p = code;
+	P.end = code + length;
+	P.pool = pool;
+
+	if(error_pos) *error_pos = -1;
+
+	_next(&P);
+	formula F = _expr(&P, 0);
+	if(F && P.token != T_END)
+	{
+		_release(&P, F);
+		F = _fail(&P, P.start);
+	}
+	if(F)
+	{
+		F = formula_finish(pool, F);
+		if(!F) _fail(&P, P.start); /* not enough memory */
+	}
+
+	if(!F && error_pos && P.error)
+		*error_pos = P.error - code;
+	return F;
+}
+
+formula parse_checked(mpool pool, const char *code, int *error_pos)
+{
+	if(!code)
+	{
+		if(error_pos) *error_pos = -1;
+		return NULL;
+	}
+	return parse_n(pool, code, strlen(code), error_pos);
+}
+
+formula parse(const char *code)
+{
+	return parse_checked(NULL, code, NULL);
+}
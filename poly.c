@@ -0,0 +1,285 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "formula_internal.h"
+
+/*
+	F_POLY: polynomials in one variable, calculated by Horner's scheme
+	(or by Estrin's scheme, which has shorter dependency chains, for high degrees).
+
+	Only polynomials written term by term are recognized, e.g.
+		3*X^3 - X^2/2 + 1,  1 + 0.5*(X-2) + 0.25*(X-2)^2.
+	Products like (X+1)^10 are not expanded: the coefficients would be
+	much larger than the value, and it would lose precision near X = -1.
+*/
+
+#define POLY_MAX_DEPTH 256 /* deeper subtrees are not analyzed (the analysis is recursive) */
+#define POLY_ESTRIN_DEGREE 8 /* Estrin's scheme from this degree */
+#define POLY_POW_COST 20 /* pow() is as expensive as ~20 multiplications */
+
+#ifdef FP_FAST_FMA
+#define _MADD(a, b, c) fma(a, b, c)
+#else /* fma() would be emulated in software */
+#define _MADD(a, b, c) ((a) * (b) + (c))
+#endif
+
+double _poly_value(const struct _poly *P, double x)
+{
+	const double *c = P->c;
+	int k, n = P->degree + 1;
+
+	if(P->degree < POLY_ESTRIN_DEGREE)
+	{
+		double r = c[P->degree];
+		for(k = P->degree - 1; k >= 0; k --)
+			r = _MADD(r, x, c[k]);
+		return r;
+	}
+
+	/* Estrin: pairs (c[0] + c[1]*x), (c[2] + c[3]*x), ... are combined with x^2, then with x^4, etc. */
+	double t[POLY_MAX_DEGREE / 2 + 1];
+	for(k = 0; 2 * k < n; k ++)
+		t[k] = 2 * k + 1 < n ? _MADD(c[2 * k + 1], x, c[2 * k]) : c[2 * k];
+
+	for(n = (n + 1) / 2; n > 1; n = (n + 1) / 2)
+	{
+		x *= x;
+		for(k = 0; 2 * k < n; k ++)
+			t[k] = 2 * k + 1 < n ? _MADD(t[2 * k + 1], x, t[2 * k]) : t[2 * k];
+	}
+	return t[0];
+}
+
+/*
+	NOTE: F is the F_POLY node created by formula_horner():
+		F->arg1 is the exact formula,
+		F->arg2 is F_TABLE with struct _poly,
+		F->other_args[0] is the variable of the polynomial (e.g. X or X-2).
+*/
+double _poly_eval(formula F, const double *args)
+{
+	double x = _formula_eval(F->other_args->arg[0], args);
+	if(isnan(x)) return NAN;
+	return _poly_value((const struct _poly *) F->arg2->arg1, x);
+}
+
+/* Structural equality (for subtrees without integrals, etc.) */
+static int _same(formula A, formula B)
+{
+	if(A == B) return 1;
+	if(A->action != B->action || A->other_args || B->other_args) return 0;
+
+	switch(A->action)
+	{
+		case F_CONST:
+			return _get_const(A) == _get_const(B);
+		case F_VAR:
+			return _VAR_ID(A) == _VAR_ID(B);
+		case F_TABLE:
+			return 0;
+	}
+
+	if(!_same(A->arg1, B->arg1)) return 0;
+	if(!A->arg2 || !B->arg2) return A->arg2 == B->arg2;
+	return _same(A->arg2, B->arg2);
+}
+
+/* At most one coefficient is not 0 */
+static int _monomial(const double *c, int degree)
+{
+	int k, count = 0;
+	for(k = 0; k <= degree; k ++)
+		if(c[k] != 0) count ++;
+	return count <= 1;
+}
+
+/*
+	Coefficients of F as a polynomial in U: c[k] is the coefficient of U^k.
+	Returns the degree, -1 if F is not a polynomial in U.
+	'cost' is increased by the cost of calculating F as it is.
+*/
+static int _coefficients(formula F, formula U, double *c, int depth, int *cost)
+{
+	double a[POLY_MAX_DEGREE + 1], b[POLY_MAX_DEGREE + 1];
+	int n1, n2, k, j;
+
+	if(depth > POLY_MAX_DEPTH) return -1;
+	if(_same(F, U))
+	{
+		c[0] = 0;
+		c[1] = 1;
+		return 1;
+	}
+
+	switch(F->action)
+	{
+		case F_CONST:
+			c[0] = _get_const(F);
+			return 0;
+
+		case F_NOT:
+			if((n1 = _coefficients(F->arg1, U, c, depth + 1, cost)) == -1) return -1;
+			for(k = 0; k <= n1; k ++)
+				c[k] = -c[k];
+			(*cost) ++;
+			return n1;
+
+		case F_ADD:
+		case F_SUB:
+			if((n1 = _coefficients(F->arg1, U, c, depth + 1, cost)) == -1) return -1;
+			if((n2 = _coefficients(F->arg2, U, b, depth + 1, cost)) == -1) return -1;
+			for(k = n1 + 1; k <= n2; k ++)
+				c[k] = 0;
+			for(k = 0; k <= n2; k ++)
+				c[k] += F->action == F_ADD ? b[k] : -b[k];
+			(*cost) ++;
+			return n1 > n2 ? n1 : n2;
+
+		case F_MUL:
+			if((n1 = _coefficients(F->arg1, U, a, depth + 1, cost)) == -1) return -1;
+			if((n2 = _coefficients(F->arg2, U, b, depth + 1, cost)) == -1) return -1;
+			if(n1 + n2 > POLY_MAX_DEGREE) return -1;
+			if(n1 && n2 && !(_monomial(a, n1) && _monomial(b, n2))) return -1; /* not expanded (see above) */
+
+			for(k = 0; k <= n1 + n2; k ++)
+				c[k] = 0;
+			for(k = 0; k <= n1; k ++)
+				for(j = 0; j <= n2; j ++)
+					c[k + j] += a[k] * b[j];
+			(*cost) ++;
+			return n1 + n2;
+
+		case F_DIV:
+			if((n1 = _coefficients(F->arg1, U, c, depth + 1, cost)) == -1) return -1;
+			if((n2 = _coefficients(F->arg2, U, b, depth + 1, cost)) != 0 || b[0] == 0) return -1;
+			for(k = 0; k <= n1; k ++)
+				c[k] /= b[0];
+			(*cost) ++;
+			return n1;
+
+		case F_POW:
+		{
+			if(F->arg2->action != F_CONST) return -1;
+			double p = _get_const(F->arg2);
+			if(!(p >= 0 && p <= POLY_MAX_DEGREE && p == (int) p)) return -1;
+
+			if((n1 = _coefficients(F->arg1, U, a, depth + 1, cost)) == -1) return -1;
+			if(!_monomial(a, n1) || n1 * (int) p > POLY_MAX_DEGREE) return -1;
+
+			for(k = 0; k <= n1 * (int) p; k ++)
+				c[k] = 0;
+			for(k = n1; k > 0 && a[k] == 0; k --);
+			c[k * (int) p] = pow(a[k], p);
+			(*cost) += POLY_POW_COST;
+			return n1 * (int) p;
+		}
+	}
+	return -1;
+}
+
+/* The base of the first power (X in X^3, X-2 in (X-2)^3), or the first variable */
+static formula _base(formula F, int powers)
+{
+	formula B;
+	if(F->action == F_VAR) return powers ? NULL : F;
+	if(F->action == F_CONST || F->action == F_TABLE || F->other_args) return NULL;
+
+	if(powers && F->action == F_POW && F->arg2->action == F_CONST && F->arg1->action != F_CONST)
+		return F->arg1;
+
+	if((B = _base(F->arg1, powers))) return B;
+	return F->arg2 ? _base(F->arg2, powers) : NULL;
+}
+
+/* F becomes F_POLY if it is a polynomial which is calculated faster this way */
+static int _polynomial(formula F)
+{
+	double c[POLY_MAX_DEGREE + 1];
+	int degree = -1, cost = 0, attempt;
+	formula U = NULL;
+
+	for(attempt = 0; attempt < 2 && degree == -1; attempt ++)
+	{
+		U = _base(F, !attempt);
+		if(U && (attempt == 0 || U->action == F_VAR))
+		{
+			cost = 0;
+			degree = _coefficients(F, U, c, 0, &cost);
+		}
+	}
+	if(degree == -1) return 0;
+
+	while(degree > 0 && c[degree] == 0)
+		degree --;
+	if(cost <= 2 * degree + 1) return 0; /* Horner's scheme wouldn't be faster */
+
+	struct _poly *P = malloc(sizeof(struct _poly) + sizeof(double) * (degree + 1));
+	if(!P) return 0;
+	P->header.size = sizeof(struct _poly) + sizeof(double) * (degree + 1);
+	P->degree = degree;
+	memcpy(P->c, c, sizeof(double) * (degree + 1));
+
+	formula N = malloc(sizeof(struct _formula));
+	formula T = _table_alloc(P, F->args);
+	formula V = _formula_clone(U, F->args);
+	struct _other_args *other = malloc(sizeof(struct _other_args));
+	formula *other_arg = malloc(sizeof(formula));
+	if(!N || !T || !V || !other || !other_arg)
+	{
+		free(N);
+		if(T) _formula_free(T); else free(P);
+		if(V) _formula_free(V);
+		free(other);
+		free(other_arg);
+		return 0;
+	}
+
+	other->count = 1;
+	other->arg = other_arg;
+	other_arg[0] = V;
+
+	memcpy(N, F, sizeof(struct _formula));
+	F->vars = symtable_clone(N->vars);
+	F->action = F_POLY;
+	F->arg1 = N;
+	F->arg2 = T;
+	F->other_args = other;
+	return 1;
+}
+
+/* Top-down: the largest polynomial subtrees are replaced */
+static void _horner(formula F)
+{
+	int i;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE || F->action == F_POLY) return;
+	if(symtable_count(F->vars) == 1 && _polynomial(F)) return;
+
+	_horner(F->arg1);
+	if(F->arg2) _horner(F->arg2);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			_horner(F->other_args->arg[i]);
+}
+
+void formula_horner(formula F)
+{
+	if(!F) return;
+	_formula_own(F, NULL);
+	_horner(F);
+}
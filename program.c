@@ -0,0 +1,601 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include "program.h"
+#include "formula_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* State of program_new(): each distinct instruction is added only once */
+struct _builder
+{
+	program P;
+	int capacity;
+	int *hash; /* indexes of instructions (-1 for empty slots) */
+	int hash_size; /* power of 2, more than twice the number of instructions */
+};
+
+static int _nodes_count(formula F)
+{
+	int i, count = 1;
+	if(F->action == F_CONST || F->action == F_VAR || F->action == F_TABLE) return 1;
+
+	count += _nodes_count(F->arg1);
+	if(F->arg2) count += _nodes_count(F->arg2);
+	if(F->other_args)
+		for(i = 0; i < F->other_args->count; i ++)
+			count += _nodes_count(F->other_args->arg[i]);
+	return count;
+}
+
+static unsigned _hash(const struct _instruction *I)
+{
+	uint64_t bits;
+	memcpy(&bits, &I->value, sizeof(bits));
+
+	uint64_t h = (uint64_t) I->action * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint32_t) I->arg1) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (uint32_t) I->arg2) * 0x94d049bb133111ebULL;
+	h ^= bits;
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 29;
+	return (unsigned) h;
+}
+
+/* Returns the index of instruction I (it is added if there's no such instruction yet) */
+static int _emit(struct _builder *B, struct _instruction *I)
+{
+	program P = B->P;
+	unsigned slot = _hash(I) & (B->hash_size - 1);
+
+	if(I->action != P_CALL)
+		for(; B->hash[slot] != -1; slot = (slot + 1) & (B->hash_size - 1))
+		{
+			struct _instruction *J = &P->code[B->hash[slot]];
+			if(J->action == I->action && J->arg1 == I->arg1 && J->arg2 == I->arg2
+				&& !memcmp(&J->value, &I->value, sizeof(double)) && J->node == I->node)
+					return B->hash[slot];
+		}
+
+	if(P->count == B->capacity) return -1; /* can't happen: capacity is the number of nodes */
+	P->code[P->count] = *I;
+
+	if(I->action != P_CALL)
+		B->hash[slot] = P->count;
+	return P->count ++;
+}
+
+static int _compile(struct _builder *B, formula F)
+{
+	struct _instruction I;
+	memset(&I, 0, sizeof(I));
+	I.action = F->action;
+	I.arg1 = I.arg2 = -1;
+
+	switch(F->action)
+	{
+		case F_CONST:
+			I.value = _get_const(F);
+			return _emit(B, &I);
+
+		case F_VAR:
+			I.arg1 = symtable_order_id(B->P->vars, _VAR_ID(F));
+			return _emit(B, &I);
+
+
+		case F_HOISTED:
+			return _compile(B, F->arg1);
+
+		case F_POLY: /* only the variable of the polynomial is a separate instruction */
+			I.arg1 = _compile(B, F->other_args->arg[0]);
+			if(I.arg1 == -1) return -1;
+			I.node = F;
+			return _emit(B, &I);
+
+		case F_INTEGRAL:
+		case F_DERIVATIVE:
+		case F_CUBATURE:
+		case F_MEMO:
+		case F_CUMULATIVE:
+		case F_APPROX:
+		case F_SUM:
+		case F_PROD:
+		{
+			if(!F->args) return -1;
+			int count = symtable_count(F->args);
+
+			I.action = P_CALL;
+			I.arg1 = count;
+			I.node = F;
+			I.orders = malloc(sizeof(int) * (count + 1));
+			I.node_args = malloc(sizeof(double) * (count + 1));
+			if(!I.orders || !I.node_args)
+			{
+				free(I.orders);
+				free(I.node_args);
+				return -1;
+			}
+
+			symtable_orders(B->P->vars, F->args, I.orders);
+			return _emit(B, &I);
+		}
+	}
+
+	I.arg1 = _compile(B, F->arg1);
+	if(I.arg1 == -1) return -1;
+	if(F->arg2)
+	{
+		I.arg2 = _compile(B, F->arg2);
+		if(I.arg2 == -1) return -1;
+
+		if((F->action == F_ADD || F->action == F_MUL) && I.arg1 > I.arg2)
+		{ /* A*B and B*A are the same instruction */
+			int t = I.arg1;
+			I.arg1 = I.arg2;
+			I.arg2 = t;
+		}
+	}
+	return _emit(B, &I);
+}
+
+program program_new(const formula *F, int count)
+{
+	struct _builder B;
+	int i, nodes = 0;
+
+	program P = calloc(1, sizeof(struct _program));
+	if(!P) return NULL;
+
+	P->vars = symtable_new();
+	P->roots = malloc(sizeof(int) * (count + 1));
+	if(!P->vars || !P->roots)
+	{
+		program_free(P);
+		return NULL;
+	}
+	P->roots_count = count;
+
+	for(i = 0; i < count; i ++)
+	{
+		symtable_import(P->vars, F[i]->vars);
+		nodes += _nodes_count(F[i]);
+	}
+
+	B.P = P;
+	B.capacity = nodes;
+	B.hash_size = 1;
+	while(B.hash_size < 2 * nodes + 2) B.hash_size <<= 1;
+
+	B.hash = malloc(sizeof(int) * B.hash_size);
+	P->code = malloc(sizeof(struct _instruction) * (nodes + 1));
+	if(!B.hash || !P->code)
+	{
+		free(B.hash);
+		program_free(P);
+		return NULL;
+	}
+	memset(B.hash, -1, sizeof(int) * B.hash_size);
+
+	for(i = 0; i < count; i ++)
+	{
+		P->roots[i] = _compile(&B, F[i]);
+		if(P->roots[i] == -1)
+		{
+			free(B.hash);
+			program_free(P);
+			return NULL;
+		}
+	}
+
+	free(B.hash);
+	return P;
+}
+
+static inline void _run(const program P, int i, const double *args, double *values)
+{
+	const struct _instruction *I = &P->code[i];
+	double p1, p2;
+	int j;
+
+	switch(I->action)
+	{
+		case F_CONST:
+			values[i] = I->value;
+			break;
+
+		case F_VAR:
+			values[i] = args[I->arg1];
+			break;
+
+		case P_CALL:
+		{
+			for(j = 0; j < I->arg1; j ++)
+				I->node_args[j] = args[I->orders[j]];
+
+			values[i] = _formula_eval(I->node, I->node_args);
+			break;
+		}
+
+		case F_POLY:
+			p1 = values[I->arg1];
+			values[i] = isnanl(p1) ? NAN : _poly_value((const struct _poly *) I->node->arg2->arg1, p1);
+			break;
+
+		default:
+			p1 = values[I->arg1];
+			p2 = I->arg2 == -1 ? 0 : values[I->arg2];
+			values[i] = (isnanl(p1) || isnanl(p2)) ? NAN : _calc(I->action, p1, p2);
+	}
+}
+
+__attribute__((fastcall)) void program_run(const program P, const double *args, double *values)
+{
+	int i;
+	for(i = 0; i < P->count; i ++)
+		_run(P, i, args, values);
+}
+
+#define PROGRAM_BATCH 128 /* points calculated at a time by program_run_batch() */
+
+int program_run_batch(const program P, const double *const *args, int count, double *const *values)
+{
+	double *buf = malloc(sizeof(double) * PROGRAM_BATCH * (P->count + 1));
+	const double **out = malloc(sizeof(double *) * (P->count + 1)); /* values of instruction i for the block */
+	int start, i, j, k;
+	if(!buf || !out)
+	{
+		free(buf);
+		free(out);
+		return 0;
+	}
+
+	for(i = 0; i < P->count; i ++)
+	{
+		double *res = buf + i * PROGRAM_BATCH;
+		out[i] = res;
+		if(P->code[i].action == F_CONST)
+			for(j = 0; j < PROGRAM_BATCH; j ++)
+				res[j] = P->code[i].value;
+	}
+
+	for(start = 0; start < count; start += PROGRAM_BATCH)
+	{
+		int n = count - start < PROGRAM_BATCH ? count - start : PROGRAM_BATCH;
+		for(i = 0; i < P->count; i ++)
+		{
+			const struct _instruction *I = &P->code[i];
+			double *res = buf + i * PROGRAM_BATCH;
+
+			switch(I->action)
+			{
+				case F_CONST:
+					break;
+
+				case F_VAR:
+					out[i] = args[I->arg1] + start;
+					break;
+
+				case P_CALL:
+					for(j = 0; j < n; j ++)
+					{
+						for(k = 0; k < I->arg1; k ++)
+							I->node_args[k] = args[I->orders[k]][start + j];
+						res[j] = _formula_eval(I->node, I->node_args);
+					}
+					break;
+
+				case F_POLY:
+					for(j = 0; j < n; j ++)
+					{
+						double x = out[I->arg1][j];
+						res[j] = isnanl(x) ? NAN : _poly_value((const struct _poly *) I->node->arg2->arg1, x);
+					}
+					break;
+
+				default:
+					_vec_calc(I->action, out[I->arg1], I->arg2 == -1 ? NULL : out[I->arg2], res, n, P->precision);
+			}
+		}
+
+		for(i = 0; i < P->roots_count; i ++)
+			memcpy(values[i] + start, out[P->roots[i]], sizeof(double) * n);
+	}
+
+	free(buf);
+	free(out);
+	return 1;
+}
+
+/*
+	Grid evaluation.
+	The level of the instruction is the last argument it depends on (-1 for constants).
+	When argument k changes, only instructions of levels k, k+1, ... are recalculated.
+*/
+
+/* Bit k is set if instruction i depends on argument k (arguments after 31 share the last bit) */
+static unsigned long _arg_bit(int order)
+{
+	return 1UL << (order < (int) (sizeof(unsigned long) * 8) ? order : (int) (sizeof(unsigned long) * 8) - 1);
+}
+
+static void _levels(const program P, int *level, int *orders)
+{
+	int i, j, count;
+	for(i = 0; i < P->count; i ++)
+	{
+		const struct _instruction *I = &P->code[i];
+		switch(I->action)
+		{
+			case F_CONST:
+				level[i] = -1;
+				break;
+
+			case F_VAR:
+				level[i] = I->arg1;
+				break;
+
+			case P_CALL:
+				/* Only free variables of the node (not all arguments of the formula) */
+				count = symtable_orders(P->vars, I->node->vars, orders);
+				level[i] = -1;
+				for(j = 0; j < count; j ++)
+					if(orders[j] > level[i])
+						level[i] = orders[j];
+				break;
+
+			default:
+				level[i] = level[I->arg1];
+				if(I->arg2 != -1 && level[I->arg2] > level[i])
+					level[i] = level[I->arg2];
+		}
+	}
+}
+
+int eval_grid(const formula F, const double *const *axes, const int *counts, double *out)
+{
+	program P = program_new(&F, 1);
+	if(!P) return 0;
+
+	int N = program_args(P), i, k;
+	int *level = malloc(sizeof(int) * (P->count + 1));
+	int *order = malloc(sizeof(int) * (P->count + 1)); /* instructions sorted by level */
+	int *start = calloc(N + 2, sizeof(int)); /* order[start[k + 1]] is the first instruction of level k */
+	int *index = malloc(sizeof(int) * (N + 1)); /* also a buffer for _levels() */
+	double *args = malloc(sizeof(double) * (N + 1));
+	double *values = malloc(sizeof(double) * (P->count + 1));
+	int ok = level && order && start && index && args && values;
+	if(!ok) goto cleanup;
+
+	long total = 1;
+	for(k = 0; k < N; k ++)
+	{
+		total *= counts[k];
+		if(counts[k] > 0) args[k] = axes[k][0];
+	}
+	if(total <= 0) goto cleanup;
+
+	/* Counting sort keeps the order of instructions within the level */
+	_levels(P, level, index);
+	memset(index, 0, sizeof(int) * (N + 1));
+	for(i = 0; i < P->count; i ++)
+		start[level[i] + 2] ++;
+	for(k = 1; k <= N; k ++)
+		start[k] += start[k - 1];
+	for(i = 0; i < P->count; i ++)
+		order[start[level[i] + 1] ++] = i;
+	for(k = N; k > 0; k --)
+		start[k] = start[k - 1];
+	start[0] = 0;
+
+	int changed = -1, root = P->roots[0];
+	long n;
+	for(n = 0; n < total; n ++)
+	{
+		for(i = start[changed + 1]; i < P->count; i ++)
+			_run(P, order[i], args, values);
+		out[n] = values[root];
+
+		/* Next point: the last argument changes most often */
+		for(k = N - 1; k >= 0; k --)
+		{
+			if(++ index[k] < counts[k]) break;
+			index[k] = 0;
+			args[k] = axes[k][0];
+		}
+		if(k < 0) break;
+
+		args[k] = axes[k][index[k]];
+		changed = k;
+	}
+
+cleanup:
+	free(level);
+	free(order);
+	free(start);
+	free(index);
+	free(args);
+	free(values);
+	program_free(P);
+	return ok;
+}
+
+int program_args(const program P)
+{
+	return symtable_count(P->vars);
+}
+
+void program_free(program P)
+{
+	int i;
+	if(!P) return;
+
+	if(P->code)
+		for(i = 0; i < P->count; i ++)
+		{
+			free(P->code[i].orders);
+			free(P->code[i].node_args);
+		}
+
+	free(P->code);
+	free(P->roots);
+	if(P->vars) symtable_free(P->vars);
+	free(P);
+}
+
+/*
+	Incremental evaluation.
+*/
+
+eval_context eval_context_new(const formula F)
+{
+	eval_context C = calloc(1, sizeof(struct _eval_context));
+	if(!C) return NULL;
+
+	program P = C->P = program_new(&F, 1);
+	if(!P)
+	{
+		free(C);
+		return NULL;
+	}
+
+	int N = program_args(P), i, j, k, count;
+	int *orders = malloc(sizeof(int) * (N + 1));
+	C->args = malloc(sizeof(double) * (N + 1));
+	C->values = malloc(sizeof(double) * (P->count + 1));
+	C->masks = malloc(sizeof(unsigned long) * (P->count + 1));
+	C->users = calloc(N + 1, sizeof(int *));
+	if(!orders || !C->args || !C->values || !C->masks || !C->users)
+	{
+		free(orders);
+		eval_context_free(C);
+		return NULL;
+	}
+
+	for(i = 0; i < P->count; i ++)
+	{
+		const struct _instruction *I = &P->code[i];
+		switch(I->action)
+		{
+			case F_CONST:
+				C->masks[i] = 0;
+				break;
+
+			case F_VAR:
+				C->masks[i] = _arg_bit(I->arg1);
+				break;
+
+			case P_CALL:
+				count = symtable_orders(P->vars, I->node->vars, orders);
+				C->masks[i] = 0;
+				for(j = 0; j < count; j ++)
+					C->masks[i] |= _arg_bit(orders[j]);
+				break;
+
+			default:
+				C->masks[i] = C->masks[I->arg1];
+				if(I->arg2 != -1) C->masks[i] |= C->masks[I->arg2];
+		}
+	}
+	free(orders);
+
+	for(k = 0; k < N; k ++)
+	{
+		for(i = 0, count = 0; i < P->count; i ++)
+			if(C->masks[i] & _arg_bit(k)) count ++;
+
+		C->users[k] = malloc(sizeof(int) * (count + 1));
+		if(!C->users[k])
+		{
+			eval_context_free(C);
+			return NULL;
+		}
+
+		for(i = 0, count = 0; i < P->count; i ++)
+			if(C->masks[i] & _arg_bit(k)) C->users[k][count ++] = i;
+		C->users[k][count] = -1;
+	}
+	return C;
+}
+
+double eval_context_update(eval_context C, const double *args)
+{
+	program P = C->P;
+	int N = program_args(P), i, k;
+
+	if(!C->valid)
+	{
+		memcpy(C->args, args, sizeof(double) * N);
+		program_run(P, C->args, C->values);
+		C->valid = 1;
+		return C->values[P->roots[0]];
+	}
+
+	unsigned long changed = 0;
+	int last = -1;
+	for(k = 0; k < N; k ++)
+		if(memcmp(&C->args[k], &args[k], sizeof(double)))
+		{
+			C->args[k] = args[k];
+			changed |= _arg_bit(k);
+			last = k;
+		}
+
+	if(last == -1)
+		; /* nothing changed */
+	else if(changed == _arg_bit(last))
+	{ /* one argument: only its users are visited */
+		const int *user;
+		for(user = C->users[last]; *user != -1; user ++)
+			_run(P, *user, C->args, C->values);
+	}
+	else
+	{
+		for(i = 0; i < P->count; i ++)
+			if(C->masks[i] & changed)
+				_run(P, i, C->args, C->values);
+	}
+	return C->values[P->roots[0]];
+}
+
+double eval_context_set(eval_context C, int arg, double value)
+{
+	const int *user;
+	if(arg < 0 || arg >= program_args(C->P) || !C->valid) return NAN;
+
+	C->args[arg] = value;
+	for(user = C->users[arg]; *user != -1; user ++)
+		_run(C->P, *user, C->args, C->values);
+	return C->values[C->P->roots[0]];
+}
+
+void eval_context_free(eval_context C)
+{
+	int k;
+	if(!C) return;
+
+	if(C->users)
+		for(k = 0; k < program_args(C->P); k ++)
+			free(C->users[k]);
+
+	free(C->users);
+	free(C->args);
+	free(C->values);
+	free(C->masks);
+	program_free(C->P);
+	free(C);
+}
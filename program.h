@@ -0,0 +1,164 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _PROGRAM_H
+#define _PROGRAM_H
+
+#include "formula.h"
+#include "symtable.h"
+
+/*
+	Several formulas compiled into one flat list of instructions.
+	Equal subexpressions (even in different formulas) are calculated once.
+*/
+
+#define P_CALL 100 /* subtree which is calculated by eval() (integrals, derivatives, etc.) */
+
+struct _instruction
+{
+	int action; /* F_CONST, F_VAR, P_CALL, F_POLY or operation (F_ADD, F_SIN, etc.) */
+	int arg1, arg2; /* indexes of the instructions with operands (-1 if none),
+		F_VAR: order of the variable, P_CALL: number of node's arguments */
+	double value; /* F_CONST */
+
+	formula node; /* P_CALL and F_POLY (the coefficients) */
+	int *orders; /* P_CALL: orders of node's arguments among arguments of the program */
+	double *node_args; /* P_CALL: buffer for node's arguments */
+};
+
+typedef struct _program
+{
+	int count; /* number of instructions */
+	int roots_count;
+	int *roots; /* roots[i] is the index of the instruction with the value of formula i */
+	symtable vars; /* arguments of the program: all arguments of all formulas */
+	struct _instruction *code;
+	int precision; /* of math functions in program_run_batch(): FORMULA_EXACT (default), FORMULA_FAST or FORMULA_APPROX */
+} *program;
+
+/**
+	@brief Compile several formulas into one program.
+	@param F Array of formulas.
+	@param count Number of formulas.
+	@returns Program object, NULL if there's not enough memory.
+
+	@note Arguments of the program are all variables used in the formulas
+		(in alphabetical order, as in eval()).
+	@note The program uses the formulas (for integrals, etc.),
+		so they must not be freed before program_free().
+*/
+program program_new(const formula *F, int count) __attribute__((malloc nonnull warn_unused_result));
+
+/**
+	@brief Calculate all instructions of the program.
+	@param P Program object.
+	@param args Values of program_args(P) arguments.
+	@param values Array of P->count doubles, receives values of all instructions.
+		The value of formula i is values[P->roots[i]].
+	@note Like eval(), this is not thread-safe for the same program.
+*/
+void program_run(const program P, const double *args, double *values) __attribute__((fastcall nonnull));
+
+/**
+	@brief Calculate the program in many points.
+	@param P Program object.
+	@param args Array of program_args(P) arrays: args[k][j] is the value of argument k in point j.
+	@param count Number of points.
+	@param values Array of P->roots_count arrays of \b count doubles,
+		values[i][j] receives the value of formula i in point j.
+	@returns 1 on success, 0 if there's not enough memory.
+
+	@note Each instruction is applied to a block of points at a time,
+		so the loops can be vectorized by the compiler. Math functions
+		are calculated with the accuracy chosen by P->precision.
+	@note Like program_run(), this is not thread-safe for the same program.
+*/
+int program_run_batch(const program P, const double *const *args, int count, double *const *values)
+	__attribute__((nonnull(1,4)));
+
+/**
+	@brief Number of arguments of the program.
+*/
+int program_args(const program P) __attribute__((nonnull));
+
+/**
+	@brief Calculate F in all points of a grid.
+	@param F Formula object.
+	@param axes Array of formula_args(F) arrays: axes[k] contains counts[k] values
+		of argument k (in the order of eval() parameters).
+	@param counts Array of formula_args(F) numbers of values.
+	@param out Array of counts[0] * counts[1] * ... doubles, receives the values of F.
+		The last argument changes most often (out[0] = F(axes[0][0], ..., axes[N-1][0]),
+		out[1] = F(axes[0][0], ..., axes[N-1][1]), etc.)
+	@returns 1 on success, 0 if there's not enough memory.
+
+	@note Subexpressions which don't depend on the inner arguments
+		(e.g. exp(-A/C) when only B changes) are calculated once
+		for all values of the inner arguments.
+*/
+int eval_grid(const formula F, const double *const *axes, const int *counts, double *out)
+	__attribute__((nonnull(1,4) warn_unused_result));
+
+/**
+	@brief Free the program returned by program_new().
+*/
+void program_free(program P);
+
+/**
+	@brief State of incremental evaluation: values of all subexpressions
+		in the last point, see eval_context_new().
+*/
+typedef struct _eval_context
+{
+	program P;
+	double *args; /* the last point */
+	double *values; /* values of all instructions in this point */
+	unsigned long *masks; /* masks[i]: bit k is set if instruction i depends on argument k */
+	int **users; /* users[k]: indexes of instructions which depend on argument k, terminated by -1 */
+	int valid; /* 0 until the first eval_context_update() */
+} *eval_context;
+
+/**
+	@brief Create a context for repeated evaluation of F in points
+		which differ in one or several arguments.
+	@returns Context object, NULL if there's not enough memory.
+	@note F must not be freed before eval_context_free().
+*/
+eval_context eval_context_new(const formula F) __attribute__((malloc nonnull warn_unused_result));
+
+/**
+	@brief Calculate F(args), recalculating only subexpressions
+		which depend on the arguments changed since the previous call.
+	@param C Context object.
+	@param args Values of formula_args(F) arguments (as in eval_array()).
+	@returns Value of F.
+*/
+double eval_context_update(eval_context C, const double *args) __attribute__((nonnull));
+
+/**
+	@brief Change one argument and calculate F.
+	@param C Context object (eval_context_update() must have been called at least once).
+	@param arg Order of the argument (as in eval() parameters).
+	@param value New value of the argument.
+	@returns Value of F.
+*/
+double eval_context_set(eval_context C, int arg, double value) __attribute__((nonnull));
+
+/**
+	@brief Free the context returned by eval_context_new().
+*/
+void eval_context_free(eval_context C);
+
+#endif
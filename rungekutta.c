@@ -44,11 +44,12 @@ formula rungekutta_solve(formula F, double X0, double Y0)
 
 		factorial *= i;
 
-		formula TaylorElement = parse("D/N*(X-T)^P");
-		reduce(TaylorElement, "D", y);
-		reduce(TaylorElement, "T", x);
-		reduce(TaylorElement, "N", factorial);
-		reduce(TaylorElement, "P", i - 1);
+		/* y/factorial*(X-x)^(i-1) */
+		formula TaylorElement = formula_finish(NULL, formula_op(NULL, F_MUL,
+			formula_op(NULL, F_DIV, formula_const(NULL, y), formula_const(NULL, factorial)),
+			formula_op(NULL, F_POW,
+				formula_op(NULL, F_SUB, formula_var(NULL, "X"), formula_const(NULL, x)),
+				formula_const(NULL, i - 1))));
 
 		upgrade(F_ADD, &top, &TaylorElement);
 	} while(++ i < 5);
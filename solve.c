@@ -0,0 +1,296 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <float.h>
+#include <pthread.h>
+
+#include "solve.h"
+#include "taylor.h"
+#include "formula_internal.h"
+
+#define SOLVE_MAX_ITERATIONS 200 /* Brent's method always converges faster (bisection is the worst case) */
+#define SOLVE_BATCH_CHUNK 16 /* solve1_batch(): equations taken by a thread at once */
+
+int solve_debug = 0;
+
+/* One equation F(args) = 0, where args[order] is the unknown */
+struct _equation
+{
+	formula F;
+	int count, order;
+	double *args; /* formula_args(F) */
+	int newton; /* 1 if taylor_series() can calculate the derivative */
+	double *series; /* 2 coefficients for each argument */
+	const double **series_args;
+	int evaluations;
+};
+
+static int _equation_init(struct _equation *E, formula F, int count, int order)
+{
+	int i;
+	E->F = F;
+	E->count = count;
+	E->order = order;
+	E->newton = 1;
+	E->evaluations = 0;
+	E->args = malloc(sizeof(double) * (count + 1));
+	E->series = malloc(sizeof(double) * 2 * (count + 1));
+	E->series_args = malloc(sizeof(double *) * (count + 1));
+	if(!E->args || !E->series || !E->series_args) return 0;
+
+	/* Derivative by the unknown: all other arguments are constant */
+	for(i = 0; i < count; i ++)
+	{
+		E->series[2 * i + 1] = (i == order) ? 1 : 0;
+		E->series_args[i] = E->series + 2 * i;
+	}
+	return 1;
+}
+
+static void _equation_free(struct _equation *E)
+{
+	free(E->args);
+	free(E->series);
+	free(E->series_args);
+}
+
+/* F(x), *derivative receives F'(x) (NAN if unknown) */
+static double _value(struct _equation *E, double x, double *derivative)
+{
+	int i;
+	E->args[E->order] = x;
+	E->evaluations ++;
+
+	if(E->newton)
+	{
+		double out[2];
+		for(i = 0; i < E->count; i ++)
+			E->series[2 * i] = E->args[i];
+
+		if(taylor_series(E->F, E->series_args, 2, out))
+		{
+			*derivative = out[1];
+			return out[0];
+		}
+		E->newton = 0; /* e.g. F contains integrals */
+	}
+
+	*derivative = NAN;
+	return _formula_eval(E->F, E->args);
+}
+
+static int _same_sign(double x, double y)
+{
+	return (x > 0) == (y > 0);
+}
+
+/*
+	Brent's method: [b; c] always contains the root, b is the best approximation,
+	a is the previous value of b. Newton's step from b (or, without derivatives,
+	inverse quadratic interpolation through a, b, c) is used when it stays well
+	within [b; c] and converges fast enough, otherwise [b; c] is bisected.
+*/
+static double _brent(struct _equation *E, double a, double b, double tolerance)
+{
+	double da, db, dc;
+	double fa = _value(E, a, &da), fb = _value(E, b, &db), fc;
+	double c, d, e, s, tol1, xm;
+	int i;
+
+	if(isnan(fa) || isnan(fb)) return NAN;
+	if(fa == 0) return a;
+	if(fb == 0) return b;
+	if(_same_sign(fa, fb)) return NAN;
+
+	c = a; fc = fa; dc = da;
+	d = e = b - a;
+
+	for(i = 0; i < SOLVE_MAX_ITERATIONS; i ++)
+	{
+		if(_same_sign(fb, fc))
+		{
+			c = a; fc = fa; dc = da;
+			d = e = b - a;
+		}
+		if(fabs(fc) < fabs(fb))
+		{
+			a = b; fa = fb; da = db;
+			b = c; fb = fc; db = dc;
+			c = a; fc = fa; dc = da;
+		}
+
+		tol1 = 2 * DBL_EPSILON * fabs(b) + tolerance / 2;
+		xm = (c - b) / 2;
+
+		if(solve_debug)
+			printf("%5i %20.15lf %20.15lf %12.4le\n", i, b, c, fb);
+
+		if(fabs(xm) <= tol1 || fb == 0)
+			return b;
+
+		int bisect = 1;
+		if(fabs(e) >= tol1 && fabs(fa) > fabs(fb))
+		{
+			if(!isnan(db) && db != 0)
+				s = -fb / db; /* Newton */
+			else if(a == c)
+				s = -fb * (b - a) / (fb - fa); /* secant */
+			else
+			{ /* inverse quadratic interpolation */
+				double q = fa / fc, r = fb / fc, t = fb / fa;
+				s = -t * (2 * xm * q * (q - r) - (b - a) * (r - 1))
+					/ ((q - 1) * (r - 1) * (t - 1));
+			}
+
+			if(isfinite(s) && s * xm > 0 && 2 * fabs(s) < 3 * fabs(xm) - tol1
+				&& 2 * fabs(s) < fabs(e))
+			{
+				e = d;
+				d = s;
+				bisect = 0;
+			}
+		}
+		if(bisect)
+			d = e = xm;
+
+		a = b; fa = fb; da = db;
+		b += fabs(d) > tol1 ? d : (xm > 0 ? tol1 : -tol1);
+		fb = _value(E, b, &db);
+		if(isnan(fb)) return NAN;
+	}
+	return b;
+}
+
+double solve1(const formula F, double a, double b, double tolerance)
+{
+	if(formula_args(F) != 1) return NAN;
+
+	struct _equation E;
+	double x = NAN;
+	if(_equation_init(&E, F, 1, 0))
+	{
+		x = _brent(&E, a, b, tolerance);
+		if(solve_debug)
+			printf("Root: %.15lf (%i evaluations%s)\n", x, E.evaluations,
+				E.newton ? ", Newton's method" : "");
+	}
+	_equation_free(&E);
+	return x;
+}
+
+/*
+	Batch solving.
+*/
+
+struct _batch_job
+{
+	formula F;
+	int args_count, order, count;
+	const double *params;
+	double a, b, tolerance;
+	double *roots;
+	int next; /* first equation which is not taken by any thread yet */
+	int found;
+};
+
+struct _batch_worker
+{
+	struct _batch_job *J;
+	formula F; /* eval() is not thread-safe, so each thread has its own copy of F */
+	int id;
+};
+
+static void *_batch_worker(void *arg)
+{
+	struct _batch_worker *W = (struct _batch_worker *) arg;
+	struct _batch_job *J = W->J;
+	int N = J->args_count - 1, found = 0, i, j;
+
+	formula F = W->F;
+	struct _equation E;
+	if(!F || !_equation_init(&E, F, J->args_count, J->order))
+	{
+		if(F) _equation_free(&E);
+		return NULL;
+	}
+
+	while(1)
+	{
+		int first = __sync_fetch_and_add(&J->next, SOLVE_BATCH_CHUNK);
+		if(first >= J->count) break;
+
+		int last = first + SOLVE_BATCH_CHUNK;
+		if(last > J->count) last = J->count;
+
+		for(i = first; i < last; i ++)
+		{
+			const double *P = J->params + (size_t) i * N;
+			for(j = 0; j < N; j ++)
+				E.args[j < J->order ? j : j + 1] = P[j];
+
+			E.newton = 1;
+			J->roots[i] = _brent(&E, J->a, J->b, J->tolerance);
+			if(!isnan(J->roots[i])) found ++;
+		}
+	}
+
+	__sync_fetch_and_add(&J->found, found);
+	_equation_free(&E);
+	return NULL;
+}
+
+int solve1_batch(const formula F, const char *x, const double *params, int count,
+	double a, double b, double tolerance, int threads, double *roots)
+{
+	int args_count = formula_args(F), i;
+	if(args_count < 1 || count < 0 || !F->args || !symtable_isset(F->args, x)) return -1;
+	if(args_count > 1 && !params && count > 0) return -1;
+	if(threads < 1) threads = 1;
+	if(threads > count / SOLVE_BATCH_CHUNK + 1) threads = count / SOLVE_BATCH_CHUNK + 1;
+
+	for(i = 0; i < count; i ++)
+		roots[i] = NAN;
+
+	struct _batch_job J = {
+		.F = F,
+		.args_count = args_count,
+		.order = symtable_order_raw(F->args, x),
+		.count = count,
+		.params = params,
+		.a = a,
+		.b = b,
+		.tolerance = tolerance,
+		.roots = roots,
+		.next = 0,
+		.found = 0
+	};
+
+	struct _batch_worker *workers = malloc(sizeof(struct _batch_worker) * threads);
+	if(!workers) return -1;
+
+	for(i = 0; i < threads; i ++)
+	{
+		workers[i].J = &J;
+		workers[i].id = i;
+	}
+	_formula_threads(F, threads, _batch_worker, workers, sizeof(struct _batch_worker), offsetof(struct _batch_worker, F));
+
+	free(workers);
+	return J.found;
+}
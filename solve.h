@@ -0,0 +1,61 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _SOLVE_H
+#define _SOLVE_H
+
+#include "formula.h"
+
+/**
+	@brief Flag to enable debugging output from solve1() and solve1_batch().
+		Set to 1 to enable (default 0).
+*/
+extern int solve_debug;
+
+/**
+	@brief Find X in [a; b] where F(X) = 0.
+	@param F Formula object (with one argument).
+	@param a Starting point of [a; b] range.
+	@param b Ending point of [a; b] range.
+	@param tolerance Needed precision of X (e.g. 1e-12).
+	@returns The root, NAN if F(a) and F(b) have the same sign (or are undefined).
+
+	@note This is Brent's method. If the derivative of F can be calculated
+		from the formula (see taylor_series()), Newton's steps are used instead
+		of interpolation, so usually only a few evaluations are needed.
+*/
+double solve1(const formula F, double a, double b, double tolerance)
+	__attribute__((nonnull(1) warn_unused_result));
+
+/**
+	@brief Solve F(X; P) = 0 for many values of parameters P.
+	@param F Formula object.
+	@param x Name of the unknown variable (e.g. "X").
+	@param params Array of count * (formula_args(F) - 1) values:
+		for each equation, values of the other arguments of F
+		(in the order of eval() parameters, without \b x).
+	@param count Number of equations.
+	@param a Starting point of [a; b] range.
+	@param b Ending point of [a; b] range.
+	@param tolerance Needed precision of X.
+	@param threads Number of threads (1 to solve everything in the current thread).
+	@param roots Array of \b count doubles, receives the roots (NAN where solve1() would fail).
+	@returns Number of roots found, -1 on error (e.g. F doesn't depend on \b x).
+*/
+int solve1_batch(const formula F, const char *x, const double *params, int count,
+	double a, double b, double tolerance, int threads, double *roots)
+	__attribute__((nonnull(1,2,9)));
+
+#endif
@@ -0,0 +1,205 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "formula_internal.h"
+
+/*
+	F_SUM and F_PROD.
+
+	The body is not calculated index by index. Before the loop it's turned into
+	a list of steps (operands go before the operation):
+		- elements of arrays are read right from the arguments
+		  (elements of one array are consecutive arguments),
+		- subexpressions which don't depend on the index are calculated once,
+		- operations are applied to SUM_CHUNK indexes at a time
+		  by _vec_calc() (vecmath.c).
+*/
+
+#define SUM_CHUNK 128 /* indexes calculated at a time */
+#define SUM_STACK_STEPS 16 /* bodies with more steps use malloc()ed buffers */
+
+struct _step
+{
+	int action; /* F_ELEMENT, F_CONST (doesn't depend on the index) or operation */
+	int arg1, arg2; /* operation: steps with the operands (arg2 is -1 for unary operations) */
+	const double *element; /* F_ELEMENT: the element for the first index */
+	double value; /* F_CONST */
+	const double *out; /* values for the current chunk */
+	double *buf; /* F_CONST and operations: SUM_CHUNK values */
+};
+
+static int _steps_count(formula F)
+{
+	if(F->action == F_ELEMENT || F->action < F_NOT || F->action > F_ABS
+		|| F->action == F_INTEGRAL || F->action == F_DERIVATIVE)
+			return 1;
+	return 1 + _steps_count(F->arg1) + (F->arg2 ? _steps_count(F->arg2) : 0);
+}
+
+/* Returns the index of the step with the value of F */
+static int _compile(struct _step *steps, int *count, formula F, const double *args, int from)
+{
+	struct _step *S;
+	int arg1, arg2 = -1;
+
+	if(F->action == F_ELEMENT)
+	{
+		S = &steps[*count];
+		S->action = F_ELEMENT;
+		S->element = args + symtable_order(F->arg1) + from - 1;
+		return (*count) ++;
+	}
+
+	if(F->action < F_NOT || F->action > F_ABS || F->action == F_INTEGRAL || F->action == F_DERIVATIVE)
+	{ /* formula_sum() checked that it doesn't contain elements */
+		S = &steps[*count];
+		S->action = F_CONST;
+		S->value = _formula_eval(F, args);
+		return (*count) ++;
+	}
+
+	arg1 = _compile(steps, count, F->arg1, args, from);
+	if(F->arg2) arg2 = _compile(steps, count, F->arg2, args, from);
+
+	if(steps[arg1].action == F_CONST && (arg2 == -1 || steps[arg2].action == F_CONST))
+	{ /* doesn't depend on the index: the same as _eval() */
+		double p1 = steps[arg1].value, p2 = arg2 == -1 ? 0 : steps[arg2].value;
+		S = &steps[arg1];
+		S->value = (isnan(p1) || isnan(p2)) ? NAN : _calc(F->action, p1, p2);
+		*count = arg1 + 1;
+		return arg1;
+	}
+
+	S = &steps[*count];
+	S->action = F->action;
+	S->arg1 = arg1;
+	S->arg2 = arg2;
+	return (*count) ++;
+}
+
+/* Several partial sums (products) are independent, so that they can be calculated in parallel */
+static double _reduce(int action, const double *a, const double *b, int n)
+{
+	double r[4];
+	int k, j;
+
+	for(j = 0; j < 4; j ++)
+		r[j] = action == F_SUM ? 0 : 1;
+
+	if(b) /* sum of a[k] * b[k] */
+		for(k = 0; k + 4 <= n; k += 4)
+			for(j = 0; j < 4; j ++)
+				r[j] += a[k + j] * b[k + j];
+	else if(action == F_SUM)
+		for(k = 0; k + 4 <= n; k += 4)
+			for(j = 0; j < 4; j ++)
+				r[j] += a[k + j];
+	else
+		for(k = 0; k + 4 <= n; k += 4)
+			for(j = 0; j < 4; j ++)
+				r[j] *= a[k + j];
+
+	for(; k < n; k ++)
+	{
+		if(b) r[0] += a[k] * b[k];
+		else if(action == F_SUM) r[0] += a[k];
+		else r[0] *= a[k];
+	}
+
+	return action == F_SUM ? (r[0] + r[1]) + (r[2] + r[3]) : (r[0] * r[1]) * (r[2] * r[3]);
+}
+
+double _sum_eval(formula F, const double *args)
+{
+	struct _step stack_steps[SUM_STACK_STEPS], *steps = stack_steps;
+	double stack_buf[SUM_STACK_STEPS * SUM_CHUNK], *buf = stack_buf;
+	int from = (int) _get_const(F->arg2), to = (int) _get_const(F->other_args->arg[0]);
+	int count = 0, i, start, k;
+	double result = F->action == F_SUM ? 0 : 1;
+
+	int max_steps = _steps_count(F->arg1);
+	if(max_steps > SUM_STACK_STEPS)
+	{
+		steps = malloc(sizeof(struct _step) * max_steps);
+		buf = malloc(sizeof(double) * SUM_CHUNK * max_steps);
+		if(!steps || !buf)
+		{
+			free(steps);
+			free(buf);
+			return NAN;
+		}
+	}
+
+	int root = _compile(steps, &count, F->arg1, args, from);
+	struct _step *R = &steps[root];
+
+	if(R->action == F_CONST)
+	{ /* e.g. sum(i = 1..n, 2) */
+		double v = R->value;
+		for(i = from; i <= to; i ++)
+			result = F->action == F_SUM ? result + v : result * v;
+		goto done;
+	}
+
+	for(i = 0; i < count; i ++)
+	{
+		steps[i].buf = buf + i * SUM_CHUNK;
+		if(steps[i].action == F_CONST)
+		{
+			for(k = 0; k < SUM_CHUNK; k ++)
+				steps[i].buf[k] = steps[i].value;
+			steps[i].out = steps[i].buf;
+		}
+	}
+
+	/* Sum of products (e.g. W[i] * X[i]) doesn't need the buffer with the products */
+	int dot = F->action == F_SUM && R->action == F_MUL;
+
+	for(start = 0; start <= to - from; start += SUM_CHUNK)
+	{
+		int n = to - from + 1 - start;
+		if(n > SUM_CHUNK) n = SUM_CHUNK;
+
+		for(i = 0; i < count; i ++)
+		{
+			struct _step *S = &steps[i];
+			if(S->action == F_ELEMENT)
+				S->out = S->element + start;
+			else if(S->action != F_CONST && !(dot && S == R))
+			{
+				_vec_calc(S->action, steps[S->arg1].out, S->arg2 == -1 ? NULL : steps[S->arg2].out, S->buf, n, FORMULA_EXACT);
+				S->out = S->buf;
+			}
+		}
+
+		if(dot)
+			result += _reduce(F_SUM, steps[R->arg1].out, steps[R->arg2].out, n);
+		else if(F->action == F_SUM)
+			result += _reduce(F_SUM, R->out, NULL, n);
+		else
+			result *= _reduce(F_PROD, R->out, NULL, n);
+	}
+
+done:
+	if(steps != stack_steps)
+	{
+		free(steps);
+		free(buf);
+	}
+	return result;
+}
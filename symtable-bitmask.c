@@ -45,10 +45,12 @@ typedef unsigned long INTTYPE;
 struct _symtable
 {
 	INTTYPE mask : BITS;
+	int refs; /* number of owners, see symtable_ref() */
 };
 
 char *symerror = NULL;
 const char *symtable_method = "bitmask";
+const int symtable_max_vars = 26;
 
 #define ERROR(msg) { symerror = msg; return 0; }
 const INTTYPE FULLMASK = (INTTYPE) -1;
@@ -81,7 +83,10 @@ symtable symtable_new()
 	if(!t)
 		symerror = "malloc() failed in symtable_new()";
 	else
+	{
 		t->mask = 0;
+		t->refs = 1;
+	}
 
 	return t;
 }
@@ -91,7 +96,10 @@ symtable symtable_new_mpool(mpool pool)
 	if(!t)
 		symerror = "malloc() failed in symtable_new()";
 	else
+	{
 		t->mask = 0;
+		t->refs = 1;
+	}
 
 	return t;
 }
@@ -123,10 +131,21 @@ __attribute__((fastcall)) void symtable_import(symtable t, symtable child)
 symtable symtable_clone(const symtable t)
 {
 	symtable copy = symtable_new();
-	symtable_import(copy, t);
+	if(copy) symtable_import(copy, t);
 	return copy;
 }
 
+symtable symtable_ref(symtable t)
+{
+	__sync_add_and_fetch(&t->refs, 1);
+	return t;
+}
+
+int symtable_shared(symtable t)
+{
+	return __sync_add_and_fetch(&t->refs, 0) > 1;
+}
+
 __attribute__((fastcall))  void symtable_del(symtable t, const char *ID)
 {
 	struct _symtable mask_holder = construct_mask(TO_UPPERCASE(ID[0]));
@@ -192,6 +211,81 @@ __attribute__((fastcall)) int symtable_order_raw(symtable t, const char *ID)
 	return order;
 }
 
+__attribute__((fastcall)) int symtable_orders(symtable t, symtable sub, int *orders)
+{
+	int pos = 0, order = 0, count = 0;
+	INTTYPE key = 1;
+
+	for(pos = 0; pos < BITS && key <= t->mask; pos ++, key <<= 1)
+	{
+		if(sub->mask & key)
+			orders[count ++] = order;
+
+		if(t->mask & key)
+			order ++;
+	}
+	return count;
+}
+
+/*
+	Identifier of the variable is its letter (uppercase if not CASE_SENSITIVE).
+*/
+int symtable_id(const char *ID)
+{
+	if(CHAR_OUT_OF_RANGE(ID[0]) || ID[1] != '\0')
+	{
+		symerror = "(bitmask)symtable.c: identifier is not a single latin letter (A-Z): symtable_id() failed";
+		return -1;
+	}
+	return TO_UPPERCASE(ID[0]);
+}
+
+int symtable_array(const char *ID, int size)
+{
+	if(CHAR_OUT_OF_RANGE(ID[0]) || size < 1)
+		symerror = "(bitmask)symtable.c: invalid array: symtable_array() failed";
+	else
+		symerror = "(bitmask)symtable.c: arrays are not supported (use 'hash' symtable): symtable_array() failed";
+	return -1;
+}
+
+const char *symtable_name(int id)
+{
+	static const char names[] = "A\0B\0C\0D\0E\0F\0G\0H\0I\0J\0K\0L\0M\0N\0O\0P\0Q\0R\0S\0T\0U\0V\0W\0X\0Y\0Z";
+	return (id < 'A' || id > 'Z') ? "?" : names + 2 * (id - 'A');
+}
+
+__attribute__((fastcall)) void symtable_add_id(symtable t, int id)
+{
+	t->mask |= construct_mask(id).mask;
+}
+
+__attribute__((fastcall)) void symtable_del_id(symtable t, int id)
+{
+	t->mask &= (FULLMASK - construct_mask(id).mask);
+}
+
+__attribute__((fastcall)) int symtable_isset_id(symtable t, int id)
+{
+	return (t->mask & construct_mask(id).mask) ? 1 : 0;
+}
+
+__attribute__((fastcall)) int symtable_order_id(symtable t, int id)
+{
+	char ID[2] = { id, '\0' };
+	return symtable_order_raw(t, ID);
+}
+
+__attribute__((fastcall)) int symtable_ids(symtable t, int *ids)
+{
+	int pos = 0, count = 0;
+	INTTYPE key = 1;
+	for(pos = 0; pos < BITS && key <= t->mask; pos ++, key <<= 1)
+		if(t->mask & key)
+			ids[count ++] = 'A' + pos;
+	return count;
+}
+
 __attribute__((fastcall)) char *symtable_varname(formula F)
 {
 	char *buf = (char *) malloc(2);
@@ -205,6 +299,7 @@ __attribute__((fastcall)) char *symtable_varname(formula F)
 
 __attribute__((fastcall)) void symtable_free(symtable t)
 {
+	if(__sync_sub_and_fetch(&t->refs, 1) > 0) return; /* still used by someone else */
 	free(t);
 }
 
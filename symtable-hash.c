@@ -0,0 +1,654 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include "symtable.h"
+
+/*
+	This is a hashed symtable implementation.
+	It supports variables with long names (e.g. X1, X2, ..., X100 or {alpha})
+	and hundreds of variables in one formula.
+	Arrays (X[1], ..., X[n], see symtable_array()) get consecutive identifiers,
+	so their elements are consecutive arguments of eval_array().
+
+	Names are interned: each name gets a number (identifier), and the symtable
+	is a bitset of identifiers. Single letters have identifiers below 64
+	(in alphabetical order), so for them the symtable is one 64-bit word,
+	as fast as the 'bitmask' symtable.
+
+	Order of the variables (in eval() parameters) is the order of their names
+	(strcmp(), so A-Z go before a-z), whatever order they were interned in.
+	Elements of an array are ordered by index (X[2] before X[10]) and
+	follow the name of the array, so they remain consecutive.
+	Symtables with longer names keep this order in a cache (see _sorted()),
+	indexed by the rank of the identifier in the bitset (found by popcount).
+
+	NOTE: without CASE_SENSITIVE, names are converted to uppercase.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SMALL_IDS 64 /* identifiers in 'small' */
+#define LETTERS 52 /* identifiers of A-Z, a-z are 1-52 (0 is not used: F->arg1 of F_VAR node can't be NULL) */
+#define MAX_IDS 65536
+#define INTERN_SLOTS (2 * MAX_IDS) /* hash table of names (power of 2) */
+#define MAX_NAME 64
+
+const int symtable_case_sensitive =
+#ifdef CASE_SENSITIVE
+	1;
+#define TO_UPPERCASE(c) c
+#else
+	0;
+#include <ctype.h>
+#define TO_UPPERCASE(c) toupper(c)
+#endif
+
+struct _order
+{
+	int count, words; /* capacity (a spare buffer is reused for smaller symtables) */
+	int *sorted; /* identifiers in the order of variables */
+	int *order; /* order[i] is the order of the identifier with i smaller identifiers in the symtable */
+	int *below; /* below[i] is the number of identifiers before big[i] */
+};
+
+struct _symtable
+{
+	uint64_t small; /* identifiers below 64 */
+	int refs; /* number of owners, see symtable_ref() */
+	int words; /* size of 'big' */
+	uint64_t *big; /* identifier 'id' is bit (id - 64) */
+	struct _order *order; /* NULL if not calculated yet (or not needed: single letters only) */
+	struct _order *spare; /* previous 'order': its memory is reused when the set of variables is changed */
+	mpool pool; /* 'big', 'order' and the symtable itself are allocated from the pool (NULL if not) */
+};
+
+char *symerror = NULL;
+const char *symtable_method = "hash";
+const int symtable_max_vars = MAX_IDS;
+
+/*
+	Interned names. Lookups don't take the lock: the name is stored
+	before its identifier is published in _index[].
+*/
+static const char *_names[MAX_IDS];
+static int _index[INTERN_SLOTS]; /* identifier + 1, 0 if the slot is empty */
+static int _ids_count = LETTERS + 1; /* the first 11 long names also fit into 'small' */
+static pthread_mutex_t _intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Arrays: names of their elements are not in _index[] (the same name can have several sizes) */
+struct _array
+{
+	char *name;
+	int size;
+	int first; /* identifier of name[1] */
+};
+static struct _array *_arrays;
+static int _arrays_count, _arrays_capacity;
+
+/* Element X[index] of the array X[1..size] (size is 0 for other identifiers) */
+static struct
+{
+	int index, size;
+} _elements[MAX_IDS];
+
+static const char _letters[] =
+	"A\0B\0C\0D\0E\0F\0G\0H\0I\0J\0K\0L\0M\0N\0O\0P\0Q\0R\0S\0T\0U\0V\0W\0X\0Y\0Z\0"
+	"a\0b\0c\0d\0e\0f\0g\0h\0i\0j\0k\0l\0m\0n\0o\0p\0q\0r\0s\0t\0u\0v\0w\0x\0y\0z";
+
+static uint32_t _hash(const char *name)
+{ /* FNV-1a */
+	uint32_t h = 2166136261u;
+	for(; *name; name ++)
+		h = (h ^ (unsigned char) *name) * 16777619u;
+	return h;
+}
+
+static int _letter(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static int _name_char(char c)
+{
+	return _letter(c) || (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+/* Normalized name (uppercase if not CASE_SENSITIVE), 0 if it's not a valid name */
+static int _normalize(const char *ID, char *out)
+{
+	int i;
+	if(!_letter(ID[0]) && ID[0] != '_') return 0;
+	for(i = 0; ID[i]; i ++)
+	{
+		if(i == MAX_NAME - 1 || !_name_char(ID[i])) return 0;
+		out[i] = TO_UPPERCASE(ID[i]);
+	}
+	out[i] = '\0';
+	return 1;
+}
+
+/* Identifier of the normalized name, -1 if it's not interned yet */
+static int _find(const char *name, int *slot)
+{
+	if(name[1] == '\0' && _letter(name[0]))
+		return (name[0] >= 'a') ? 27 + name[0] - 'a' : 1 + name[0] - 'A';
+
+	int i = _hash(name) & (INTERN_SLOTS - 1), id;
+	while((id = __atomic_load_n(&_index[i], __ATOMIC_ACQUIRE)) != 0)
+	{
+		if(!strcmp(_names[id - 1], name)) return id - 1;
+		i = (i + 1) & (INTERN_SLOTS - 1);
+	}
+	if(slot) *slot = i;
+	return -1;
+}
+
+/* Identifier of the name (if there is such name), -1 otherwise */
+static int _lookup(const char *ID)
+{
+	char name[MAX_NAME];
+	return _normalize(ID, name) ? _find(name, NULL) : -1;
+}
+
+int symtable_id(const char *ID)
+{
+	char name[MAX_NAME];
+	int id, slot;
+
+	if(!_normalize(ID, name))
+	{
+		symerror = "(hash)symtable.c: invalid identifier: symtable_id() failed";
+		return -1;
+	}
+
+	id = _find(name, NULL);
+	if(id != -1) return id;
+
+	pthread_mutex_lock(&_intern_lock);
+	id = _find(name, &slot); /* another thread could add it */
+	if(id == -1 && _ids_count < MAX_IDS)
+	{
+		char *copy = strdup(name);
+		if(copy)
+		{
+			id = _ids_count ++;
+			_names[id] = copy;
+			__atomic_store_n(&_index[slot], id + 1, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&_intern_lock);
+
+	if(id == -1) symerror = "(hash)symtable.c: too many identifiers: symtable_id() failed";
+	return id;
+}
+
+/* Called with _intern_lock held */
+static int _new_array(const char *name, int size)
+{
+	char buf[MAX_NAME + 16];
+	int i;
+
+	if(_arrays_count == _arrays_capacity)
+	{
+		int capacity = _arrays_capacity ? 2 * _arrays_capacity : 16;
+		struct _array *arrays = realloc(_arrays, sizeof(struct _array) * capacity);
+		if(!arrays) return -1;
+		_arrays = arrays;
+		_arrays_capacity = capacity;
+	}
+
+	struct _array *A = &_arrays[_arrays_count];
+	A->name = strdup(name);
+	if(!A->name) return -1;
+	A->size = size;
+	A->first = _ids_count;
+
+	for(i = 0; i < size; i ++)
+	{
+		sprintf(buf, "%s[%i]", name, i + 1);
+		if(!(_names[A->first + i] = strdup(buf)))
+		{
+			while(i --) free((char *) _names[A->first + i]);
+			free(A->name);
+			return -1;
+		}
+		_elements[A->first + i].index = i + 1;
+		_elements[A->first + i].size = size;
+	}
+	_ids_count += size;
+	_arrays_count ++;
+	return A->first;
+}
+
+int symtable_array(const char *ID, int size)
+{
+	char name[MAX_NAME];
+	int id = -1, i;
+
+	if(!_normalize(ID, name) || size < 1)
+	{
+		symerror = "(hash)symtable.c: invalid array: symtable_array() failed";
+		return -1;
+	}
+
+	pthread_mutex_lock(&_intern_lock);
+	for(i = 0; i < _arrays_count; i ++)
+		if(_arrays[i].size == size && !strcmp(_arrays[i].name, name))
+		{
+			id = _arrays[i].first;
+			break;
+		}
+
+	if(id == -1 && size <= MAX_IDS - _ids_count)
+		id = _new_array(name, size);
+	pthread_mutex_unlock(&_intern_lock);
+
+	if(id == -1) symerror = "(hash)symtable.c: too many identifiers: symtable_array() failed";
+	return id;
+}
+
+const char *symtable_name(int id)
+{
+	if(id >= 1 && id <= LETTERS) return _letters + 2 * (id - 1);
+	if(id < 0 || id >= MAX_IDS || !_names[id]) return "?";
+	return _names[id];
+}
+
+/*
+	Order of the variables: by name, elements of arrays by size of the array and index.
+	'[' ends the name, so X[1], ..., X[10] go right after X and before X1, X_, etc.
+*/
+static int _compare(int a, int b)
+{
+	const unsigned char *p = (const unsigned char *) symtable_name(a);
+	const unsigned char *q = (const unsigned char *) symtable_name(b);
+
+	for(; *p == *q && *p && *p != '['; p ++, q ++);
+	int c1 = *p == '[' ? 0 : *p, c2 = *q == '[' ? 0 : *q;
+	if(c1 != c2) return c1 - c2;
+
+	if(_elements[a].size != _elements[b].size) return _elements[a].size - _elements[b].size;
+	return _elements[a].index - _elements[b].index;
+}
+
+static int _compare_qsort(const void *a, const void *b)
+{
+	return _compare(*(const int *) a, *(const int *) b);
+}
+
+/*
+	Bitsets.
+*/
+
+static symtable _new(mpool pool)
+{
+	symtable t = (symtable) (pool ? mpool_malloc(pool, sizeof(struct _symtable)) : malloc(sizeof(struct _symtable)));
+	if(!t)
+		symerror = "malloc() failed in symtable_new()";
+	else
+	{
+		t->small = 0;
+		t->refs = 1;
+		t->words = 0;
+		t->big = NULL;
+		t->order = NULL;
+		t->spare = NULL;
+		t->pool = pool;
+	}
+	return t;
+}
+
+symtable symtable_new()
+{
+	return _new(NULL);
+}
+symtable symtable_new_mpool(mpool pool)
+{
+	return _new(pool);
+}
+
+/* Make sure that 'big' has at least 'words' words */
+static int _grow(symtable t, int words)
+{
+	if(words <= t->words) return 1;
+
+	uint64_t *big;
+	if(t->pool)
+	{
+		big = mpool_malloc(t->pool, sizeof(uint64_t) * words);
+		if(big && t->big) memcpy(big, t->big, sizeof(uint64_t) * t->words);
+	}
+	else big = realloc(t->big, sizeof(uint64_t) * words);
+
+	if(!big)
+	{
+		symerror = "malloc() failed in symtable_add()";
+		return 0;
+	}
+	memset(big + t->words, 0, sizeof(uint64_t) * (words - t->words));
+	t->big = big;
+	t->words = words;
+	return 1;
+}
+
+/*
+	The set of variables is changed: the order must be calculated again.
+	The old buffer is kept for the next _sorted(): eval() of integrals adds and deletes
+	the variable of integration each time, and pools can't free memory.
+*/
+static void _changed(symtable t)
+{
+	struct _order *O = t->order;
+	if(!O) return;
+	t->order = NULL;
+
+	if(t->spare && t->spare->count >= O->count && t->spare->words >= O->words)
+	{ /* the spare buffer is larger */
+		struct _order *t1 = O;
+		O = t->spare;
+		t->spare = t1;
+	}
+	if(!t->pool) free(t->spare);
+	t->spare = O;
+}
+
+__attribute__((fastcall)) void symtable_clear(symtable t)
+{
+	_changed(t);
+	t->small = 0;
+	if(t->words) memset(t->big, 0, sizeof(uint64_t) * t->words);
+}
+
+static int _add(symtable t, int id)
+{
+	if(symtable_isset_id(t, id)) return 1;
+	_changed(t);
+
+	if(id < SMALL_IDS)
+	{
+		t->small |= (uint64_t) 1 << id;
+		return 1;
+	}
+
+	id -= SMALL_IDS;
+	if(!_grow(t, id / 64 + 1)) return 0;
+	t->big[id / 64] |= (uint64_t) 1 << (id % 64);
+	return 1;
+}
+
+__attribute__((fastcall)) int symtable_add(symtable t, const char *ID)
+{
+	if(!t) { symerror = "symtable_add() called on undefined symtable"; return 0; }
+	if(!ID) { symerror = "symtable_add() called with undefined ID"; return 0; }
+
+	int id = symtable_id(ID);
+	return id != -1 && _add(t, id);
+}
+
+__attribute__((fastcall)) void symtable_add_id(symtable t, int id)
+{
+	_add(t, id);
+}
+
+__attribute__((fastcall)) void symtable_import(symtable t, symtable child)
+{
+	int i;
+	if(!symtable_count(child)) return;
+
+	_changed(t);
+	t->small |= child->small;
+	if(child->words && _grow(t, child->words))
+		for(i = 0; i < child->words; i ++)
+			t->big[i] |= child->big[i];
+}
+
+symtable symtable_clone(const symtable t)
+{
+	symtable copy = symtable_new();
+	if(copy) symtable_import(copy, t);
+	return copy;
+}
+
+symtable symtable_ref(symtable t)
+{
+	__sync_add_and_fetch(&t->refs, 1);
+	return t;
+}
+
+int symtable_shared(symtable t)
+{
+	return __sync_add_and_fetch(&t->refs, 0) > 1;
+}
+
+__attribute__((fastcall)) void symtable_del_id(symtable t, int id)
+{
+	if(!symtable_isset_id(t, id)) return;
+	_changed(t);
+
+	if(id < SMALL_IDS)
+		t->small &= ~((uint64_t) 1 << id);
+	else if((id - SMALL_IDS) / 64 < t->words)
+		t->big[(id - SMALL_IDS) / 64] &= ~((uint64_t) 1 << ((id - SMALL_IDS) % 64));
+}
+
+__attribute__((fastcall)) void symtable_del(symtable t, const char *ID)
+{
+	int id = _lookup(ID);
+	if(id != -1) symtable_del_id(t, id);
+}
+
+__attribute__((fastcall)) int symtable_isset_id(symtable t, int id)
+{
+	if(id < SMALL_IDS)
+		return (t->small >> id) & 1;
+
+	id -= SMALL_IDS;
+	return id / 64 < t->words && ((t->big[id / 64] >> (id % 64)) & 1);
+}
+
+__attribute__((fastcall)) int symtable_isset(symtable t, const char *ID)
+{
+	int id = _lookup(ID);
+	return id != -1 && symtable_isset_id(t, id);
+}
+
+__attribute__((fastcall)) int symtable_count(symtable t)
+{
+	int count = __builtin_popcountll(t->small), i;
+	for(i = 0; i < t->words; i ++)
+		count += __builtin_popcountll(t->big[i]);
+	return count;
+}
+
+/* Identifiers in ascending order, returns their number */
+static int _bits(symtable t, int *ids)
+{
+	int count = 0, i;
+	uint64_t w;
+
+	for(w = t->small; w; w &= w - 1)
+		ids[count ++] = __builtin_ctzll(w);
+	for(i = 0; i < t->words; i ++)
+		for(w = t->big[i]; w; w &= w - 1)
+			ids[count ++] = SMALL_IDS + 64 * i + __builtin_ctzll(w);
+	return count;
+}
+
+/* Number of identifiers of t which are smaller than 'id' */
+static inline int _rank(symtable t, const struct _order *O, int id)
+{
+	if(id < SMALL_IDS)
+		return __builtin_popcountll(t->small & (((uint64_t) 1 << id) - 1));
+
+	id -= SMALL_IDS;
+	return O->below[id / 64] + __builtin_popcountll(t->big[id / 64] & (((uint64_t) 1 << (id % 64)) - 1));
+}
+
+/* No longer names: the order of identifiers is the order of names */
+static int _letters_only(symtable t)
+{
+	int i;
+	if(t->small >> (LETTERS + 1)) return 0;
+	for(i = 0; i < t->words; i ++)
+		if(t->big[i]) return 0;
+	return 1;
+}
+
+/*
+	The order of the variables (NULL if there is no memory).
+	Symtables can be shared between threads (F->args of formula_clone()s),
+	so the calculated order is published atomically.
+*/
+static struct _order *_sorted(symtable t)
+{
+	struct _order *O = __atomic_load_n(&t->order, __ATOMIC_ACQUIRE);
+	if(O) return O;
+
+	int count = symtable_count(t), k, i;
+	O = __atomic_exchange_n(&t->spare, NULL, __ATOMIC_ACQ_REL);
+	if(O && (O->count < count || O->words < t->words))
+	{
+		if(!t->pool) free(O);
+		O = NULL;
+	}
+	if(!O)
+	{
+		size_t size = sizeof(struct _order) + sizeof(int) * (2 * count + t->words);
+		O = t->pool ? mpool_malloc(t->pool, size) : malloc(size);
+		if(!O) return NULL;
+
+		O->count = count;
+		O->words = t->words;
+		O->sorted = (int *) (O + 1);
+		O->order = O->sorted + count;
+		O->below = O->order + count;
+	}
+
+	/* Rank of an identifier among the identifiers of t is found by popcount (see _rank()) */
+	k = __builtin_popcountll(t->small);
+	for(i = 0; i < t->words; i ++)
+	{
+		O->below[i] = k;
+		k += __builtin_popcountll(t->big[i]);
+	}
+
+	_bits(t, O->sorted);
+	qsort(O->sorted, count, sizeof(int), _compare_qsort);
+	for(k = 0; k < count; k ++)
+		O->order[_rank(t, O, O->sorted[k])] = k;
+
+	struct _order *expected = NULL;
+	if(!__atomic_compare_exchange_n(&t->order, &expected, O, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{ /* calculated by another thread */
+		if(!t->pool) free(O);
+		O = expected;
+	}
+	return O;
+}
+
+/* Number of variables which go before 'id' (it doesn't have to be in t) */
+__attribute__((fastcall)) int symtable_order_id(symtable t, int id)
+{
+	if(id <= LETTERS && _letters_only(t))
+		return __builtin_popcountll(t->small & (((uint64_t) 1 << id) - 1));
+
+	struct _order *O;
+	if(symtable_isset_id(t, id) && (O = _sorted(t)))
+		return O->order[_rank(t, O, id)];
+
+	/* Not in t (e.g. a variable of integration, before it's added to F->args) */
+	int order = 0, i;
+	uint64_t w;
+	for(w = t->small; w; w &= w - 1)
+		if(_compare(__builtin_ctzll(w), id) < 0) order ++;
+	for(i = 0; i < t->words; i ++)
+		for(w = t->big[i]; w; w &= w - 1)
+			if(_compare(SMALL_IDS + 64 * i + __builtin_ctzll(w), id) < 0) order ++;
+	return order;
+}
+
+/* NOTE: it checks F->args, not F->vars! */
+__attribute__((fastcall)) int symtable_order(formula F)
+{
+	return symtable_order_id(F->args, (int) (long) F->arg1);
+}
+
+__attribute__((fastcall)) int symtable_order_raw(symtable t, const char *ID)
+{
+	int id = _lookup(ID);
+	return id == -1 ? symtable_count(t) : symtable_order_id(t, id);
+}
+
+__attribute__((fastcall)) int symtable_ids(symtable t, int *ids)
+{
+	int count = _bits(t, ids);
+	if(_letters_only(t)) return count;
+
+	struct _order *O = _sorted(t);
+	if(O)
+		memcpy(ids, O->sorted, sizeof(int) * count);
+	else
+		qsort(ids, count, sizeof(int), _compare_qsort);
+	return count;
+}
+
+__attribute__((fastcall)) int symtable_orders(symtable t, symtable sub, int *orders)
+{
+	int count = symtable_ids(sub, orders), i;
+	for(i = 0; i < count; i ++)
+		orders[i] = symtable_order_id(t, orders[i]);
+	return count;
+}
+
+__attribute__((fastcall)) char *symtable_varname(formula F)
+{
+	return strdup(symtable_name((int) (long) F->arg1));
+}
+
+__attribute__((fastcall)) void symtable_free(symtable t)
+{
+	if(__sync_sub_and_fetch(&t->refs, 1) > 0) return; /* still used by someone else */
+	if(t->pool) return; /* freed by mpool_free() */
+	free(t->order);
+	free(t->spare);
+	free(t->big);
+	free(t);
+}
+
+__attribute__((fastcall)) char *symtable_print(symtable t)
+{
+	int count = symtable_count(t), i;
+	int *ids = malloc(sizeof(int) * (count + 1));
+	if(!ids) return NULL;
+	symtable_ids(t, ids);
+
+	size_t length = 1;
+	for(i = 0; i < count; i ++)
+		length += strlen(symtable_name(ids[i])) + 1;
+
+	char *symbols = malloc(length), *p = symbols;
+	if(symbols)
+	{
+		*p = '\0';
+		for(i = 0; i < count; i ++)
+			p += sprintf(p, i ? ",%s" : "%s", symtable_name(ids[i]));
+	}
+	free(ids);
+	return symbols;
+}
@@ -38,12 +38,19 @@ typedef struct _symtable *symtable;
 extern char *symerror; /* Last error occured (or NULL if there's no error) */
 extern const char *symtable_method; /* 'bitmask' for "best memory-preserving" method */
 extern const int symtable_case_sensitive;
+extern const int symtable_max_vars; /* maximum number of variables in one symtable */
 
 /* Allocate a new symtable */
 symtable symtable_new() __attribute__((malloc warn_unused_result)); /* must symtable_free() it */
 symtable symtable_new_mpool(mpool pool) __attribute__((warn_unused_result)); /* don't free, just delete it's mpool */
 symtable symtable_clone(const symtable t) __attribute__((malloc nonnull warn_unused_result));
 
+/* Add one more owner of the symtable (symtable_free() is needed once per owner), returns t */
+symtable symtable_ref(symtable t) __attribute__((nonnull));
+
+/* Check whether the symtable has more than one owner */
+int symtable_shared(symtable t) __attribute__((nonnull warn_unused_result));
+
 /* Clear a symtable */
 void symtable_clear(symtable t) __attribute__((fastcall nonnull));
 
@@ -61,6 +68,36 @@ int symtable_order(formula F) __attribute__((fastcall nonnull const warn_unused_
 
 int symtable_order_raw(symtable t, const char *ID) __attribute__((fastcall nonnull const warn_unused_result));
 
+/* Fill 'orders' with the order in 't' of every variable from 'sub', returns the number of variables in 'sub' */
+int symtable_orders(symtable t, symtable sub, int *orders) __attribute__((fastcall nonnull));
+
+/*
+	Identifiers: every variable name has a number, which is kept in F->arg1 of F_VAR nodes.
+	Functions with identifiers are faster than the same functions with names.
+*/
+
+/* Return the identifier of the variable name (-1 if it's not a valid name, symerror is being updated) */
+int symtable_id(const char *ID) __attribute__((nonnull warn_unused_result));
+
+/*
+	Return the identifier of ID[1], the first element of the array ID[1..size] (-1 on error).
+	Elements have consecutive identifiers (ID[k] is the first one plus k - 1).
+	Arrays with the same name and different sizes are different arrays.
+*/
+int symtable_array(const char *ID, int size) __attribute__((nonnull warn_unused_result));
+
+/* Return the name of the variable by its identifier (this memory must not be freed) */
+const char *symtable_name(int id) __attribute__((warn_unused_result));
+
+/* Same as symtable_add(), symtable_del(), symtable_isset() and symtable_order_raw(), but with identifiers */
+void symtable_add_id(symtable t, int id) __attribute__((fastcall nonnull));
+void symtable_del_id(symtable t, int id) __attribute__((fastcall nonnull));
+int symtable_isset_id(symtable t, int id) __attribute__((fastcall nonnull warn_unused_result));
+int symtable_order_id(symtable t, int id) __attribute__((fastcall nonnull warn_unused_result));
+
+/* Fill 'ids' with identifiers of all variables (in order), returns the number of variables */
+int symtable_ids(symtable t, int *ids) __attribute__((fastcall nonnull));
+
 /* Return the variable name F->arg1 from F->vars symtable (caller must free() this memory) */
 char *symtable_varname(formula F) __attribute__((fastcall nonnull const warn_unused_result));
 
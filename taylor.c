@@ -0,0 +1,446 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "taylor.h"
+#include "formula_internal.h"
+
+/*
+	Truncated Taylor series arithmetic.
+
+	Series 'a' of length n means a[0] + a[1]*t + ... + a[n-1]*t^(n-1).
+	All recurrences below are the usual ones for automatic differentiation
+	(e.g. for c = exp(a) we have c' = a' * c, which gives c[k] via a[1..k]).
+*/
+
+static void _series_mul(const double *a, const double *b, int n, double *c)
+{
+	int k, j;
+	for(k = 0; k < n; k ++)
+	{
+		double s = 0;
+		for(j = 0; j <= k; j ++)
+			s += a[j] * b[k - j];
+		c[k] = s;
+	}
+}
+
+static int _series_div(const double *a, const double *b, int n, double *c)
+{
+	int k, j;
+	if(!b[0]) return 0; /* as in _calc(): division by zero is undefined */
+
+	for(k = 0; k < n; k ++)
+	{
+		double s = a[k];
+		for(j = 1; j <= k; j ++)
+			s -= b[j] * c[k - j];
+		c[k] = s / b[0];
+	}
+	return 1;
+}
+
+static void _series_exp(const double *a, int n, double *c)
+{
+	int k, j;
+	c[0] = exp(a[0]);
+	for(k = 1; k < n; k ++)
+	{
+		double s = 0;
+		for(j = 1; j <= k; j ++)
+			s += j * a[j] * c[k - j];
+		c[k] = s / k;
+	}
+}
+
+static int _series_ln(const double *a, int n, double *c)
+{
+	int k, j;
+	if(a[0] <= 0) return 0;
+
+	c[0] = log(a[0]);
+	for(k = 1; k < n; k ++)
+	{
+		double s = 0;
+		for(j = 1; j < k; j ++)
+			s += j * c[j] * a[k - j];
+		c[k] = (a[k] - s / k) / a[0];
+	}
+	return 1;
+}
+
+static void _series_sincos(const double *a, int n, double *s, double *c)
+{
+	int k, j;
+	s[0] = sin(a[0]);
+	c[0] = cos(a[0]);
+	for(k = 1; k < n; k ++)
+	{
+		double ss = 0, cc = 0;
+		for(j = 1; j <= k; j ++)
+		{
+			ss += j * a[j] * c[k - j];
+			cc += j * a[j] * s[k - j];
+		}
+		s[k] = ss / k;
+		c[k] = - cc / k;
+	}
+}
+
+/* c = a^p, where p is a constant */
+static int _series_pow_const(const double *a, double p, int n, double *c)
+{
+	int k, j;
+	if(!a[0])
+	{
+		/* Recurrence needs a[0] != 0, but small natural powers are just products */
+		if(p != floor(p) || p < 0 || p > 64) return 0;
+
+		double *t = malloc(sizeof(double) * n);
+		if(!t) return 0;
+
+		memset(c, 0, sizeof(double) * n);
+		c[0] = 1;
+		for(k = 0; k < p; k ++)
+		{
+			_series_mul(c, a, n, t);
+			memcpy(c, t, sizeof(double) * n);
+		}
+		free(t);
+		return 1;
+	}
+
+	c[0] = pow(a[0], p);
+	for(k = 1; k < n; k ++)
+	{
+		double s = 0;
+		for(j = 0; j < k; j ++)
+			s += (p * (k - j) - j) * a[k - j] * c[j];
+		c[k] = s / (k * a[0]);
+	}
+	return 1;
+}
+
+/* u' = a' * g, u[0] is given: used for inverse trigonometric functions */
+static void _series_integrate_product(const double *a, const double *g, int n, double *u)
+{
+	int k, j;
+	for(k = 1; k < n; k ++)
+	{
+		double s = 0;
+		for(j = 1; j <= k; j ++)
+			s += j * a[j] * g[k - j];
+		u[k] = s / k;
+	}
+}
+
+static int _series(const formula F, const double *const *args, int n, double *out)
+{
+	double *p1, *p2, *t;
+	int i, ok = 1;
+
+	if(F->action == F_CONST)
+	{
+		memset(out, 0, sizeof(double) * n);
+		out[0] = _get_const(F);
+		return 1;
+	}
+	if(F->action == F_VAR)
+	{
+		memcpy(out, args[symtable_order(F)], sizeof(double) * n);
+		return 1;
+	}
+	if(F->action == F_INTEGRAL || F->action == F_DERIVATIVE || F->action == F_CUBATURE
+		|| F->action == F_SUM || F->action == F_PROD || F->action == F_ELEMENT)
+			return 0; /* Not supported: these are calculated numerically */
+	if(F->action == F_HOISTED || F->action == F_MEMO || F->action == F_CUMULATIVE || F->action == F_APPROX
+		|| F->action == F_POLY)
+		return _series(F->arg1, args, n, out);
+
+	p1 = malloc(sizeof(double) * n * 3);
+	if(!p1) return 0;
+	p2 = p1 + n;
+	t = p2 + n;
+
+	if(!_series(F->arg1, args, n, p1) || (F->arg2 && !_series(F->arg2, args, n, p2)))
+	{
+		free(p1);
+		return 0;
+	}
+
+	switch(F->action)
+	{
+		case F_NOT:
+			for(i = 0; i < n; i ++) out[i] = -p1[i];
+			break;
+		case F_ADD:
+			for(i = 0; i < n; i ++) out[i] = p1[i] + p2[i];
+			break;
+		case F_SUB:
+			for(i = 0; i < n; i ++) out[i] = p1[i] - p2[i];
+			break;
+		case F_MUL:
+			_series_mul(p1, p2, n, out);
+			break;
+		case F_DIV:
+			ok = _series_div(p1, p2, n, out);
+			break;
+		case F_POW:
+			for(i = 1; i < n && !p2[i]; i ++);
+			if(i == n)
+				ok = _series_pow_const(p1, p2[0], n, out);
+			else
+			{ /* a^b = exp(b * ln(a)) */
+				ok = _series_ln(p1, n, t);
+				if(ok)
+				{
+					_series_mul(p2, t, n, p1);
+					_series_exp(p1, n, out);
+				}
+			}
+			break;
+		case F_EXP:
+			_series_exp(p1, n, out);
+			break;
+		case F_LN:
+			ok = _series_ln(p1, n, out);
+			break;
+		case F_LG:
+		case F_LOG2:
+			ok = _series_ln(p1, n, out);
+			for(i = 0; i < n; i ++)
+				out[i] /= (F->action == F_LG ? log(10) : log(2));
+			break;
+		case F_SIN:
+			_series_sincos(p1, n, out, t);
+			break;
+		case F_COS:
+			_series_sincos(p1, n, t, out);
+			break;
+		case F_TAN:
+			_series_sincos(p1, n, p2, t);
+			ok = _series_div(p2, t, n, out);
+			break;
+		case F_CTG:
+			_series_sincos(p1, n, p2, t);
+			ok = p2[0] ? _series_div(t, p2, n, out) : 0;
+			break;
+		case F_D2R:
+			for(i = 0; i < n; i ++) out[i] = p1[i] * 3.14 / 180; /* the same constant as in _calc() */
+			break;
+		case F_ASIN:
+		case F_ACOS:
+			/* asin(a)' = a' / sqrt(1 - a^2) */
+			_series_mul(p1, p1, n, t);
+			for(i = 0; i < n; i ++) t[i] = -t[i];
+			t[0] += 1;
+			ok = _series_pow_const(t, -0.5, n, p2);
+			if(ok)
+			{
+				_series_integrate_product(p1, p2, n, out);
+				out[0] = asin(p1[0]);
+				if(F->action == F_ACOS)
+				{
+					for(i = 1; i < n; i ++) out[i] = -out[i];
+					out[0] = acos(p1[0]);
+				}
+			}
+			break;
+		case F_ATAN:
+			/* atan(a)' = a' / (1 + a^2) */
+			_series_mul(p1, p1, n, t);
+			t[0] += 1;
+			memset(p2, 0, sizeof(double) * n);
+			p2[0] = 1;
+			ok = _series_div(p2, t, n, out);
+			if(ok)
+			{
+				memcpy(p2, out, sizeof(double) * n);
+				_series_integrate_product(p1, p2, n, out);
+				out[0] = atan(p1[0]);
+			}
+			break;
+		case F_ABS:
+			/* Sign is determined by the first non-zero coefficient */
+			for(i = 0; i < n && !p1[i]; i ++);
+			for(i = (i < n && p1[i] < 0) ? 0 : n; i < n; i ++) p1[i] = -p1[i];
+			memcpy(out, p1, sizeof(double) * n);
+			break;
+		default:
+			ok = 0;
+	}
+	free(p1);
+
+	for(i = 0; ok && i < n; i ++)
+		if(isnanl(out[i])) ok = 0;
+	return ok;
+}
+
+int taylor_series(const formula F, const double *const *args, int n, double *out)
+{
+	if(!F || n < 1) return 0;
+	return _series(F, args, n, out);
+}
+
+/*
+	Taylor series method.
+
+	In point (x, y) we find Y(x + t) = y[0] + y[1]*t + ... + y[p]*t^p.
+	Since Y' = F(X, Y), coefficient y[k + 1] equals F[k] / (k + 1), and F[k]
+	only depends on y[0..k], so the coefficients are found one by one.
+*/
+static int _taylor_step(const formula F, double x, double y, int order, double *ycoef, double *work)
+{
+	double *xs = work, *f = work + order + 1;
+	const double *args[2];
+	int k;
+
+	memset(xs, 0, sizeof(double) * (order + 1));
+	memset(ycoef, 0, sizeof(double) * (order + 1));
+	xs[0] = x;
+	xs[1] = 1;
+	ycoef[0] = y;
+
+	args[0] = xs;
+	args[1] = ycoef;
+	for(k = 0; k < order; k ++)
+	{
+		if(!_series(F, args, k + 1, f))
+			return 0;
+		ycoef[k + 1] = f[k] / (k + 1);
+	}
+	return 1;
+}
+
+static double _horner(const double *c, int order, double t)
+{
+	double v = c[order];
+	int k;
+	for(k = order - 1; k >= 0; k --)
+		v = v * t + c[k];
+	return v;
+}
+
+const int TAYLOR_MAX_STEPS = 100000;
+taylor_solution taylor_solve(const formula F, double X0, double Y0, double X1, double tolerance)
+{
+	if(!F || formula_args(F) != 2 || !(tolerance > 0)) return NULL;
+
+	/* Order for the given tolerance, see Jorba & Zou (2005) */
+	int order = ceil(-log(tolerance) / 2) + 1;
+	if(order < 4) order = 4;
+	if(order > 30) order = 30;
+
+	taylor_solution S = calloc(1, sizeof(struct _taylor_solution));
+	if(!S) return NULL;
+	S->order = order;
+
+	int allocated = 0;
+	double *work = malloc(sizeof(double) * (order + 1) * 2);
+	double x = X0, y = Y0;
+	double dir = X1 >= X0 ? 1 : -1;
+
+	while(work && S->count < TAYLOR_MAX_STEPS)
+	{
+		if(S->count == allocated)
+		{
+			allocated = allocated ? allocated * 2 : 16;
+			double *nx = realloc(S->x, sizeof(double) * allocated);
+			if(nx) S->x = nx;
+			double *nh = realloc(S->h, sizeof(double) * allocated);
+			if(nh) S->h = nh;
+			double *nc = realloc(S->coef, sizeof(double) * allocated * (order + 1));
+			if(nc) S->coef = nc;
+			if(!nx || !nh || !nc) break;
+		}
+
+		double *c = S->coef + S->count * (order + 1);
+		if(!_taylor_step(F, x, y, order, c, work))
+			break;
+
+		/*
+			Step size: the last two terms of the series must be
+			smaller than the tolerance (relative for large Y).
+		*/
+		double tol = tolerance * (fabs(y) > 1 ? fabs(y) : 1);
+		double h = INFINITY;
+		int k;
+		for(k = order - 1; k <= order; k ++)
+			if(c[k])
+			{
+				double hk = pow(tol / fabs(c[k]), 1. / k);
+				if(hk < h) h = hk;
+			}
+		h *= exp(-0.7 / (order - 1));
+
+		double rest = fabs(X1 - x);
+		int last = (h >= rest);
+		if(last) h = rest;
+
+		S->x[S->count] = x;
+		S->h[S->count] = dir * h;
+		S->count ++;
+
+		y = _horner(c, order, dir * h);
+		x = last ? X1 : x + dir * h;
+
+		if(isnanl(y)) break; /* the solution blows up before X1 */
+		if(last)
+		{
+			free(work);
+			return S;
+		}
+	}
+
+	free(work);
+	taylor_free(S);
+	return NULL;
+}
+
+double taylor_value(const taylor_solution S, double X)
+{
+	int lo = 0, hi = S->count - 1;
+	if(S->count < 1) return NAN;
+
+	double dir = S->h[0] >= 0 ? 1 : -1;
+	double first = S->x[0], last = S->x[hi] + S->h[hi];
+	if(dir * (X - first) < 0 || dir * (X - last) > 0) return NAN;
+
+	/* Binary search: the last step which starts before X */
+	while(lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if(dir * (X - S->x[mid]) >= 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return _horner(S->coef + lo * (S->order + 1), S->order, X - S->x[lo]);
+}
+
+void taylor_free(taylor_solution S)
+{
+	if(S)
+	{
+		free(S->x);
+		free(S->h);
+		free(S->coef);
+		free(S);
+	}
+}
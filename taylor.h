@@ -0,0 +1,81 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#ifndef _TAYLOR_H
+#define _TAYLOR_H
+
+#include "formula.h"
+
+/**
+	@brief Calculate Taylor coefficients of F along given argument series.
+	@param F Formula object.
+	@param args Array of formula_args(F) series, one per argument.
+		Each series is an array of \b n coefficients:
+		arg(t) = args[i][0] + args[i][1]*t + args[i][2]*t^2 + ...
+	@param n Number of coefficients to calculate.
+	@param out Array of \b n doubles, receives coefficients of F(args(t)).
+	@returns 1 on success, 0 if the series can't be calculated
+		(e.g. F contains integrals or derivatives, or the value is undefined).
+
+	@note Coefficients are exact (up to rounding), not approximated
+		by finite differences.
+*/
+int taylor_series(const formula F, const double *const *args, int n, double *out)
+	__attribute__((nonnull(1,2,4) warn_unused_result));
+
+/**
+	@brief Solution of Y' = F(X, Y), returned by taylor_solve().
+
+	The solution is a chain of local Taylor polynomials, so Y(X)
+	can be calculated in any point between X0 and X1 (dense output).
+*/
+typedef struct _taylor_solution
+{
+	int count; /* number of steps made */
+	int order; /* degree of local polynomials */
+	double *x; /* x[i] is the starting point of step i */
+	double *h; /* h[i] is the length of step i (negative if X1 < X0) */
+	double *coef; /* (order + 1) coefficients for each step */
+} *taylor_solution;
+
+/**
+	@brief Solve a differential equation
+		Y' = F(X, Y) with Y(X0) = Y0 on [X0; X1] by the Taylor series method.
+
+	@param F Formula F(X, Y) in the right part of the equation.
+	@param X0 Some value of X.
+	@param Y0 Value of Y(X) in point \b X0.
+	@param X1 Last value of X.
+	@param tolerance Needed precision of each step (e.g. 1e-12).
+	@returns Solution object, NULL if F can't be expanded into Taylor series.
+
+	@note Order of the method and step size are chosen automatically.
+	@note The solution returned must be taylor_free()d.
+*/
+taylor_solution taylor_solve(const formula F, double X0, double Y0, double X1, double tolerance)
+	__attribute__((malloc nonnull(1) warn_unused_result));
+
+/**
+	@brief Calculate Y(X) from the solution returned by taylor_solve().
+	@returns Value of Y(X), NAN if X is outside of [X0; X1].
+*/
+double taylor_value(const taylor_solution S, double X) __attribute__((nonnull));
+
+/**
+	@brief Free the solution returned by taylor_solve().
+*/
+void taylor_free(taylor_solution S);
+
+#endif
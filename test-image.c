@@ -0,0 +1,146 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "image.h"
+
+const char *app = "test-image";
+
+#define POINTS 1000
+
+/*
+	The loaded image must give the same values as eval_array()
+	in random points, both from memory and from a file.
+*/
+static const char *cases[] = {
+	"2 + 3*A",
+	"sin(A)*cos(B) + A^2/(B + 1) - ln(A + 2)*exp(0.5*B) + |A - B|*3.25 + arctg(A*B)",
+	"$[X*A]dX|A_B + 1",
+	"$[$[X*Y]dX|0_1]dY|0_A",
+	"d(X^3)/dX + A",
+	"$[exp(-X*X)]dX|0_INF + C",
+	"ln(A - 0.5) + B",
+	"7",
+	NULL
+};
+
+static int same(double a, double b)
+{
+	return a == b || (isnan(a) && isnan(b));
+}
+
+static int compare(formula F, formula_image I)
+{
+	double args[3];
+	int i, k, errors = 0;
+
+	if(formula_image_args(I) != formula_args(F))
+		return POINTS;
+
+	for(i = 0; i < POINTS; i ++)
+	{
+		for(k = 0; k < 3; k ++)
+			args[k] = (double) rand() / RAND_MAX * 4 - 1;
+		if(!same(eval_array(F, args), formula_image_eval(I, args)))
+			errors ++;
+	}
+	return errors;
+}
+
+int main()
+{
+	char filename[] = "/tmp/test-image-XXXXXX";
+	int i, fd, errors, failed = 0;
+
+	fd = mkstemp(filename);
+	if(fd == -1)
+	{
+		perror(app);
+		return 1;
+	}
+	close(fd);
+
+	srand(1);
+	for(i = 0; cases[i]; i ++)
+	{
+		formula F = parse(cases[i]);
+		if(!F)
+		{
+			printf("%s: parse error\n", cases[i]);
+			failed = 1;
+			continue;
+		}
+
+		size_t size = formula_save_memory(F, NULL, 0);
+		void *buf = malloc(size);
+		formula_image I = NULL, J = NULL;
+
+		if(buf && formula_save_memory(F, buf, size) == size)
+			I = formula_load_memory(buf, size);
+		if(formula_save(F, filename))
+			J = formula_load(filename);
+
+		errors = I ? compare(F, I) : POINTS;
+		errors += J ? compare(F, J) : POINTS;
+		printf("%-40.40s %5zu bytes, %i errors\n", cases[i], size, errors);
+		if(errors) failed = 1;
+
+		if(I) formula_image_free(I);
+		if(J) formula_image_free(J);
+
+		/* Damaged images must be rejected */
+		if(buf && size > sizeof(struct _image_header))
+		{
+			if((I = formula_load_memory(buf, size - 8)))
+			{
+				printf("FAILED: truncated image was loaded\n");
+				formula_image_free(I);
+				failed = 1;
+			}
+
+			struct _image_header *H = buf;
+			uint32_t saved_size = H->size;
+			int32_t saved_count = H->count;
+			H->size = 0;
+			H->count = 1000;
+			if((I = formula_load_memory(buf, size)))
+			{
+				printf("FAILED: image with size 0 in the header was loaded\n");
+				formula_image_free(I);
+				failed = 1;
+			}
+			H->size = saved_size;
+			H->count = saved_count;
+
+			H->magic ^= 1;
+			if((I = formula_load_memory(buf, size)))
+			{
+				printf("FAILED: image with wrong magic was loaded\n");
+				formula_image_free(I);
+				failed = 1;
+			}
+		}
+
+		free(buf);
+		formula_free(F);
+	}
+	unlink(filename);
+	return failed;
+}
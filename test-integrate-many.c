@@ -0,0 +1,77 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "integral.h"
+
+const char *app = "test-integrate-many";
+
+/* Integrals over [0; 1], compared with their exact values */
+static const struct {
+	const char *code;
+	double value;
+	int memoize;
+} cases[] = {
+	{ "X", 0.5, 0 },
+	{ "X*X", 1. / 3, 0 },
+	{ "X*X*exp(X)", M_E - 2, 0 }, /* shares X*X with the previous one */
+	{ "sin(X)", 0.45969769413186023, 0 }, /* 1 - cos(1) */
+	{ "$[X*B]dB|0_1", 0.25, 0 }, /* an integral inside is called through eval() */
+	{ "$[X*B]dB|0_1", 0.25, 1 } /* the same with formula_memoize() */
+};
+#define CASES ((int) (sizeof(cases) / sizeof(cases[0])))
+
+int main()
+{
+	formula F[CASES];
+	double out[CASES];
+	int i, rule, failed = 0;
+
+	for(i = 0; i < CASES; i ++)
+	{
+		F[i] = parse(cases[i].code);
+		if(!F[i])
+		{
+			printf("%s: parse() failed\n", cases[i].code);
+			return 1;
+		}
+		if(cases[i].memoize) formula_memoize(F[i], 64);
+	}
+
+	for(rule = QUAD_SIMPSON; rule <= QUAD_GAUSS; rule ++)
+	{
+		if(!integrate_many((const formula *) F, CASES, 0, 1, rule, rule == QUAD_GAUSS ? 16 : 1000, out))
+		{
+			printf("integrate_many() failed\n");
+			return 1;
+		}
+
+		printf("%s:\n", rule == QUAD_GAUSS ? "Gauss-Legendre, 16 nodes" : "Simpson, 1000 steps");
+		for(i = 0; i < CASES; i ++)
+		{
+			int ok = fabs(out[i] - cases[i].value) < 1e-9;
+			printf("\t%s%s = %.12lf%s\n", cases[i].code, cases[i].memoize ? " (memoized)" : "",
+				out[i], ok ? "" : " FAILED");
+			if(!ok) failed = 1;
+		}
+	}
+
+	for(i = 0; i < CASES; i ++)
+		formula_free(F[i]);
+	return failed;
+}
@@ -0,0 +1,86 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "interval.h"
+
+const char *app = "test-interval";
+
+/*
+	Values of F(A, B) in random points of the box must be in the range
+	returned by eval_interval(), and the range must be defined where F is.
+*/
+static const struct {
+	const char *code;
+	double lo[2], hi[2];
+	int undefined;
+} cases[] = {
+	{ "A*A - 2*A*B + B", { -1, 0 }, { 2, 3 }, INTERVAL_DEFINED },
+	{ "sin(A) * exp(B) / (1 + A^2)", { -4, -1 }, { 4, 1 }, INTERVAL_DEFINED },
+	{ "|A - B|^3 + arctg(A*B)", { -2, -2 }, { 2, 2 }, INTERVAL_DEFINED },
+	{ "$[X*A + B]dX|0_2", { -1, 0 }, { 1, 1 }, INTERVAL_DEFINED },
+	{ "ln(A) + B", { -1, 0 }, { 1, 1 }, INTERVAL_MAYBE_UNDEFINED },
+	{ "A / B", { 1, -1 }, { 2, 1 }, INTERVAL_MAYBE_UNDEFINED },
+	{ "ln(A) + B", { -2, 0 }, { -1, 1 }, INTERVAL_UNDEFINED },
+	{ "A^(0-1) + B", { 1, 0 }, { 2, 1 }, INTERVAL_DEFINED },
+	{ "A^(0-2) * B", { -2, -1 }, { -0.5, 1 }, INTERVAL_DEFINED },
+	{ "A^(0-3) + B", { -1, 0 }, { 2, 1 }, INTERVAL_MAYBE_UNDEFINED }
+};
+#define CASES ((int) (sizeof(cases) / sizeof(cases[0])))
+#define POINTS 10000
+
+int main()
+{
+	int i, j, failed = 0;
+	srand(1);
+
+	for(i = 0; i < CASES; i ++)
+	{
+		formula F = parse(cases[i].code);
+		if(!F || formula_args(F) != 2)
+		{
+			printf("%s: parse() failed\n", cases[i].code);
+			return 1;
+		}
+
+		interval box[2] = { { cases[i].lo[0], cases[i].hi[0], 0 }, { cases[i].lo[1], cases[i].hi[1], 0 } };
+		interval r = eval_interval(F, box);
+		printf("%s in [%g; %g] x [%g; %g]: [%g; %g], undefined = %i\n", cases[i].code,
+			box[0].lo, box[0].hi, box[1].lo, box[1].hi, r.lo, r.hi, r.undefined);
+
+		if(r.undefined != cases[i].undefined)
+		{
+			printf("FAILED: expected undefined = %i\n", cases[i].undefined);
+			failed = 1;
+		}
+
+		for(j = 0; j < POINTS; j ++)
+		{
+			double A = box[0].lo + (box[0].hi - box[0].lo) * rand() / RAND_MAX;
+			double B = box[1].lo + (box[1].hi - box[1].lo) * rand() / RAND_MAX;
+			double value = eval(F, A, B);
+			if(isnan(value) || (value >= r.lo && value <= r.hi)) continue;
+
+			printf("FAILED: F(%.17g, %.17g) = %.17g\n", A, B, value);
+			failed = 1;
+			break;
+		}
+		formula_free(F);
+	}
+	return failed;
+}
@@ -0,0 +1,109 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "library.h"
+
+const char *app = "test-library";
+
+/*
+	A library of many formulas is written to a temporary file and loaded
+	with 1 and 4 threads; each formula is compared with parse() of its text.
+*/
+#define FORMULAS 1000
+
+static void code_of(int i, char *code)
+{
+	if(i % 10 == 9)
+		sprintf(code, "$[X * A + %i]dX|0_B", i);
+	else
+		sprintf(code, "sin(A * %i.5) + B^2 / (A + %i) - |A - B| * 3.25", i, i + 1);
+}
+
+int main()
+{
+	char filename[] = "/tmp/test-library-XXXXXX", code[128], name[32];
+	int fd = mkstemp(filename), i, threads, error_line, failed = 0;
+	FILE *f = fd == -1 ? NULL : fdopen(fd, "w");
+	if(!f)
+	{
+		perror(app);
+		return 1;
+	}
+
+	fprintf(f, "# test library\n\n");
+	for(i = 0; i < FORMULAS; i ++)
+	{
+		code_of(i, code);
+		fprintf(f, "f%i = %s\n", i, code);
+	}
+	fclose(f);
+
+	for(threads = 1; threads <= 4; threads *= 4)
+	{
+		library L = library_load(filename, threads, &error_line);
+		if(!L)
+		{
+			printf("library_load() failed (line %i)\n", error_line);
+			unlink(filename);
+			return 1;
+		}
+
+		int errors = 0;
+		for(i = 0; i < FORMULAS; i ++)
+		{
+			sprintf(name, "f%i", i);
+			code_of(i, code);
+
+			formula F = library_get(L, name), G = parse(code);
+			if(!F || !G || eval(F, 0.5, 1.5) != eval(G, 0.5, 1.5))
+				errors ++;
+			if(G) formula_free(G);
+		}
+		if(library_get(L, "f"))
+			errors ++;
+
+		printf("%i threads: %i formulas, %i errors\n", threads, L->count, errors);
+		if(L->count != FORMULAS || errors) failed = 1;
+		library_free(L);
+	}
+	unlink(filename);
+
+	/* Invalid libraries: the number of the first wrong line */
+	static const struct {
+		const char *text;
+		int line;
+	} bad[] = {
+		{ "a = A+B\nb = A*\nc = 1\n", 2 },
+		{ "a = A+B\n# comment\nb = A\na = 1\n", 4 }, /* the same name twice */
+		{ "a = A+B\nb A\n", 2 }
+	};
+	for(i = 0; i < (int) (sizeof(bad) / sizeof(bad[0])); i ++)
+	{
+		library L = library_load_memory(bad[i].text, strlen(bad[i].text), 2, &error_line);
+		printf("Invalid library %i: error in line %i\n", i + 1, error_line);
+		if(L || error_line != bad[i].line)
+		{
+			printf("FAILED: expected line %i\n", bad[i].line);
+			if(L) library_free(L);
+			failed = 1;
+		}
+	}
+	return failed;
+}
@@ -0,0 +1,108 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "minNvars.h"
+
+const char *app = "test-minify";
+
+/*
+	Global minimums which are known exactly. The proven lower bound
+	must be below the minimum found, and not more than 'precision' below it.
+*/
+static const struct {
+	const char *code;
+	double lo[2], hi[2];
+	double min;
+} cases[] = {
+	{ "A^(0-1) + A", { 0.25 }, { 4 }, 2 }, /* at A = 1 */
+	{ "(A - 1)^2 + (B + 0.5)^2 + A*B", { -2, -2 }, { 2, 2 }, -13. / 12 }, /* at A = 5/3, B = -4/3 */
+	{ "$[X*X + A*A]dX|0_B + (A - 0.5)^2", { -1, 0 }, { 1, 1 }, 0 } /* at A = 0.5, B = 0 (integrals in threads) */
+};
+#define CASES ((int) (sizeof(cases) / sizeof(cases[0])))
+
+static int test(const char *code, const double *lo, const double *hi, int threads, const double *expected)
+{
+	formula F = parse(code);
+	if(!F)
+	{
+		printf("%s: parse() failed\n", code);
+		return 1;
+	}
+
+	int i, N = formula_args(F), failed = 0;
+	double *box = NULL;
+	if(!lo)
+	{ /* [-1; 1]^N */
+		box = malloc(sizeof(double) * 2 * N);
+		for(i = 0; i < N; i ++)
+		{
+			box[i] = -1;
+			box[N + i] = 1;
+		}
+		lo = box;
+		hi = box + N;
+	}
+
+	double value, lower_bound, precision = 1e-6;
+	point X = minify_global(F, lo, hi, precision, threads, &value, &lower_bound);
+	free(box);
+	if(!X)
+	{
+		printf("%s: minify_global() failed\n", code);
+		formula_free(F);
+		return 1;
+	}
+
+	printf("%s (%i threads): F = %.9lf >= %.9lf at", code, threads, value, lower_bound);
+	for(i = 0; i < N; i ++)
+		printf(" %.6lf", X[i]);
+	printf("\n");
+
+	if(!(lower_bound <= value) || value - lower_bound > precision)
+	{
+		printf("FAILED: the lower bound must be within %g below the value\n", precision);
+		failed = 1;
+	}
+	if(expected && (fabs(value - *expected) > precision || lower_bound > *expected))
+	{
+		printf("FAILED: expected %.9lf\n", *expected);
+		failed = 1;
+	}
+
+	free(X);
+	formula_free(F);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int i, failed = 0;
+
+	if(argc > 1)
+	{ /* test-minify FORMULA [THREADS]: the minimum in [-1; 1]^N */
+		return test(argv[1], NULL, NULL, argc > 2 ? atoi(argv[2]) : 4, NULL);
+	}
+
+	for(i = 0; i < CASES; i ++)
+	{
+		failed |= test(cases[i].code, cases[i].lo, cases[i].hi, 1, &cases[i].min);
+		failed |= test(cases[i].code, cases[i].lo, cases[i].hi, 4, &cases[i].min);
+	}
+	return failed;
+}
@@ -0,0 +1,128 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "parse_cache.h"
+
+const char *app = "test-parse-cache";
+
+/*
+	Several threads get formulas from a small cache (so that they are evicted
+	while other threads use them) and compare them with the results of parse().
+*/
+static const char *codes[] = {
+	"A + B", "A+B", "A * B - C", "sin(A) * cos(B)", "A^2 + B^2 + C^2",
+	"$[X * A]dX|0_1", "$[$[X * Y]dX|0_A]dY|0_B", "ln(A + 1) / (B + 2)",
+	"|A - B| + 3", "exp(0 - A * A)", "A +* B", "2 * (A + B"
+};
+#define CODES ((int) (sizeof(codes) / sizeof(codes[0])))
+#define CAPACITY 4
+#define THREADS 4
+#define ITERATIONS 5000
+
+static const double args[] = { 0.5, 1.5, 2.5 };
+static double expected[CODES];
+static int expected_args[CODES];
+
+struct worker
+{
+	parse_cache C;
+	unsigned int seed;
+	int errors;
+};
+
+static void *worker(void *arg)
+{
+	struct worker *W = (struct worker *) arg;
+	int i;
+
+	for(i = 0; i < ITERATIONS; i ++)
+	{
+		int k = rand_r(&W->seed) % CODES;
+		formula F = parse_cache_get(W->C, codes[k]);
+
+		if(!F != (expected_args[k] == -1))
+			W->errors ++;
+		else if(F)
+		{
+			if(formula_args(F) != expected_args[k] || eval_array(F, args) != expected[k])
+				W->errors ++;
+			formula_free(F);
+		}
+	}
+	return NULL;
+}
+
+int main()
+{
+	struct worker W[THREADS];
+	pthread_t tid[THREADS];
+	int i, errors = 0;
+
+	for(i = 0; i < CODES; i ++)
+	{
+		formula F = parse(codes[i]);
+		expected_args[i] = F ? formula_args(F) : -1;
+		expected[i] = F ? eval_array(F, args) : 0;
+		if(F) formula_free(F);
+	}
+
+	parse_cache C = parse_cache_new(CAPACITY);
+	if(!C)
+	{
+		perror(app);
+		return 1;
+	}
+
+	printf("%i threads, %i formulas, cache capacity %i\n", THREADS, CODES, CAPACITY);
+	for(i = 0; i < THREADS; i ++)
+	{
+		W[i].C = C;
+		W[i].seed = i + 1;
+		W[i].errors = 0;
+		if(pthread_create(&tid[i], NULL, worker, &W[i]))
+		{
+			perror(app);
+			return 1;
+		}
+	}
+	for(i = 0; i < THREADS; i ++)
+	{
+		pthread_join(tid[i], NULL);
+		errors += W[i].errors;
+	}
+
+	struct parse_cache_stats stats;
+	parse_cache_statistics(C, &stats);
+	parse_cache_free(C);
+
+	printf("hits %li, misses %li, evictions %li, %i formulas in the cache\n",
+		stats.hits, stats.misses, stats.evictions, stats.count);
+	if(stats.hits + stats.misses != THREADS * ITERATIONS || stats.count > CAPACITY)
+	{
+		printf("FAILED: wrong statistics\n");
+		return 1;
+	}
+	if(errors)
+	{
+		printf("FAILED: %i results differ from parse()\n", errors);
+		return 1;
+	}
+	printf("All results are the same as with parse().\n");
+	return 0;
+}
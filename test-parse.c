@@ -0,0 +1,73 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "formula.h"
+
+const char *app = "test-parse";
+
+/*
+	Very long formulas: "A+A+...+A" with N terms (and a constant integral
+	at the end, so that it is folded by parse()) is parsed, balanced,
+	calculated and freed. The tree is N nodes deep after parse(),
+	so this fails if any of these walks it recursively.
+*/
+int main(int argc, char **argv)
+{
+	int i, N = argc > 1 ? atoi(argv[1]) : 1000000;
+	if(N < 1)
+	{
+		printf("Usage: %s [NUMBER_OF_TERMS]\n", app);
+		return 1;
+	}
+
+	const char *tail = "$[2*X]dX|0_1";
+	char *code = malloc(2 * N + strlen(tail) + 1), *p = code;
+	if(!code)
+	{
+		perror(app);
+		return 1;
+	}
+	for(i = 0; i < N; i ++)
+	{
+		*p ++ = 'A';
+		*p ++ = '+';
+	}
+	strcpy(p, tail);
+
+	formula F = parse(code);
+	free(code);
+	if(!F)
+	{
+		printf("parse() failed\n");
+		return 1;
+	}
+	printf("Parsed %i terms, %i argument(s)\n", N, formula_args(F));
+
+	formula_balance(F);
+	double value = eval(F, 2.), expected = 2. * N + 1;
+	printf("Result: %lf (expected %lf)\n", value, expected);
+
+	formula_free(F);
+	if(value != expected)
+	{
+		printf("FAILED\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "solve.h"
+
+const char *app = "test-solve";
+
+/*
+	solve1_batch(): X*X = A and the integral of Y from 0 to X (X*X/2) = A
+	for many values of A, the roots are known. There are no roots for A < 0.
+*/
+#define EQUATIONS 1000
+static const struct {
+	const char *code;
+	double scale; /* the root is sqrt(scale * A) */
+} cases[] = {
+	{ "X*X - A", 1 },
+	{ "$[Y]dY|0_X - A", 2 }
+};
+
+static int self_test()
+{
+	double params[EQUATIONS], roots[EQUATIONS];
+	int i, k, threads, failed = 0;
+
+	for(k = 0; k < EQUATIONS; k ++)
+		params[k] = k % 10 ? k * 0.01 : -1; /* every 10th equation has no root */
+
+	for(i = 0; i < (int) (sizeof(cases) / sizeof(cases[0])); i ++)
+	{
+		formula F = parse(cases[i].code);
+		if(!F)
+		{
+			printf("%s: parse() failed\n", cases[i].code);
+			return 1;
+		}
+
+		for(threads = 1; threads <= 4; threads *= 4)
+		{
+			int found = solve1_batch(F, "X", params, EQUATIONS, 0, 20, 1e-10, threads, roots), errors = 0;
+			for(k = 0; k < EQUATIONS; k ++)
+			{
+				double expected = params[k] < 0 ? NAN : sqrt(cases[i].scale * params[k]);
+				if(isnan(expected) ? !isnan(roots[k]) : !(fabs(roots[k] - expected) <= 1e-8))
+					errors ++;
+			}
+
+			printf("%s (%i threads): %i roots found, %i errors\n", cases[i].code, threads, found, errors);
+			if(found != EQUATIONS - EQUATIONS / 10 || errors)
+			{
+				printf("FAILED: expected %i roots\n", EQUATIONS - EQUATIONS / 10);
+				failed = 1;
+			}
+		}
+		formula_free(F);
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc == 1)
+		return self_test();
+
+	if(argc < 4)
+	{
+		printf("Usage: %s FORMULA A B [TOLERANCE]\n", app);
+		return 1;
+	}
+
+	const char *code = argv[1];
+	formula F = parse(code);
+	if(!F)
+	{
+		printf("parse() failed\n");
+		return 1;
+	}
+	dump(F);
+
+	int expected_args = formula_args(F);
+	if(expected_args != 1)
+	{
+		printf("The formula must expect one parameter, not these %i of yours\n", expected_args);
+		formula_free(F);
+		return 1;
+	}
+
+	double a = strtold(argv[2], NULL), b = strtold(argv[3], NULL);
+	double tolerance = argc > 4 ? strtold(argv[4], NULL) : 1e-12;
+
+	solve_debug = 1;
+	double X = solve1(F, a, b, tolerance);
+	printf("F(%.15lf) = %le\n", X, eval(F, X));
+
+	formula_free(F);
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "symtable.h"
+
+int main()
+{
+	int rand_number;
+	int i; symtable t;
+	char name[64];
+
+	srand(time(NULL));
+
+	rand_number = 100 + rand() % 100;
+
+	if(strcmp(symtable_method, "hash"))
+	{
+		printf("This is a test for 'hash' symtable, but '%s' symtable is compiled in.\nNo tests were run.\n", symtable_method);
+		return 0;
+	}
+
+	printf("Running symtable test: %s (%scase-sensitive)\n", symtable_method, symtable_case_sensitive ? "" : "NOT ");
+
+	t = symtable_new();
+	if(!t)
+	{
+		perror(symerror);
+		return 1;
+	}
+
+	printf("Allocated ok. Going to make %i symtable_add() calls...\n", rand_number);
+	for(i = 0; i < rand_number; i ++)
+	{
+		if(rand() % 4)
+			sprintf(name, "X%i", rand() % 500);
+		else
+			sprintf(name, "%c", 'A' + rand() % 26);
+
+		if(!symtable_add(t, name))
+		{
+			perror(symerror);
+			return 1;
+		}
+		if(symtable_name(symtable_id(name))[0] != name[0] || !symtable_isset(t, name))
+		{
+			printf("'%s' is lost after symtable_add()\n", name);
+			return 1;
+		}
+	}
+	printf("All symbols have been registered in symtable. Count = %i\n", symtable_count(t));
+
+	/* Order of variables is the order of names (whatever order they were added in) */
+	static const char *sorted[] = { "ALPHA", "B", "X", "X[2]", "X[10]", "X10", "X9", "ZETA" };
+	int count = sizeof(sorted) / sizeof(sorted[0]), first = symtable_array("X", 12);
+	symtable u = symtable_new();
+	if(first == -1 || !u)
+	{
+		perror(symerror);
+		return 1;
+	}
+	for(i = count - 1; i >= 0; i --)
+	{
+		if(sorted[i][1] == '[')
+			symtable_add_id(u, first + atoi(sorted[i] + 2) - 1);
+		else if(!symtable_add(u, sorted[i]))
+		{
+			perror(symerror);
+			return 1;
+		}
+	}
+	for(i = 0; i < count; i ++)
+	{
+		int order = sorted[i][1] == '[' ? symtable_order_id(u, first + atoi(sorted[i] + 2) - 1) : symtable_order_raw(u, sorted[i]);
+		if(order != i)
+		{
+			printf("'%s' has order %i, not %i\n", sorted[i], order, i);
+			return 1;
+		}
+	}
+	symtable_free(u);
+	printf("Order of %i variables is correct.\n", count);
+
+	printf("Now please enter variable names for manual testing.\nEmpty line = EXIT.\n");
+	while(fgets(name, sizeof(name), stdin))
+	{
+		name[strcspn(name, "\r\n")] = '\0';
+		if(!name[0])
+			break;
+
+		if(symtable_id(name) == -1)
+		{
+			printf("'%s' is not a valid name: %s\n", name, symerror);
+			continue;
+		}
+
+		if(symtable_isset(t, name))
+			printf("symtable_isset(): '%s' is set, its order is %i.\n", name, symtable_order_raw(t, name));
+		else
+			printf("symtable_isset(): '%s' is NOT set.\n", name);
+	}
+
+	printf("Exiting.\n");
+	return 0;
+}
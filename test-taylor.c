@@ -0,0 +1,113 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "taylor.h"
+
+const char *app = "test-taylor";
+
+/* Built-in cases (run without arguments) */
+static const struct {
+	const char *code;
+	double X0, Y0, X1;
+	int solvable;
+} cases[] = {
+	{ "B+0*A", 0, 1, 1, 1 }, /* Y = exp(X) */
+	{ "0-2*A*B", 0, 1, 2, 1 }, /* Y = exp(-X^2) */
+	{ "B*B+0*A", 0, 1, 2, 0 } /* Y = 1/(1-X) blows up at X = 1 */
+};
+
+static int self_test()
+{
+	int i, failed = 0;
+	for(i = 0; i < (int) (sizeof(cases) / sizeof(cases[0])); i ++)
+	{
+		formula F = parse(cases[i].code);
+		if(!F)
+		{
+			printf("%s: parse() failed\n", cases[i].code);
+			return 1;
+		}
+
+		taylor_solution S = taylor_solve(F, cases[i].X0, cases[i].Y0, cases[i].X1, 1e-12);
+		printf("%s, Y(%lf) = %lf: %s\n", cases[i].code, cases[i].X0, cases[i].Y0,
+			S ? "solved" : "no solution");
+		if(!S != !cases[i].solvable)
+		{
+			printf("FAILED: expected %s\n", cases[i].solvable ? "a solution" : "no solution");
+			failed = 1;
+		}
+
+		if(S) taylor_free(S);
+		formula_free(F);
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc == 1)
+		return self_test();
+
+	if(argc < 5)
+	{
+		printf("Usage: %s FORMULA X0 Y0 X1 [TOLERANCE]\n", app);
+		return 1;
+	}
+
+	const char *code = argv[1];
+	formula F = parse(code);
+	if(!F)
+	{
+		printf("parse() failed\n");
+		return 1;
+	}
+	dump(F);
+
+	int expected_args = formula_args(F);
+	if(expected_args != 2)
+	{
+		printf("The formula must expect two parameters, not these %i of yours\n", expected_args);
+		formula_free(F);
+		return 1;
+	}
+
+	double X0 = strtold(argv[2], NULL), Y0 = strtold(argv[3], NULL);
+	double X1 = strtold(argv[4], NULL);
+	double tolerance = argc > 5 ? strtold(argv[5], NULL) : 1e-12;
+
+	printf("Taylor series method:\n");
+	taylor_solution S = taylor_solve(F, X0, Y0, X1, tolerance);
+	if(!S)
+	{
+		printf("taylor_solve() failed\n");
+		formula_free(F);
+		return 1;
+	}
+	printf("%i steps of order %i\n", S->count, S->order);
+
+	int i;
+	for(i = 0; i <= 4; i ++)
+	{
+		double X = X0 + (X1 - X0) * i / 4;
+		printf("Y(%lf) = %.12lf\n", X, taylor_value(S, X));
+	}
+
+	taylor_free(S);
+	formula_free(F);
+	return 0;
+}
@@ -0,0 +1,426 @@
+/*
+	Formula manager - the mathematical library.
+	Copyright (C) 2010-2015 Edward Chernenko.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+
+#include "formula_internal.h"
+
+/*
+	Operations on arrays of values (sum.c, program_run_batch()).
+
+	With FORMULA_FAST and FORMULA_APPROX math functions are calculated
+	without calls to the C library: the argument is reduced to a small range
+	(Cody-Waite), then a polynomial is calculated for all values at once.
+	There are no branches in these loops, so the compiler can vectorize them
+	(SSE2, AVX2, AVX-512, depending on -march). Values outside of the range
+	(very large arguments, NAN, etc.) are calculated by the C library afterwards.
+
+	Maximum error with FORMULA_FAST (units in the last place, measured
+	against long double sinl(), cosl()/sinl(), etc. on 1.6*10^7 random arguments,
+	including ones close to multiples of pi/2 for tan and ctg):
+		exp, sin, cos: 1.2 ULP,
+		ln, atan: 1.9 ULP,
+		tan, ctg, acos: 3 ULP,
+		lg, log2, asin: 3.4 ULP,
+		pow: 3.4 ULP for integer powers from -4 to 4, the C library otherwise.
+	For comparison, ctg with FORMULA_EXACT is 1 / tan(x), up to 1.5 ULP.
+	With FORMULA_APPROX polynomials are shorter (relative error < 2.5e-8),
+	and pow(x, y) is exp(y * ln(x)) for positive x (relative error < 1e-7).
+*/
+
+#define VEC_BLOCK 128 /* values calculated at a time (buffers are on the stack) */
+#define VEC_POW_MAX 4 /* FORMULA_FAST: x^n by multiplications for |n| <= VEC_POW_MAX */
+
+#define ROUND_MAGIC 6755399441055744.0 /* 1.5 * 2^52: (x + ROUND_MAGIC) - ROUND_MAGIC is x rounded */
+
+#define LOG2E 1.44269504088896338700e+00
+#define LN2_HI 6.93147180369123816490e-01 /* ln(2) = LN2_HI + LN2_LO, k * LN2_HI is exact */
+#define LN2_LO 1.90821492927058770002e-10
+#define LOG10_2_HI 3.01029995663611771306e-01
+#define LOG10_2_LO 3.69423907715893078616e-13
+#define INV_LN10 4.34294481903251816668e-01
+#define SQRT2 1.41421356237309514547e+00
+
+#define TWO_OVER_PI 6.36619772367581382433e-01
+#define PIO2_1 1.57079632673412561417e+00 /* pi/2 = PIO2_1 + PIO2_2 + PIO2_3 + PIO2_3T (33 bits each) */
+#define PIO2_2 6.07710050630396597660e-11
+#define PIO2_3 2.02226624871116645580e-21
+#define PIO2_3T 8.47842766036889956997e-32
+#define TRIG_MAX 1e5 /* larger arguments of sin(), etc. are reduced by the C library */
+
+#define PIO2_HI 1.57079632679489655800e+00
+#define PIO2_LO 6.12323399573676603587e-17
+#define PIO4_HI 7.85398163397448278999e-01
+#define PIO4_LO 3.06161699786838301793e-17
+#define TAN_PI_8 4.14213562373095034936e-01
+
+/* Taylor series: coefficient of x^k (exp), of s^k (the others) */
+static const double _exp_c[] = { 1, 1, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040,
+	1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800.0 };
+
+/* ln(m) = 2f * (1 + s/3 + s^2/5 + ...), where f = (m-1)/(m+1), s = f^2 */
+static const double _log_c[] = { 1, 1.0 / 3, 1.0 / 5, 1.0 / 7, 1.0 / 9, 1.0 / 11, 1.0 / 13, 1.0 / 15, 1.0 / 17, 1.0 / 19 };
+
+/* sin(r) = r * (1 - s/3! + s^2/5! - ...), cos(r) = 1 - s/2! + s^2/4! - ..., s = r^2 */
+static const double _sin_c[] = { 1, -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880,
+	-1.0 / 39916800, 1.0 / 6227020800.0, -1.0 / 1307674368000.0 };
+static const double _cos_c[] = { 1, -1.0 / 2, 1.0 / 24, -1.0 / 720, 1.0 / 40320,
+	-1.0 / 3628800, 1.0 / 479001600, -1.0 / 87178291200.0, 1.0 / 20922789888000.0 };
+
+/* atan(t) = t * (1 - s/3 + s^2/5 - ...) */
+static const double _atan_c[] = { 1, -1.0 / 3, 1.0 / 5, -1.0 / 7, 1.0 / 9, -1.0 / 11, 1.0 / 13, -1.0 / 15,
+	1.0 / 17, -1.0 / 19, 1.0 / 21, -1.0 / 23, 1.0 / 25, -1.0 / 27, 1.0 / 29, -1.0 / 31,
+	1.0 / 33, -1.0 / 35, 1.0 / 37, -1.0 / 39, 1.0 / 41, -1.0 / 43 };
+
+#define TERMS(c) ((int) (sizeof(c) / sizeof(c[0])))
+
+/* Number of terms for relative error < 1e-7 (FORMULA_APPROX) */
+#define EXP_APPROX_TERMS 8
+#define LOG_APPROX_TERMS 5
+#define SIN_APPROX_TERMS 5
+#define COS_APPROX_TERMS 6
+#define ATAN_APPROX_TERMS 10
+
+/* p[k] = c[0] + c[1]*x[k] + ... + c[terms - 1]*x[k]^(terms - 1) */
+static void _horner(const double *c, int terms, const double *x, double *p, int n)
+{
+	int j, k;
+	for(k = 0; k < n; k ++)
+		p[k] = c[terms - 1];
+	for(j = terms - 2; j >= 0; j --)
+		for(k = 0; k < n; k ++)
+			p[k] = p[k] * x[k] + c[j];
+}
+
+static inline uint64_t _bits(double x)
+{
+	uint64_t u;
+	memcpy(&u, &x, sizeof(u));
+	return u;
+}
+
+static inline double _double(uint64_t u)
+{
+	double x;
+	memcpy(&x, &u, sizeof(x));
+	return x;
+}
+
+/* exp(x) = 2^k * exp(r), where x = k*ln(2) + r, |r| <= ln(2)/2 */
+static void _exp(const double *a, double *out, int n, int approx)
+{
+	double r[VEC_BLOCK], scale[VEC_BLOCK];
+	int k;
+
+	for(k = 0; k < n; k ++)
+	{
+		double x = (a[k] >= -708 && a[k] <= 708) ? a[k] : 0;
+		double t = x * LOG2E + ROUND_MAGIC, e = t - ROUND_MAGIC;
+
+		/* The lowest bits of t are e (two's complement) */
+		scale[k] = _double(((_bits(t) + 1023) & 0x7ff) << 52);
+		r[k] = (x - e * LN2_HI) - e * LN2_LO;
+	}
+
+	_horner(_exp_c, approx ? EXP_APPROX_TERMS : TERMS(_exp_c), r, out, n);
+	for(k = 0; k < n; k ++)
+		out[k] *= scale[k];
+
+	for(k = 0; k < n; k ++)
+		if(!(a[k] >= -708 && a[k] <= 708))
+			out[k] = exp(a[k]);
+}
+
+/* x = 2^e * m, sqrt(2)/2 <= m < sqrt(2): ln(x) = e*ln(2) + ln(m) */
+static void _log(int action, const double *a, double *out, int n, int approx)
+{
+	double f[VEC_BLOCK], s[VEC_BLOCK], e[VEC_BLOCK];
+	int k;
+
+	for(k = 0; k < n; k ++)
+	{
+		uint64_t u = _bits((a[k] >= DBL_MIN && a[k] <= DBL_MAX) ? a[k] : 1);
+		double m = _double((u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+
+		/* Exponent field as a double: 2^52 + field is 0x433... with the field in the lowest bits */
+		double ek = (_double((u >> 52) | 0x4330000000000000ULL) - 4503599627370496.0) - 1023;
+
+		int big = m > SQRT2;
+		m = big ? m * 0.5 : m;
+		e[k] = big ? ek + 1 : ek;
+		f[k] = (m - 1) / (m + 1);
+		s[k] = f[k] * f[k];
+	}
+
+	/* The first term 2f is added last (it's the largest one) */
+	_horner(_log_c + 1, (approx ? LOG_APPROX_TERMS : TERMS(_log_c)) - 1, s, out, n);
+
+	for(k = 0; k < n; k ++)
+	{
+		double lm = 2 * f[k] + 2 * f[k] * s[k] * out[k];
+		if(action == F_LN)
+			out[k] = e[k] * LN2_HI + (lm + e[k] * LN2_LO);
+		else if(action == F_LG)
+			out[k] = e[k] * LOG10_2_HI + (lm * INV_LN10 + e[k] * LOG10_2_LO);
+		else
+			out[k] = e[k] + lm * LOG2E;
+	}
+
+	for(k = 0; k < n; k ++)
+		if(!(a[k] >= DBL_MIN && a[k] <= DBL_MAX))
+			out[k] = _calc(action, a[k], 0);
+}
+
+/*
+	x = q*pi/2 + r, |r| <= pi/4: sin(r), cos(r) and q (modulo 4).
+	r is kept as r + rl (rl is the rounding error of r), and the first terms
+	of the series are added last, so that tan() and ctg(), which divide
+	one by another, lose as few bits as possible.
+*/
+static void _sincos(const double *a, double *sin_r, double *cos_r, uint64_t *q, int n, int approx)
+{
+	double r[VEC_BLOCK], rl[VEC_BLOCK], s[VEC_BLOCK], p[VEC_BLOCK];
+	int k;
+
+	for(k = 0; k < n; k ++)
+	{
+		double x = (a[k] >= -TRIG_MAX && a[k] <= TRIG_MAX) ? a[k] : 0;
+		double t = x * TWO_OVER_PI + ROUND_MAGIC, e = t - ROUND_MAGIC;
+		q[k] = _bits(t) & 3;
+
+		/* e * PIO2_* are exact, and so is w */
+		double w = x - e * PIO2_1, y = e * PIO2_2;
+		double r1 = w - y, d = r1 - w;
+		double err = (w - (r1 - d)) - (y + d); /* w - y = r1 + err exactly */
+		double lo = err - (e * PIO2_3 + e * PIO2_3T);
+
+		r[k] = r1 + lo;
+		rl[k] = lo - (r[k] - r1);
+		s[k] = r[k] * r[k];
+	}
+
+	/* sin(r + rl) = r + r*s*(-1/3! + s/5! - ...) + rl*cos(r) */
+	_horner(_sin_c + 1, (approx ? SIN_APPROX_TERMS : TERMS(_sin_c)) - 1, s, p, n);
+	for(k = 0; k < n; k ++)
+		sin_r[k] = r[k] + (r[k] * s[k] * p[k] + rl[k] * (1 - 0.5 * s[k]));
+
+	/* cos(r + rl) = (1 - s/2) + s^2*(1/4! - s/6! + ...) - r*rl, where 1 - s/2 is split as in fdlibm */
+	_horner(_cos_c + 2, (approx ? COS_APPROX_TERMS : TERMS(_cos_c)) - 2, s, p, n);
+	for(k = 0; k < n; k ++)
+	{
+		double hs = 0.5 * s[k], w = 1 - hs;
+		cos_r[k] = w + (((1 - w) - hs) + (s[k] * s[k] * p[k] - r[k] * rl[k]));
+	}
+}
+
+static void _trig(int action, const double *a, double *out, int n, int approx)
+{
+	double sin_r[VEC_BLOCK], cos_r[VEC_BLOCK];
+	uint64_t q[VEC_BLOCK];
+	int k;
+
+	_sincos(a, sin_r, cos_r, q, n, approx);
+
+	for(k = 0; k < n; k ++)
+	{
+		double v;
+		if(action == F_SIN)
+		{ /* sin(r), cos(r), -sin(r), -cos(r) */
+			v = (q[k] & 1) ? cos_r[k] : sin_r[k];
+			v = (q[k] & 2) ? -v : v;
+		}
+		else if(action == F_COS)
+		{ /* cos(r), -sin(r), -cos(r), sin(r) */
+			v = (q[k] & 1) ? sin_r[k] : cos_r[k];
+			v = ((q[k] + 1) & 2) ? -v : v;
+		}
+		else if(action == F_TAN)
+			v = (q[k] & 1) ? -cos_r[k] / sin_r[k] : sin_r[k] / cos_r[k];
+		else /* one division, not 1 / tan(x); NAN where tan(x) is 0, as in _calc() */
+			v = (q[k] & 1) ? -sin_r[k] / cos_r[k] : (sin_r[k] != 0 ? cos_r[k] / sin_r[k] : NAN);
+		out[k] = v;
+	}
+
+	for(k = 0; k < n; k ++)
+		if(!(a[k] >= -TRIG_MAX && a[k] <= TRIG_MAX))
+			out[k] = _calc(action, a[k], 0);
+}
+
+/*
+	atan(x): |x| > 1 is reduced with atan(x) = pi/2 - atan(1/x),
+	then t > tan(pi/8) with atan(t) = pi/4 + atan((t-1)/(t+1)).
+*/
+static void _atan(const double *a, double *out, int n, int approx)
+{
+	double t[VEC_BLOCK], s[VEC_BLOCK];
+	int inv[VEC_BLOCK], mid[VEC_BLOCK];
+	int k;
+
+	for(k = 0; k < n; k ++)
+	{
+		double x = fabs(a[k]);
+		inv[k] = x > 1;
+		x = inv[k] ? 1 / x : x;
+		mid[k] = x > TAN_PI_8;
+		t[k] = mid[k] ? (x - 1) / (x + 1) : x;
+		s[k] = t[k] * t[k];
+	}
+
+	_horner(_atan_c + 1, (approx ? ATAN_APPROX_TERMS : TERMS(_atan_c)) - 1, s, out, n);
+
+	for(k = 0; k < n; k ++)
+	{
+		double r = t[k] + t[k] * s[k] * out[k];
+		r = mid[k] ? PIO4_HI + (PIO4_LO + r) : r;
+		r = inv[k] ? PIO2_HI + (PIO2_LO - r) : r;
+		out[k] = a[k] < 0 ? -r : r;
+	}
+}
+
+/* asin(x) = atan(x / sqrt(1 - x^2)), acos(x) = 2 * atan(sqrt((1 - x) / (1 + x))) */
+static void _asin(int action, const double *a, double *out, int n, int approx)
+{
+	double y[VEC_BLOCK];
+	int k;
+
+	for(k = 0; k < n; k ++)
+	{
+		double x = (a[k] >= -1 && a[k] <= 1) ? a[k] : 0;
+		y[k] = action == F_ASIN ? x / sqrt((1 - x) * (1 + x)) : sqrt((1 - x) / (1 + x));
+	}
+
+	_atan(y, out, n, approx);
+	for(k = 0; k < n; k ++)
+		out[k] = action == F_ASIN ? out[k] : 2 * out[k];
+
+	for(k = 0; k < n; k ++)
+		if(!(a[k] >= -1 && a[k] <= 1))
+			out[k] = _calc(action, a[k], 0);
+}
+
+/* Integer powers by multiplications, exp(y * ln(x)) for FORMULA_APPROX */
+static void _pow(const double *a, const double *b, double *out, int n, int approx)
+{
+	double t[VEC_BLOCK], e[VEC_BLOCK];
+	int m[VEC_BLOCK]; /* |b[k]| if it's an integer from 1 to VEC_POW_MAX, 0 otherwise */
+	int k, j;
+
+	for(k = 0; k < n; k ++)
+	{
+		double y = fabs(b[k]);
+		m[k] = (y >= 1 && y <= VEC_POW_MAX && y == (int) y) ? (int) y : 0;
+		t[k] = a[k];
+		out[k] = 1;
+	}
+	for(j = 1; j <= VEC_POW_MAX; j <<= 1)
+		for(k = 0; k < n; k ++)
+		{ /* t[k] is a[k]^j, it is multiplied in if bit j of m[k] is set */
+			out[k] = (m[k] & j) ? out[k] * t[k] : out[k];
+			t[k] *= t[k];
+		}
+	for(k = 0; k < n; k ++)
+		out[k] = b[k] < 0 ? 1 / out[k] : out[k];
+
+	if(approx)
+	{
+		_log(F_LN, a, t, n, 1);
+		for(k = 0; k < n; k ++)
+			t[k] *= b[k];
+		_exp(t, e, n, 1);
+	}
+
+	for(k = 0; k < n; k ++)
+		if(!m[k])
+		{
+			if(approx && a[k] > 0 && a[k] <= DBL_MAX && fabs(b[k]) <= DBL_MAX)
+				out[k] = e[k];
+			else
+				out[k] = (isnan(a[k]) || isnan(b[k])) ? NAN : pow(a[k], b[k]);
+		}
+}
+
+/* Like _calc() for each value, but the result is NAN if any of the operands is NAN */
+static void _vec_block(int action, const double *a, const double *b, double *out, int n, int precision)
+{
+	int k, approx = precision == FORMULA_APPROX;
+	switch(action)
+	{
+		case F_NOT:
+			for(k = 0; k < n; k ++) out[k] = -a[k];
+			return;
+		case F_ADD:
+			for(k = 0; k < n; k ++) out[k] = a[k] + b[k];
+			return;
+		case F_SUB:
+			for(k = 0; k < n; k ++) out[k] = a[k] - b[k];
+			return;
+		case F_MUL:
+			for(k = 0; k < n; k ++) out[k] = a[k] * b[k];
+			return;
+		case F_DIV:
+			for(k = 0; k < n; k ++) out[k] = b[k] ? a[k] / b[k] : NAN;
+			return;
+		case F_ABS:
+			for(k = 0; k < n; k ++) out[k] = fabs(a[k]);
+			return;
+		case F_D2R:
+			for(k = 0; k < n; k ++) out[k] = a[k] * 3.14 / 180;
+			return;
+	}
+
+	if(precision != FORMULA_EXACT)
+		switch(action)
+		{
+			case F_EXP:
+				_exp(a, out, n, approx);
+				return;
+			case F_LN:
+			case F_LG:
+			case F_LOG2:
+				_log(action, a, out, n, approx);
+				return;
+			case F_SIN:
+			case F_COS:
+			case F_TAN:
+			case F_CTG:
+				_trig(action, a, out, n, approx);
+				return;
+			case F_ATAN:
+				_atan(a, out, n, approx);
+				return;
+			case F_ASIN:
+			case F_ACOS:
+				_asin(action, a, out, n, approx);
+				return;
+			case F_POW:
+				_pow(a, b, out, n, approx);
+				return;
+		}
+
+	for(k = 0; k < n; k ++)
+		out[k] = (isnan(a[k]) || (b && isnan(b[k]))) ? NAN : _calc(action, a[k], b ? b[k] : 0);
+}
+
+void _vec_calc(F_TYPE action, const double *a, const double *b, double *out, int n, int precision)
+{
+	int start;
+	for(start = 0; start < n; start += VEC_BLOCK)
+		_vec_block(action, a + start, b ? b + start : NULL, out + start,
+			n - start < VEC_BLOCK ? n - start : VEC_BLOCK, precision);
+}